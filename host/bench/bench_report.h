@@ -0,0 +1,51 @@
+#pragma once
+#include "capture_pipeline.h"
+#include "HCS301.h"
+
+/* Output shared by the host tools. */
+
+static void report(const char *pass, uint32_t frames, int64_t elapsed_us)
+{
+  double seconds = elapsed_us / 1e6;
+  printf("%-10s %8u frames %10.3f ms %12.0f frames/s %8.3f us/frame\n", pass, frames, elapsed_us / 1e3,
+         seconds > 0 ? frames / seconds : 0.0, frames ? (double)elapsed_us / frames : 0.0);
+}
+
+template <typename Index>
+static void printDecoders(const Index &index)
+{
+  for (auto decoder : index.decoders) {
+    uint32_t calls = decoder->stats.hits + decoder->stats.misses;
+    printf("  %-10s %8u hits %8u misses %8.3f us/call\n", decoder->name, decoder->stats.hits, decoder->stats.misses,
+           calls ? (double)decoder->stats.time_us / calls : 0.0);
+  }
+}
+
+static void printAllDecoders()
+{
+  printDecoders(pwm_decoders);
+  printDecoders(manchester_decoders);
+  printDecoders(pulse_distance_decoders);
+}
+
+static void printKeeloqStats(HCS301 &hcs301)
+{
+  cJSON *json = cJSON_CreateObject();
+  hcs301.serializeKeeloqStats(json);
+  printf("  keeloq    ");
+  for (cJSON *item = json->child; item; item = item->next) {
+    printf(" %s %u", item->string, (unsigned)item->valuedouble);
+  }
+  printf("\n");
+  cJSON_Delete(json);
+}
+
+static void printPipelineStats()
+{
+  cJSON *json = cJSON_CreateObject();
+  capture_pipeline_serialize_stats(json);
+  char *str = cJSON_Print(json);
+  printf("%s\n", str);
+  cJSON_free(str);
+  cJSON_Delete(json);
+}
@@ -0,0 +1,285 @@
+/*
+ * KeeLoq cipher, HCS301 counter window, button tracker and remote table: test vectors, then timings.
+ *
+ *   keeloq_bench [-n iterations]
+ *
+ * Exits with 1 if any vector or window case fails.
+ */
+#include "HCS301.h"
+
+#include <unistd.h>
+
+static int failures = 0;
+
+static void expect(const char *what, uint64_t got, uint64_t want)
+{
+  bool ok = got == want;
+  failures += !ok;
+  printf("  %-4s %-40s got 0x%llx", ok ? "ok" : "FAIL", what, (unsigned long long)got);
+  if (!ok) {
+    printf(", want 0x%llx", (unsigned long long)want);
+  }
+  printf("\n");
+}
+
+static void vectors()
+{
+  const uint64_t key = 0x5CEC6701B79FD949ULL;
+  printf("cipher\n");
+  expect("encrypt", keeloq::encrypt(0xF741E2DB, key), 0xE44F4CDF);
+  expect("decrypt", keeloq::decrypt(0xE44F4CDF, key), 0xF741E2DB);
+  uint32_t x = 0x12345678;
+  for (int i = 0; i < 1000; i++) {
+    x = keeloq::encrypt(x, key + i);
+  }
+  for (int i = 999; i >= 0; i--) {
+    x = keeloq::decrypt(x, key + i);
+  }
+  expect("1000 encryptions undone", x, 0x12345678);
+  expect("simple learning", keeloq::deviceKey(0x1234567, key, KEELOQ_LEARNING_SIMPLE), key);
+  uint64_t device_key = keeloq::deviceKey(0x1234567, key, KEELOQ_LEARNING_NORMAL);
+  expect("normal learning, low word", keeloq::encrypt(device_key, key), 0x1234567 | KEELOQ_LEARN_LOW);
+  expect("normal learning, high word", keeloq::encrypt(device_key >> 32, key), 0x1234567 | KEELOQ_LEARN_HIGH);
+}
+
+/* A code word from remote `serial` with `device_key`. */
+static HCS301_t codeWord(uint32_t serial, uint64_t device_key, uint8_t buttons, uint16_t counter)
+{
+  HCS301_t frame;
+  frame.preamble = 0xfff;
+  frame.serial = serial;
+  frame.buttons = buttons;
+  frame.encrypted = keeloq::encrypt((uint32_t)frame.hopping_buttons() << 28 | (serial & 0x3ff) << 16 | counter, device_key);
+  return frame;
+}
+
+static void window()
+{
+  const uint32_t serial = 0x001C4A01;
+  const uint64_t device_key = keeloq::deviceKey(serial, 0x0123456789ABCDEFULL, KEELOQ_LEARNING_NORMAL);
+  hcs301_remote_t remote(serial, device_key);
+  uint16_t counter;
+  uint32_t now_ms = 0;
+  // Frames 100 ms apart, well within the release time, unless `after_ms` says otherwise.
+  auto check = [&](const HCS301_t &frame, uint32_t after_ms = 100) {
+    return remote.check(frame, &counter, now_ms += after_ms, BUTTON_RELEASE_MS);
+  };
+  printf("counter window\n");
+  expect("first code word resyncs", check(codeWord(serial, device_key, 2, 100)), HCS301_RESYNC);
+  expect("its repeat too", check(codeWord(serial, device_key, 2, 100)), HCS301_RESYNC);
+  expect("next one is accepted", check(codeWord(serial, device_key, 2, 101)), HCS301_ACCEPTED);
+  expect("counter", counter, 101);
+  expect("repeat", check(codeWord(serial, device_key, 2, 101)), HCS301_REPEATED);
+  expect("repeat after the press ended", check(codeWord(serial, device_key, 2, 101), BUTTON_RELEASE_MS + 1),
+         HCS301_OUT_OF_WINDOW);
+  expect("and its repeats", check(codeWord(serial, device_key, 2, 101)), HCS301_OUT_OF_WINDOW);
+  expect("replay of an older code word", check(codeWord(serial, device_key, 2, 100)), HCS301_OUT_OF_WINDOW);
+  expect("skip within the open window", check(codeWord(serial, device_key, 4, 101 + HCS301_OPEN_WINDOW)),
+         HCS301_ACCEPTED);
+  expect("skip past the open window", check(codeWord(serial, device_key, 4, 1000)), HCS301_RESYNC);
+  expect("not followed by the next code word", check(codeWord(serial, device_key, 4, 1005)), HCS301_RESYNC);
+  expect("followed by it", check(codeWord(serial, device_key, 4, 1006)), HCS301_ACCEPTED);
+  expect("one behind", check(codeWord(serial, device_key, 4, 1005)), HCS301_OUT_OF_WINDOW);
+  expect("wrong key", check(codeWord(serial, device_key + 1, 4, 1007)), HCS301_BAD_DECRYPT);
+  HCS301_t mismatch = codeWord(serial, device_key, 4, 1007);
+  mismatch.buttons = 8;
+  expect("buttons differ from the hopping code", check(mismatch), HCS301_BAD_DECRYPT);
+  expect("other serial's discrimination", check(codeWord(serial + 1, device_key, 4, 1007)), HCS301_BAD_DECRYPT);
+  expect("decryptions (repeats skip them)", remote.decrypts, 11);
+
+  // A reboot: the counter saved before it, 1006, is all that is left.
+  hcs301_remote_t rebooted(serial, device_key);
+  rebooted.restore(1006);
+  auto recheck = [&](const HCS301_t &frame) {
+    return rebooted.check(frame, &counter, now_ms += 100, BUTTON_RELEASE_MS);
+  };
+  expect("after a reboot: a recorded pair", recheck(codeWord(serial, device_key, 4, 1005)), HCS301_OUT_OF_WINDOW);
+  expect("its second code word", recheck(codeWord(serial, device_key, 4, 1006)), HCS301_OUT_OF_WINDOW);
+  expect("a press ahead of the saved counter", recheck(codeWord(serial, device_key, 4, 1008)), HCS301_RESYNC);
+  expect("and the next one", recheck(codeWord(serial, device_key, 4, 1009)), HCS301_ACCEPTED);
+  rebooted = hcs301_remote_t(serial, device_key);
+  recheck(codeWord(serial, device_key, 4, 1005));
+  expect("with nothing saved, the pair resyncs", recheck(codeWord(serial, device_key, 4, 1006)), HCS301_ACCEPTED);
+}
+
+/*
+ * A press of the remote the firmware used to be configured with as serial
+ * 0x001C4A01, as the PWM decoder hands it over: 12 preamble bits, then the
+ * code word LSB first. The old parser read the serial from bits 48..71 a byte
+ * at a time; it is 0x014A1C5 read LSB first from bit 44.
+ */
+static const uint8_t legacy_frame[10] = { 0xff, 0xf8, 0x95, 0xcd, 0x4b, 0xaa, 0x38, 0x52, 0x80, 0x20 };
+
+static bool decodeFrame(HCS301 &decoder, const uint8_t *buf, uint32_t time_ms = millis())
+{
+  static pwm_message_t pwm_msg;
+  static rmt_message_t rmt_msg;
+  memcpy(pwm_msg.buf, buf, 10);
+  pwm_msg.length = 78;
+  rmt_msg.length = 78;
+  rmt_msg.time = time_ms;
+  return decoder.decode_pwm(&pwm_msg, &rmt_msg);
+}
+
+static void legacy()
+{
+  HCS301_t frame;
+  frame.update(legacy_frame);
+  printf("legacy serial\n");
+  expect("preamble", frame.is_valid(), 1);
+  expect("serial", frame.serial, 0x014A1C5);
+  expect("serial as the old parser read it", frame.legacy_serial(), 0x001C4A01);
+  expect("hopping code", frame.encrypted, 0x5D2B3A91);
+  expect("buttons", frame.buttons, 2);
+
+  HCS301 plain(0);
+  plain.enroll(HCS301_SERIAL_LEGACY | 0x001C4A01);
+  expect("no key: legacy remote matches", decodeFrame(plain, legacy_frame), 1);
+  expect("and is moved to the whole serial", plain.remove(0x014A1C5), 1);
+  expect("legacy entry is gone", plain.remove(HCS301_SERIAL_LEGACY | 0x001C4A01), 0);
+  plain.enroll(0x014A1C5);
+  expect("no key: a press", decodeFrame(plain, legacy_frame, 1000), 1);
+  expect("its repeat", decodeFrame(plain, legacy_frame, 1100), 1);
+  expect("the same code word after the press ended", decodeFrame(plain, legacy_frame, 1101 + BUTTON_RELEASE_MS), 0);
+
+  // The same remote programmed with a manufacturer key: the frame must decrypt before it is migrated.
+  const uint64_t manufacturer_key = 0x0123456789ABCDEFULL;
+  HCS301 keyed(manufacturer_key);
+  keyed.enroll(HCS301_SERIAL_LEGACY | 0x001C4A01);
+  expect("wrong key: not matched", decodeFrame(keyed, legacy_frame), 0);
+  expect("and still legacy", keyed.remove(0x014A1C5), 0);
+  HCS301_t press = codeWord(0x014A1C5, keeloq::deviceKey(0x014A1C5, manufacturer_key, KEELOQ_LEARNING_NORMAL), 2, 7);
+  uint8_t buf[10];
+  memcpy(buf, legacy_frame, sizeof(buf));
+  for (int i = 0; i < 32; i++) {
+    uint16_t pos = 12 + i;
+    buf[pos / 8] = (buf[pos / 8] & ~(0x80 >> pos % 8)) | ((press.encrypted >> i & 1) << 7 >> pos % 8);
+  }
+  expect("decrypting code word: a resync, not a hit", decodeFrame(keyed, buf), 0);
+  expect("but migrated to the whole serial", keyed.remove(0x014A1C5), 1);
+}
+
+static void buttons()
+{
+  ButtonTracker tracker;
+  uint32_t presses = 0;
+  uint32_t releases = 0;
+  tracker.setSink([&](const button_event_t &event) {
+    presses += event.type == BUTTON_PRESS;
+    releases += event.type == BUTTON_RELEASE;
+  });
+  printf("button tracker\n");
+  tracker.frame(1, 2, 1000, true);
+  expect("a repeat does not start a press", presses, 0);
+  tracker.frame(1, 2, 1100);
+  tracker.frame(1, 2, 1200, true);
+  expect("a new code word does", presses, 1);
+  tracker.frame(1, 4, 1300, true);
+  expect("a repeat with other buttons does not end it", releases, 0);
+  tracker.frame(1, 2, 1150 + BUTTON_RELEASE_MS, true);
+  expect("a repeat keeps it going", releases, 0);
+  tracker.frame(1, 2, 1200 + 2 * BUTTON_RELEASE_MS, true);
+  expect("after the release, a repeat is no press", presses, 1);
+  expect("the press was released", releases, 1);
+}
+
+static void table()
+{
+  HCS301Remotes remotes;
+  std::vector<uint32_t> serials;
+  uint32_t x = 1;
+  for (int i = 0; i < HCS301_MAX_REMOTES; i++) {
+    x = x * 1103515245 + 12345;
+    serials.push_back(x & 0x0fffffff);
+    remotes.insert(hcs301_remote_t(serials.back()));
+  }
+  printf("remote table\n");
+  expect("full", remotes.size(), HCS301_MAX_REMOTES);
+  expect("one more is refused", remotes.insert(hcs301_remote_t(0x0abcdef)) == nullptr, 1);
+  expect("replacing a remote is not", remotes.insert(hcs301_remote_t(serials[3])) != nullptr, 1);
+  for (size_t i = 0; i < serials.size(); i += 2) {
+    remotes.remove(serials[i]);
+  }
+  size_t found = 0;
+  size_t gone = 0;
+  for (size_t i = 0; i < serials.size(); i++) {
+    hcs301_remote_t *remote = remotes.find(serials[i]);
+    found += remote && remote->serial == serials[i];
+    gone += remote == nullptr;
+  }
+  expect("kept after removing every other one", found, HCS301_MAX_REMOTES / 2);
+  expect("removed", gone, HCS301_MAX_REMOTES / 2);
+  expect("removing twice", remotes.remove(serials[0]), 0);
+  hcs301_remote_t mapped(1);
+  mapped.button_map = HCS301_BUTTONS_IDENTITY;
+  expect("identity button map", mapped.mapButtons(9), 9);
+  uint64_t button_map = (HCS301_BUTTONS_IDENTITY & ~(0xfULL << 8)) | 4ULL << 8;
+  mapped.button_map = button_map;
+  expect("mapped buttons", mapped.mapButtons(2), 4);
+}
+
+template <typename F>
+static void time(const char *what, uint32_t iterations, F f)
+{
+  volatile uint32_t sink = 0;
+  int64_t start = esp_timer_get_time();
+  for (uint32_t i = 0; i < iterations; i++) {
+    sink = sink + f(i);
+  }
+  int64_t elapsed = esp_timer_get_time() - start;
+  printf("  %-30s %10.1f ns/op\n", what, elapsed * 1000.0 / iterations);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t iterations = 200000;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+      case 'n': iterations = strtoul(optarg, NULL, 0); break;
+      default:
+        fprintf(stderr, "usage: %s [-n iterations]\n", argv[0]);
+        return 2;
+    }
+  }
+
+  vectors();
+  window();
+  legacy();
+  buttons();
+  table();
+
+  const uint32_t serial = 0x001C4A01;
+  const uint64_t device_key = keeloq::deviceKey(serial, 0x0123456789ABCDEFULL, KEELOQ_LEARNING_NORMAL);
+  const keeloq_key_t schedule(device_key);
+  printf("\ntimings\n");
+  time("encrypt", iterations, [&](uint32_t i) { return keeloq::encrypt(i, device_key); });
+  time("decrypt", iterations, [&](uint32_t i) { return keeloq::decrypt(i, schedule); });
+  time("normal learning key", iterations / 2, [&](uint32_t i) {
+    return (uint32_t)keeloq::deviceKey(i, device_key, KEELOQ_LEARNING_NORMAL);
+  });
+  hcs301_remote_t remote(serial, device_key);
+  std::vector<HCS301_t> presses;
+  for (uint32_t i = 0; i < 1024; i++) {
+    presses.push_back(codeWord(serial, device_key, 2, i));
+  }
+  uint16_t counter;
+  time("check, new code word", iterations, [&](uint32_t i) {
+    return remote.check(presses[i % 1024], &counter, i, BUTTON_RELEASE_MS);
+  });
+  time("check, repeat", iterations, [&](uint32_t i) { return remote.check(presses[0], &counter, 0, BUTTON_RELEASE_MS); });
+  HCS301Remotes remotes;
+  std::vector<uint32_t> serials;
+  for (uint32_t i = 0; i < HCS301_MAX_REMOTES; i++) {
+    serials.push_back((i * 0x9E3779B1u) & 0x0fffffff);
+    remotes.insert(hcs301_remote_t(serials.back()));
+  }
+  time("find, full table", iterations, [&](uint32_t i) {
+    return remotes.find(serials[i % HCS301_MAX_REMOTES]) != nullptr;
+  });
+  time("find, unknown serial", iterations, [&](uint32_t i) { return remotes.find(i | 0x08000000) != nullptr; });
+
+  printf("\n%s\n", failures ? "FAILED" : "all vectors passed");
+  fflush(stdout);
+  quick_exit(failures ? 1 : 0);
+}
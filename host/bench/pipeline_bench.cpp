@@ -0,0 +1,193 @@
+/*
+ * Capture pipeline benchmark on the host.
+ *
+ *   pipeline_bench [-n frames] [-r repeats] [-p period_us] [-w capture.pvc] [-v]
+ *
+ * Feeds SyntheticSource captures through the same code the device runs and
+ * reports these passes:
+ *
+ *   classify   PWM packing, the float reference and PWMDecoder::pack(); their
+ *              output must match bit for bit.
+ *   serialize  ws_frame::encodeCapture alone.
+ *   inline     capture_submit + capture_process on one thread: decode cost.
+ *   threaded   the source feeds rmt_parse_task through the real pool and queue,
+ *              one capture every `period_us` (0: as fast as possible); drops
+ *              show where the parser falls behind.
+ *
+ * followed by the per-decoder results and the /radio/stats counters. With -w,
+ * the captures of the inline pass are also written to a capture file, the same
+ * way the device recorder does, for capture_replay.
+ *
+ * Exits with 1 if the classifiers disagree on any frame.
+ */
+#include "capture_pipeline.h"
+#include "HCS301.h"
+#include "fixed_code.h"
+#include "synthetic_source.h"
+#include "capture_file.h"
+#include "bench_report.h"
+#include "pwm_golden.h"
+
+#include <unistd.h>
+#include <chrono>
+#include <thread>
+
+/* The remote the firmware is seeded with, 0x001C4A01 as the old parser read it. */
+#define HCS301_SERIAL 0x014A1C5
+#define HCS301_BENCH_KEY 0x0123456789ABCDEFULL
+
+/* The synthetic HCS301 counter carries over from pass to pass, as on a real remote. */
+static const uint64_t hcs301_device_key = keeloq::deviceKey(HCS301_SERIAL, HCS301_BENCH_KEY, KEELOQ_LEARNING_NORMAL);
+static uint16_t hcs301_counter = 1;
+
+struct broadcast_stats_t {
+  uint32_t frames[4];
+  uint64_t bytes[4];
+};
+
+static broadcast_stats_t broadcast_stats;
+
+static void bench_broadcast(uint8_t *data, size_t len, uint32_t subscribers)
+{
+  uint8_t type = len > 1 && data[1] < 4 ? data[1] : 0;
+  broadcast_stats.frames[type]++;
+  broadcast_stats.bytes[type] += len;
+}
+
+static bool classifyPass(uint32_t frames, uint8_t repeats)
+{
+  SyntheticSource source(frames, repeats, HCS301_SERIAL);
+  source.setHcs301Key(hcs301_device_key, 1);
+  PwmGolden golden;
+  golden.run(source);
+  return golden.print();
+}
+
+static void serializePass(uint32_t frames, uint8_t repeats)
+{
+  SyntheticSource source(frames, repeats, HCS301_SERIAL);
+  static rmt_message_t msg;
+  uint8_t frame[WS_FRAME_MAX_SIZE];
+  uint64_t bytes = 0;
+  uint64_t symbols = 0;
+  int64_t elapsed = 0;
+  size_t n;
+  int64_t time_us;
+  while ((n = source.next(msg.buf, DECODER_MAX_SYMBOLS, &msg.rssi, &time_us)) > 0) {
+    msg.length = n;
+    int64_t start = esp_timer_get_time();
+    bytes += ws_frame::encodeCapture(&msg, frame, sizeof(frame));
+    elapsed += esp_timer_get_time() - start;
+    symbols += n;
+  }
+  report("serialize", frames, elapsed);
+  printf("           %.2f bytes/symbol, %.1f bytes/frame\n", symbols ? (double)bytes / symbols : 0.0,
+         frames ? (double)bytes / frames : 0.0);
+}
+
+static CaptureFileWriter capture_writer;
+
+static void inlinePass(uint32_t frames, uint8_t repeats)
+{
+  SyntheticSource source(frames, repeats, HCS301_SERIAL);
+  source.setHcs301Key(hcs301_device_key, hcs301_counter);
+  rmt_source_stats_t stats = {};
+  uint8_t frame[WS_FRAME_MAX_SIZE];
+  rmt_message_t *msg;
+  int64_t start = esp_timer_get_time();
+  while (rmt_source_feed(source, &stats)) {
+    while (xQueueReceive(rmt_parse_queue, &msg, 0) == pdTRUE) {
+      capture_process(msg, frame);
+    }
+  }
+  repeat_folder.flushAll();
+  report("inline", stats.frames, esp_timer_get_time() - start);
+  capture_tap = nullptr;
+  hcs301_counter = source.hcs301Counter();
+}
+
+static void threadedPass(uint32_t frames, uint8_t repeats, uint32_t period_us)
+{
+  SyntheticSource source(frames, repeats, HCS301_SERIAL, 2);
+  source.setHcs301Key(hcs301_device_key, hcs301_counter);
+  rmt_source_stats_t stats = {};
+  xTaskCreate(rmt_parse_task, "rmt_parse_task", 1024 * 8, NULL, 1, NULL);
+  int64_t start = esp_timer_get_time();
+  int64_t next = start;
+  while (rmt_source_feed(source, &stats)) {
+    if (period_us) {
+      next += period_us;
+      std::this_thread::sleep_until(std::chrono::steady_clock::now() + std::chrono::microseconds(next - esp_timer_get_time()));
+    }
+  }
+  while (capture_pool.getStats().in_use > 0) {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+  report("threaded", stats.frames, esp_timer_get_time() - start);
+  printf("           %u dropped (%.1f%%), pool high water %u of %u\n", stats.dropped,
+         stats.frames ? 100.0 * stats.dropped / stats.frames : 0.0, capture_pool.getStats().high_water, CAPTURE_POOL_SIZE);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t frames = 100000;
+  uint8_t repeats = 5;
+  uint32_t period_us = 0;
+  FILE *record = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:r:p:w:v")) != -1) {
+    switch (opt) {
+      case 'n': frames = strtoul(optarg, NULL, 0); break;
+      case 'r': repeats = strtoul(optarg, NULL, 0); break;
+      case 'p': period_us = strtoul(optarg, NULL, 0); break;
+      case 'w':
+        record = fopen(optarg, "wb");
+        if (record == NULL || !capture_writer.begin(record)) {
+          perror(optarg);
+          return 1;
+        }
+        break;
+      case 'v': esp_log_level_set("*", ESP_LOG_DEBUG); break;
+      default:
+        fprintf(stderr, "usage: %s [-n frames] [-r repeats] [-p period_us] [-w capture.pvc] [-v]\n", argv[0]);
+        return 2;
+    }
+  }
+
+  HCS301 hcs301(HCS301_BENCH_KEY);
+  hcs301.enroll(HCS301_SERIAL_LEGACY | hcs301_legacy_serial(HCS301_SERIAL));  // as main.cpp does
+  FixedCodeDecoder<EV1527> ev1527;
+  FixedCodeDecoder<PT2262> pt2262;
+  FixedCodeDecoder<HS2303> hs2303;
+  if (!capture_pipeline_init(bench_broadcast)) {
+    return 1;
+  }
+
+  bool classify_ok = classifyPass(frames, repeats);
+  serializePass(frames, repeats);
+  if (record) {
+    capture_tap = [](const rmt_message_t *msg) { capture_writer.write(msg); };
+  }
+  inlinePass(frames, repeats);
+  if (record) {
+    fclose(record);
+  }
+  threadedPass(frames, repeats, period_us);
+
+  printf("\ndecoders (both passes)\n");
+  printAllDecoders();
+  printKeeloqStats(hcs301);
+
+  static const char *types[4] = { "other", "capture", "event", "repeat" };
+  printf("\nbroadcast\n");
+  for (int t = 0; t < 4; t++) {
+    printf("  %-8s %8u frames %10llu bytes\n", types[t], broadcast_stats.frames[t], (unsigned long long)broadcast_stats.bytes[t]);
+  }
+
+  printf("\n");
+  printPipelineStats();
+
+  // The pipeline tasks never return; skip static destructors they could still be using.
+  fflush(stdout);
+  quick_exit(classify_ok ? 0 : 1);
+}
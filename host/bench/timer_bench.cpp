@@ -0,0 +1,187 @@
+/*
+ * Shared timer service: expiry, rearm, cancel and remaining time on the host
+ * esp_timer, then the cost of arming and cancelling with many timers armed.
+ *
+ *   timer_bench [-n iterations] [-t timers]
+ *
+ * Exits with 1 if any case fails. Takes a few seconds: the cases run in real time.
+ */
+#include "timer_service.h"
+
+#include <atomic>
+#include <unistd.h>
+#include <vector>
+
+static int failures = 0;
+
+static void expect(const char *what, int64_t got, int64_t want)
+{
+  bool ok = got == want;
+  failures += !ok;
+  printf("  %-4s %-44s got %lld", ok ? "ok" : "FAIL", what, (long long)got);
+  if (!ok) {
+    printf(", want %lld", (long long)want);
+  }
+  printf("\n");
+}
+
+static void expectRange(const char *what, int64_t got, int64_t low, int64_t high)
+{
+  bool ok = got >= low && got <= high;
+  failures += !ok;
+  printf("  %-4s %-44s got %lld", ok ? "ok" : "FAIL", what, (long long)got);
+  if (!ok) {
+    printf(", want %lld..%lld", (long long)low, (long long)high);
+  }
+  printf("\n");
+}
+
+/* Records when a timer fired. */
+struct probe_t {
+  soft_timer_t timer;
+  int64_t armed_at = 0;
+  std::atomic<int64_t> fired_at{ 0 };
+  std::atomic<int> fired{ 0 };
+
+  probe_t() : timer(fire, this) {}
+
+  static void fire(void *arg) {
+    probe_t *this_ = static_cast<probe_t *>(arg);
+    this_->fired_at = esp_timer_get_time();
+    this_->fired++;
+  }
+
+  void arm(uint32_t timeout_ms) {
+    armed_at = esp_timer_get_time();
+    timer_service.armMs(&timer, timeout_ms);
+  }
+
+  int64_t latencyMs(uint32_t timeout_ms) const {
+    return (fired_at - armed_at) / 1000 - timeout_ms;
+  }
+};
+
+/* Late by at most a tick plus scheduling slack, never early. */
+static const int64_t slack_ms = TIMER_SERVICE_TICK_US / 1000 + 20;
+
+static void basics()
+{
+  printf("one-shot\n");
+  probe_t probe;
+  probe.arm(100);
+  expectRange("remaining right after arming, ms", timer_service.remainingMs(&probe.timer), 99, 100);
+  delay(50);
+  expectRange("remaining halfway, ms", timer_service.remainingMs(&probe.timer), 40, 50);
+  delay(100);
+  expect("fired once", probe.fired, 1);
+  expectRange("late by, ms", probe.latencyMs(100), 0, slack_ms);
+  expect("remaining once fired", timer_service.remainingMs(&probe.timer), -1);
+  delay(50);
+  expect("service idle", timer_service.armed(), 0);
+
+  printf("rearm and cancel\n");
+  probe_t rearmed;
+  rearmed.arm(100);
+  delay(60);
+  rearmed.arm(100);
+  delay(60);
+  expect("pushed out by the rearm", rearmed.fired, 0);
+  delay(80);
+  expect("fired once after the rearm", rearmed.fired, 1);
+  expectRange("late by, ms", rearmed.latencyMs(100), 0, slack_ms);
+  probe_t cancelled;
+  cancelled.arm(50);
+  expect("cancel an armed timer", timer_service.cancel(&cancelled.timer), 1);
+  expect("cancel again", timer_service.cancel(&cancelled.timer), 0);
+  delay(100);
+  expect("cancelled timer did not fire", cancelled.fired, 0);
+}
+
+static void longTimeout()
+{
+  const uint32_t timeout_ms = TIMER_SERVICE_TICK_US / 1000 * TIMER_SERVICE_SLOTS + 300;
+  printf("timeout beyond one wheel turn (%u ms)\n", (unsigned)timeout_ms);
+  probe_t probe;
+  probe.arm(timeout_ms);
+  delay(timeout_ms - 200);
+  expect("not fired a turn early", probe.fired, 0);
+  delay(200 + slack_ms);
+  expect("fired once", probe.fired, 1);
+  expectRange("late by, ms", probe.latencyMs(timeout_ms), 0, slack_ms);
+}
+
+static void many(uint32_t count)
+{
+  printf("%u timers at once\n", (unsigned)count);
+  std::vector<probe_t> probes(count);
+  uint32_t x = 1;
+  std::vector<uint32_t> timeouts;
+  for (uint32_t i = 0; i < count; i++) {
+    x = x * 1103515245 + 12345;
+    timeouts.push_back(20 + (x >> 16) % 500);
+    probes[i].arm(timeouts[i]);
+  }
+  delay(520 + slack_ms);
+  int fired = 0;
+  int early = 0;
+  int64_t worst = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    fired += probes[i].fired;
+    int64_t late = probes[i].latencyMs(timeouts[i]);
+    early += late < 0;
+    worst = MAX(worst, late);
+  }
+  expect("all fired once", fired, count);
+  expect("fired early", early, 0);
+  expectRange("latest, ms", worst, 0, slack_ms);
+}
+
+template <typename F>
+static void time(const char *what, uint32_t iterations, F f)
+{
+  int64_t start = esp_timer_get_time();
+  for (uint32_t i = 0; i < iterations; i++) {
+    f(i);
+  }
+  int64_t elapsed = esp_timer_get_time() - start;
+  printf("  %-30s %10.1f ns/op\n", what, elapsed * 1000.0 / iterations);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t iterations = 200000;
+  uint32_t timers = 1000;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:t:")) != -1) {
+    switch (opt) {
+      case 'n': iterations = strtoul(optarg, NULL, 0); break;
+      case 't': timers = strtoul(optarg, NULL, 0); break;
+      default:
+        fprintf(stderr, "usage: %s [-n iterations] [-t timers]\n", argv[0]);
+        return 2;
+    }
+  }
+  timer_service.init();
+
+  basics();
+  longTimeout();
+  many(timers);
+
+  printf("\ntimings, %u other timers armed\n", (unsigned)timers);
+  std::vector<probe_t> background(timers);
+  for (uint32_t i = 0; i < timers; i++) {
+    background[i].arm(3600000 + i);
+  }
+  std::vector<probe_t> probes(1024);
+  time("arm", iterations, [&](uint32_t i) { timer_service.armMs(&probes[i % 1024].timer, 600000); });
+  time("rearm", iterations, [&](uint32_t i) { timer_service.armMs(&probes[i % 1024].timer, 600000 + i % 1000); });
+  time("remaining", iterations, [&](uint32_t i) { timer_service.remainingUs(&probes[i % 1024].timer); });
+  time("cancel and arm", iterations, [&](uint32_t i) {
+    timer_service.cancel(&probes[i % 1024].timer);
+    timer_service.armMs(&probes[i % 1024].timer, 600000);
+  });
+
+  printf("\n%s\n", failures ? "FAILED" : "all cases passed");
+  fflush(stdout);
+  quick_exit(failures ? 1 : 0);
+}
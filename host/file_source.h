@@ -0,0 +1,62 @@
+#pragma once
+#include "rmt_source.h"
+#include "capture_file.h"
+
+/**
+ * @brief Plays back a capture file recorded by the device's CaptureRecorder.
+ *
+ * Capture times are rebuilt from the recorded deltas, so the pipeline sees the
+ * recorded timing (repeat folding included) however fast the file is read.
+ */
+class FileSource : public RmtSource
+{
+public:
+  /**
+   * @return false if `path` cannot be opened or is not a capture file.
+   */
+  bool open(const char *path) {
+    file_ = fopen(path, "rb");
+    if (file_ == NULL || !reader_.begin(file_)) {
+      return false;
+    }
+    pending_ = reader_.next(&msg_);
+    time_us_ = (int64_t)msg_.time * 1000;
+    return true;
+  }
+
+  /**
+   * @brief Time of the capture before the first one, so that capture_submit()
+   *        reproduces the first recorded delta too.
+   */
+  int64_t startTimeUs() const { return pending_ ? time_us_ - msg_.delta : 0; }
+
+  ~FileSource() {
+    if (file_) {
+      fclose(file_);
+    }
+  }
+
+  size_t next(rmt_data_t *buf, size_t max_symbols, int *rssi, int64_t *time_us) override {
+    if (!pending_) {
+      if (!file_ || !reader_.next(&msg_)) {
+        return 0;
+      }
+      time_us_ += msg_.delta;
+    }
+    pending_ = false;
+    size_t n = MIN(msg_.length, max_symbols);
+    memcpy(buf, msg_.buf, n * sizeof(rmt_data_t));
+    *rssi = msg_.rssi;
+    *time_us = time_us_;
+    return n;
+  }
+
+  bool truncated() const { return reader_.truncated(); }
+
+private:
+  FILE *file_ = NULL;
+  CaptureFileReader reader_;
+  rmt_message_t msg_ = {};
+  int64_t time_us_ = 0;
+  bool pending_ = false;
+};
@@ -0,0 +1,99 @@
+#pragma once
+#include "decoders.h"
+#include "rmt_source.h"
+#include "bench/bench_report.h"
+
+/**
+ * @brief The PWM packing the firmware had before the integer classifier, kept as the reference.
+ *
+ * Copied from the original PWMDecoder::decode: a float ratio test per symbol
+ * and one bit set at a time.
+ */
+static void pwm_reference_pack(const rmt_message_t *msg, pwm_message_t *pwm_msg)
+{
+  pwm_msg->length = 0;
+
+  for (int i = 0; i < msg->length; i++)
+  {
+    uint16_t d1 = msg->buf[i].duration0;
+    uint16_t d2 = msg->buf[i].duration1;
+
+    float diff = d1 - d2;
+    float avg = (d1 + d2) / 2;
+    float ratio = diff / avg;
+
+    uint8_t b = ratio < 0.2 ? 1 : 0;
+
+    if (i % 8 == 0)
+    {
+      pwm_msg->buf[i / 8] = 0;
+    }
+
+    if (b)
+    {
+      pwm_msg->buf[i / 8] |= (1 << (7 - i % 8));
+    }
+
+    if (i % 8 == 7 || i == msg->length - 1)
+    {
+      pwm_msg->length++;
+    }
+  }
+}
+
+/**
+ * @brief Golden test of PWMDecoder::pack() against pwm_reference_pack().
+ *
+ * Every capture of a source is packed both ways and the PWM messages are
+ * compared bit for bit, length included; the time each takes is reported.
+ */
+struct PwmGolden {
+  uint32_t frames = 0;
+  uint32_t mismatches = 0;
+  int64_t reference_us = 0;
+  int64_t packed_us = 0;
+
+  void check(const rmt_message_t *msg) {
+    static pwm_message_t want;
+    static pwm_message_t got;
+    frame_features_t features;
+    int64_t start = esp_timer_get_time();
+    pwm_reference_pack(msg, &want);
+    int64_t middle = esp_timer_get_time();
+    PWMDecoder::pack(msg, &got, &features);
+    packed_us += esp_timer_get_time() - middle;
+    reference_us += middle - start;
+    frames++;
+    if (got.length != want.length || memcmp(got.buf, want.buf, want.length) != 0) {
+      if (mismatches++ == 0) {
+        printf("           first mismatch: frame %u, %u symbols\n", frames - 1, msg->length);
+      }
+    }
+  }
+
+  /**
+   * @brief Pack every capture of `source` that fits a PWM message.
+   */
+  void run(RmtSource &source) {
+    static rmt_message_t msg;
+    int rssi;
+    int64_t time_us;
+    size_t n;
+    while ((n = source.next(msg.buf, DECODER_MAX_SYMBOLS, &rssi, &time_us)) > 0) {
+      msg.length = n;
+      if (n <= sizeof(pwm_message_t::buf) * 8) {
+        check(&msg);
+      }
+    }
+  }
+
+  /**
+   * @return false on a mismatch.
+   */
+  bool print() const {
+    report("float", frames, reference_us);
+    report("integer", frames, packed_us);
+    printf("           %u of %u frames differ from the float classifier\n", mismatches, frames);
+    return mismatches == 0;
+  }
+};
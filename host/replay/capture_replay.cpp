@@ -0,0 +1,136 @@
+/*
+ * Replays a capture file recorded on the device (POST /radio/capture, then
+ * GET /radio/capture to download it) through the same pipeline and decoders
+ * the firmware runs.
+ *
+ *   capture_replay [-l loops] [-k manufacturer_key] [-v] capture.pvc
+ *
+ * Prints the throughput, the per-decoder results and what would have been
+ * broadcast, plus a digest of the broadcast bytes: the pipeline is
+ * deterministic for a given file, so two builds that print the same digest
+ * decoded it identically. The file's captures are also packed by the float
+ * reference classifier and by PWMDecoder::pack(); it exits with 1 if they
+ * differ on any of them.
+ */
+#include "capture_pipeline.h"
+#include "HCS301.h"
+#include "fixed_code.h"
+#include "file_source.h"
+#include "bench/bench_report.h"
+#include "pwm_golden.h"
+
+#include <unistd.h>
+
+/* The remote the firmware is seeded with, as the old parser read its serial. */
+#define HCS301_SERIAL (HCS301_SERIAL_LEGACY | 0x001C4A01)
+
+struct replay_stats_t {
+  uint32_t frames[4];
+  uint64_t bytes[4];
+  uint64_t digest;
+};
+
+static replay_stats_t replay_stats = { {}, {}, 0xcbf29ce484222325ULL };
+
+static void replay_broadcast(uint8_t *data, size_t len, uint32_t subscribers)
+{
+  uint8_t type = len > 1 && data[1] < 4 ? data[1] : 0;
+  replay_stats.frames[type]++;
+  replay_stats.bytes[type] += len;
+  // FNV-1a
+  for (size_t i = 0; i < len; i++) {
+    replay_stats.digest = (replay_stats.digest ^ data[i]) * 0x100000001b3ULL;
+  }
+}
+
+/**
+ * @brief Play the file once.
+ *
+ * @return false if the file cannot be read.
+ */
+static bool replay(const char *path)
+{
+  FileSource source;
+  if (!source.open(path)) {
+    fprintf(stderr, "%s: not a capture file\n", path);
+    return false;
+  }
+  capture_last_time_us = source.startTimeUs();
+  rmt_source_stats_t stats = {};
+  uint8_t frame[WS_FRAME_MAX_SIZE];
+  rmt_message_t *msg;
+  int64_t start = esp_timer_get_time();
+  while (rmt_source_feed(source, &stats)) {
+    while (xQueueReceive(rmt_parse_queue, &msg, 0) == pdTRUE) {
+      capture_process(msg, frame);
+    }
+  }
+  repeat_folder.flushAll();
+  report("replay", stats.frames, esp_timer_get_time() - start);
+  if (source.truncated()) {
+    printf("           file is truncated, stopped at the first damaged record\n");
+  }
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t loops = 1;
+  uint64_t manufacturer_key = HCS301_MANUFACTURER_KEY;
+  int opt;
+  while ((opt = getopt(argc, argv, "l:k:v")) != -1) {
+    switch (opt) {
+      case 'l': loops = strtoul(optarg, NULL, 0); break;
+      case 'k': manufacturer_key = strtoull(optarg, NULL, 16); break;
+      case 'v': esp_log_level_set("*", ESP_LOG_DEBUG); break;
+      default:
+        fprintf(stderr, "usage: %s [-l loops] [-k manufacturer_key] [-v] capture.pvc\n", argv[0]);
+        return 2;
+    }
+  }
+  if (optind != argc - 1) {
+    fprintf(stderr, "usage: %s [-l loops] [-k manufacturer_key] [-v] capture.pvc\n", argv[0]);
+    return 2;
+  }
+
+  HCS301 hcs301(manufacturer_key);
+  hcs301.enroll(HCS301_SERIAL);
+  FixedCodeDecoder<EV1527> ev1527;
+  FixedCodeDecoder<PT2262> pt2262;
+  FixedCodeDecoder<HS2303> hs2303;
+  if (!capture_pipeline_init(replay_broadcast)) {
+    return 1;
+  }
+
+  for (uint32_t i = 0; i < loops; i++) {
+    if (!replay(argv[optind])) {
+      return 1;
+    }
+  }
+
+  printf("\nclassifier\n");
+  FileSource golden_source;
+  PwmGolden golden;
+  if (golden_source.open(argv[optind])) {
+    golden.run(golden_source);
+  }
+  bool classify_ok = golden.print();
+
+  printf("\ndecoders\n");
+  printAllDecoders();
+  if (manufacturer_key) {
+    printKeeloqStats(hcs301);
+  }
+
+  static const char *types[4] = { "other", "capture", "event", "repeat" };
+  printf("\nbroadcast (digest %016llx)\n", (unsigned long long)replay_stats.digest);
+  for (int t = 0; t < 4; t++) {
+    printf("  %-8s %8u frames %10llu bytes\n", types[t], replay_stats.frames[t], (unsigned long long)replay_stats.bytes[t]);
+  }
+
+  printf("\n");
+  printPipelineStats();
+
+  fflush(stdout);
+  quick_exit(classify_ok ? 0 : 1);
+}
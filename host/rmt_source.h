@@ -0,0 +1,63 @@
+#pragma once
+#include "capture_pipeline.h"
+
+/**
+ * @brief Where the host build gets its captures from, in place of the RMT channel.
+ */
+class RmtSource
+{
+public:
+  virtual ~RmtSource() {}
+
+  /**
+   * @brief Produce the next capture.
+   *
+   * @param buf Symbol buffer to fill.
+   * @param max_symbols Capacity of `buf`.
+   * @param rssi Set to the RSSI of the capture, dBm.
+   * @param time_us End of the capture, esp_timer time. Preset to the current
+   *        time; recorded sources replace it with the recorded one.
+   * @return Number of symbols written, 0 once the source is exhausted.
+   */
+  virtual size_t next(rmt_data_t *buf, size_t max_symbols, int *rssi, int64_t *time_us) = 0;
+};
+
+struct rmt_source_stats_t {
+  uint32_t frames;
+  uint32_t dropped;
+};
+
+/**
+ * @brief Feed one capture into the pipeline the way the RX ISR and rmt_recive_task do.
+ *
+ * The capture is received straight into a capture_pool slot and handed to
+ * capture_submit(). When the pool is exhausted the capture is consumed but
+ * dropped, as the idle RMT channel would miss it; captures of 3 symbols or
+ * less are discarded like on the target.
+ *
+ * @return false once the source is exhausted.
+ */
+static bool rmt_source_feed(RmtSource &source, rmt_source_stats_t *stats)
+{
+  static rmt_data_t scratch[DECODER_MAX_SYMBOLS];
+  rmt_message_t *slot = capture_pool.acquire();
+  rmt_data_t *buf = slot ? slot->buf : scratch;
+  int rssi = 0;
+  int64_t time_us = esp_timer_get_time();
+  size_t num_symbols = source.next(buf, DECODER_MAX_SYMBOLS, &rssi, &time_us);
+  if (num_symbols == 0) {
+    capture_pool.release(slot);
+    return false;
+  }
+  stats->frames++;
+  if (slot == nullptr) {
+    stats->dropped++;
+    return true;
+  }
+  if (num_symbols <= 3) {
+    capture_pool.release(slot);
+    return true;
+  }
+  capture_submit(slot, num_symbols, time_us, rssi);
+  return true;
+}
@@ -0,0 +1,221 @@
+#include "cJSON.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+static cJSON *create(int type)
+{
+  cJSON *item = (cJSON *)calloc(1, sizeof(cJSON));
+  if (item) {
+    item->type = type;
+  }
+  return item;
+}
+
+cJSON *cJSON_CreateObject(void) { return create(cJSON_Object); }
+cJSON *cJSON_CreateArray(void) { return create(cJSON_Array); }
+
+cJSON *cJSON_CreateNumber(double num)
+{
+  cJSON *item = create(cJSON_Number);
+  if (item) {
+    item->valuedouble = num;
+    item->valueint = num >= 2147483647.0 ? 2147483647 : num <= -2147483648.0 ? -2147483647 - 1 : (int)num;
+  }
+  return item;
+}
+
+cJSON *cJSON_CreateString(const char *string)
+{
+  cJSON *item = create(cJSON_String);
+  if (item) {
+    item->valuestring = strdup(string);
+  }
+  return item;
+}
+
+cJSON *cJSON_CreateBool(cJSON_bool boolean)
+{
+  return create(boolean ? cJSON_True : cJSON_False);
+}
+
+void cJSON_Delete(cJSON *item)
+{
+  while (item) {
+    cJSON *next = item->next;
+    cJSON_Delete(item->child);
+    free(item->valuestring);
+    free(item->string);
+    free(item);
+    item = next;
+  }
+}
+
+cJSON_bool cJSON_AddItemToArray(cJSON *array, cJSON *item)
+{
+  if (array == NULL || item == NULL || array == item) {
+    return 0;
+  }
+  if (array->child == NULL) {
+    array->child = item;
+    item->prev = item;
+  } else {
+    cJSON *last = array->child->prev;
+    last->next = item;
+    item->prev = last;
+    array->child->prev = item;
+  }
+  return 1;
+}
+
+cJSON_bool cJSON_AddItemToObject(cJSON *object, const char *string, cJSON *item)
+{
+  if (item == NULL || string == NULL) {
+    return 0;
+  }
+  free(item->string);
+  item->string = strdup(string);
+  return cJSON_AddItemToArray(object, item);
+}
+
+static cJSON *add(cJSON *object, const char *name, cJSON *item)
+{
+  if (cJSON_AddItemToObject(object, name, item)) {
+    return item;
+  }
+  cJSON_Delete(item);
+  return NULL;
+}
+
+cJSON *cJSON_AddNumberToObject(cJSON *object, const char *name, double number) { return add(object, name, cJSON_CreateNumber(number)); }
+cJSON *cJSON_AddStringToObject(cJSON *object, const char *name, const char *string) { return add(object, name, cJSON_CreateString(string)); }
+cJSON *cJSON_AddBoolToObject(cJSON *object, const char *name, cJSON_bool boolean) { return add(object, name, cJSON_CreateBool(boolean)); }
+cJSON *cJSON_AddObjectToObject(cJSON *object, const char *name) { return add(object, name, cJSON_CreateObject()); }
+cJSON *cJSON_AddArrayToObject(cJSON *object, const char *name) { return add(object, name, cJSON_CreateArray()); }
+
+int cJSON_GetArraySize(const cJSON *array)
+{
+  int size = 0;
+  for (cJSON *child = array ? array->child : NULL; child; child = child->next) {
+    size++;
+  }
+  return size;
+}
+
+cJSON *cJSON_GetArrayItem(const cJSON *array, int index)
+{
+  cJSON *child = array ? array->child : NULL;
+  while (child && index-- > 0) {
+    child = child->next;
+  }
+  return child;
+}
+
+cJSON *cJSON_GetObjectItem(const cJSON *object, const char *string)
+{
+  for (cJSON *child = object ? object->child : NULL; child; child = child->next) {
+    if (child->string && strcasecmp(child->string, string) == 0) {
+      return child;
+    }
+  }
+  return NULL;
+}
+
+double cJSON_GetNumberValue(const cJSON *item) { return cJSON_IsNumber(item) ? item->valuedouble : NAN; }
+char *cJSON_GetStringValue(const cJSON *item) { return cJSON_IsString(item) ? item->valuestring : NULL; }
+
+cJSON_bool cJSON_IsBool(const cJSON *item) { return item && (item->type & (cJSON_True | cJSON_False)); }
+cJSON_bool cJSON_IsTrue(const cJSON *item) { return item && (item->type & 0xff) == cJSON_True; }
+cJSON_bool cJSON_IsNumber(const cJSON *item) { return item && (item->type & 0xff) == cJSON_Number; }
+cJSON_bool cJSON_IsString(const cJSON *item) { return item && (item->type & 0xff) == cJSON_String; }
+cJSON_bool cJSON_IsArray(const cJSON *item) { return item && (item->type & 0xff) == cJSON_Array; }
+cJSON_bool cJSON_IsObject(const cJSON *item) { return item && (item->type & 0xff) == cJSON_Object; }
+
+static void printString(std::string &out, const char *s)
+{
+  out += '"';
+  for (; *s; s++) {
+    unsigned char c = *s;
+    switch (c) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if (c < 0x20) {
+          char buf[8];
+          snprintf(buf, sizeof(buf), "\\u%04x", c);
+          out += buf;
+        } else {
+          out += c;
+        }
+    }
+  }
+  out += '"';
+}
+
+static void printValue(std::string &out, const cJSON *item, bool format, int depth)
+{
+  char buf[32];
+  switch (item->type & 0xff) {
+    case cJSON_False: out += "false"; break;
+    case cJSON_True: out += "true"; break;
+    case cJSON_NULL: out += "null"; break;
+    case cJSON_Number:
+      if (isnan(item->valuedouble) || isinf(item->valuedouble)) {
+        out += "null";
+      } else if (item->valuedouble == (double)(long long)item->valuedouble) {
+        snprintf(buf, sizeof(buf), "%lld", (long long)item->valuedouble);
+        out += buf;
+      } else {
+        snprintf(buf, sizeof(buf), "%.15g", item->valuedouble);
+        out += buf;
+      }
+      break;
+    case cJSON_String: printString(out, item->valuestring ? item->valuestring : ""); break;
+    case cJSON_Array:
+    case cJSON_Object: {
+      bool object = (item->type & 0xff) == cJSON_Object;
+      out += object ? '{' : '[';
+      for (cJSON *child = item->child; child; child = child->next) {
+        if (format && object) {
+          out += '\n';
+          out.append(depth + 1, '\t');
+        }
+        if (object) {
+          printString(out, child->string ? child->string : "");
+          out += format ? ":\t" : ":";
+        }
+        printValue(out, child, format, depth + 1);
+        if (child->next) {
+          out += format && !object ? ", " : ",";
+        }
+      }
+      if (format && object && item->child) {
+        out += '\n';
+        out.append(depth, '\t');
+      }
+      out += object ? '}' : ']';
+      break;
+    }
+    default: out += "null";
+  }
+}
+
+static char *print(const cJSON *item, bool format)
+{
+  if (item == NULL) {
+    return NULL;
+  }
+  std::string out;
+  printValue(out, item, format, 0);
+  return strdup(out.c_str());
+}
+
+char *cJSON_Print(const cJSON *item) { return print(item, true); }
+char *cJSON_PrintUnformatted(const cJSON *item) { return print(item, false); }
+void cJSON_free(void *object) { free(object); }
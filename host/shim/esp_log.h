@@ -0,0 +1,36 @@
+#pragma once
+/*
+ * Host shim: ESP_LOGx print to stderr. The default level is WARN; a message
+ * below the highest level set for any tag costs one comparison.
+ *
+ * No printf format checking: the pipeline formats int64_t with %lld, which is
+ * right on the target and only differs in type name on LP64 hosts.
+ */
+#include <stdint.h>
+
+typedef enum {
+  ESP_LOG_NONE,
+  ESP_LOG_ERROR,
+  ESP_LOG_WARN,
+  ESP_LOG_INFO,
+  ESP_LOG_DEBUG,
+  ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+extern esp_log_level_t esp_log_max_level;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level);
+esp_log_level_t esp_log_level_get(const char *tag);
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...);
+
+#define ESP_LOG_LEVEL(level, tag, format, ...) do {                              \
+    if ((level) <= esp_log_max_level && (level) <= esp_log_level_get(tag)) {    \
+      esp_log_write(level, tag, format, ##__VA_ARGS__);                         \
+    }                                                                           \
+  } while (0)
+
+#define ESP_LOGE(tag, format, ...) ESP_LOG_LEVEL(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ESP_LOG_LEVEL(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ESP_LOG_LEVEL(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ESP_LOG_LEVEL(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) ESP_LOG_LEVEL(ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
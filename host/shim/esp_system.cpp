@@ -0,0 +1,211 @@
+#include "Arduino.h"
+
+#include <stdarg.h>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+static const auto boot = std::chrono::steady_clock::now();
+
+int64_t esp_timer_get_time(void)
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - boot).count();
+}
+
+unsigned long millis(void)
+{
+  return esp_timer_get_time() / 1000;
+}
+
+unsigned long micros(void)
+{
+  return esp_timer_get_time();
+}
+
+void delay(uint32_t ms)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+  switch (code) {
+    case ESP_OK: return "ESP_OK";
+    case ESP_FAIL: return "ESP_FAIL";
+    case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+    default: return "UNKNOWN ERROR";
+  }
+}
+
+/* Logging */
+
+esp_log_level_t esp_log_max_level = ESP_LOG_WARN;
+static esp_log_level_t log_default_level = ESP_LOG_WARN;
+static std::map<std::string, esp_log_level_t> log_levels;
+static std::mutex log_mutex;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+  std::lock_guard<std::mutex> lock(log_mutex);
+  if (strcmp(tag, "*") == 0) {
+    log_default_level = level;
+    log_levels.clear();
+  } else {
+    log_levels[tag] = level;
+  }
+  esp_log_max_level = log_default_level;
+  for (auto &entry : log_levels) {
+    esp_log_max_level = std::max(esp_log_max_level, entry.second);
+  }
+}
+
+esp_log_level_t esp_log_level_get(const char *tag)
+{
+  std::lock_guard<std::mutex> lock(log_mutex);
+  auto it = log_levels.find(tag);
+  return it == log_levels.end() ? log_default_level : it->second;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+  static const char letters[] = "NEWIDV";
+  std::lock_guard<std::mutex> lock(log_mutex);
+  fprintf(stderr, "%c (%lu) %s: ", letters[level], millis(), tag);
+  va_list args;
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  fputc('\n', stderr);
+}
+
+/* esp_timer */
+
+struct esp_timer {
+  esp_timer_create_args_t args;
+  int64_t deadline = 0;
+  uint64_t period = 0;
+  bool active = false;
+};
+
+static std::mutex timer_mutex;
+static std::condition_variable timer_changed;
+static std::multimap<int64_t, esp_timer *> timer_queue;
+static bool timer_thread_started = false;
+
+static void timer_unschedule(esp_timer *timer)
+{
+  auto range = timer_queue.equal_range(timer->deadline);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (it->second == timer) {
+      timer_queue.erase(it);
+      break;
+    }
+  }
+  timer->active = false;
+}
+
+static void timer_schedule(esp_timer *timer, int64_t deadline)
+{
+  timer->deadline = deadline;
+  timer->active = true;
+  timer_queue.emplace(deadline, timer);
+  timer_changed.notify_all();
+}
+
+static void timer_dispatch(void)
+{
+  std::unique_lock<std::mutex> lock(timer_mutex);
+  while (true) {
+    if (timer_queue.empty()) {
+      timer_changed.wait(lock);
+      continue;
+    }
+    auto first = timer_queue.begin();
+    int64_t now = esp_timer_get_time();
+    if (first->first > now) {
+      timer_changed.wait_for(lock, std::chrono::microseconds(first->first - now));
+      continue;
+    }
+    esp_timer *timer = first->second;
+    timer_queue.erase(first);
+    timer->active = false;
+    if (timer->period) {
+      timer_schedule(timer, timer->deadline + timer->period);
+    }
+    esp_timer_create_args_t args = timer->args;
+    lock.unlock();
+    args.callback(args.arg);
+    lock.lock();
+  }
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *out_handle)
+{
+  if (args == NULL || args->callback == NULL || out_handle == NULL) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  std::lock_guard<std::mutex> lock(timer_mutex);
+  if (!timer_thread_started) {
+    std::thread(timer_dispatch).detach();
+    timer_thread_started = true;
+  }
+  esp_timer *timer = new esp_timer();
+  timer->args = *args;
+  *out_handle = timer;
+  return ESP_OK;
+}
+
+static esp_err_t timer_start(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us)
+{
+  std::lock_guard<std::mutex> lock(timer_mutex);
+  if (timer->active) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  timer->period = period_us;
+  timer_schedule(timer, esp_timer_get_time() + timeout_us);
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+  return timer_start(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us)
+{
+  return timer_start(timer, period_us, period_us);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+  std::lock_guard<std::mutex> lock(timer_mutex);
+  if (!timer->active) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  timer_unschedule(timer);
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+  std::lock_guard<std::mutex> lock(timer_mutex);
+  if (timer->active) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  delete timer;
+  return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer)
+{
+  std::lock_guard<std::mutex> lock(timer_mutex);
+  return timer->active;
+}
@@ -0,0 +1,359 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/event_groups.h"
+#include "freertos/message_buffer.h"
+#include "freertos/semphr.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static const auto boot = std::chrono::steady_clock::now();
+
+/* Wait on `cv` until `ready` holds or `ticks` ms passed. */
+template <typename Ready>
+static bool waitFor(std::condition_variable &cv, std::unique_lock<std::mutex> &lock, TickType_t ticks, Ready ready)
+{
+  if (ticks == 0) {
+    return ready();  // a zero timed wait would still sleep for the kernel's timer slack
+  }
+  if (ticks == portMAX_DELAY) {
+    cv.wait(lock, ready);
+    return true;
+  }
+  return cv.wait_for(lock, std::chrono::milliseconds(ticks), ready);
+}
+
+void vPortEnterCritical(portMUX_TYPE *mux)
+{
+  while (mux->locked.exchange(true, std::memory_order_acquire)) {
+    std::this_thread::yield();
+  }
+}
+
+void vPortExitCritical(portMUX_TYPE *mux)
+{
+  mux->locked.store(false, std::memory_order_release);
+}
+
+/* Tasks */
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *param,
+                       UBaseType_t priority, TaskHandle_t *handle)
+{
+  std::thread thread(fn, param);
+  if (handle) {
+    *handle = (TaskHandle_t)thread.native_handle();
+  }
+  thread.detach();
+  return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *param,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core)
+{
+  return xTaskCreate(fn, name, stack_depth, param, priority, handle);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+  if (task == NULL) {
+    pthread_exit(NULL);
+  }
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - boot).count();
+}
+
+/* Queues */
+
+struct QueueDefinition {
+  std::mutex mutex;
+  std::condition_variable can_send;
+  std::condition_variable can_receive;
+  std::vector<uint8_t> storage;
+  size_t item_size;
+  size_t length;
+  size_t head = 0;
+  size_t count = 0;
+
+  QueueDefinition(size_t length, size_t item_size) : storage(length * item_size), item_size(item_size), length(length) {}
+
+  uint8_t *at(size_t i) { return &storage[(i % length) * item_size]; }
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+  return length ? new QueueDefinition(length, item_size) : NULL;
+}
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t item_size, uint8_t *storage, StaticQueue_t *buffer)
+{
+  return xQueueCreate(length, item_size);
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+  delete queue;
+}
+
+static BaseType_t queueSend(QueueHandle_t q, const void *item, TickType_t ticks, bool front)
+{
+  std::unique_lock<std::mutex> lock(q->mutex);
+  if (!waitFor(q->can_send, lock, ticks, [q] { return q->count < q->length; })) {
+    return errQUEUE_FULL;
+  }
+  if (front) {
+    q->head = (q->head + q->length - 1) % q->length;
+    memcpy(q->at(q->head), item, q->item_size);
+  } else {
+    memcpy(q->at(q->head + q->count), item, q->item_size);
+  }
+  q->count++;
+  q->can_receive.notify_one();
+  return pdPASS;
+}
+
+static BaseType_t queueReceive(QueueHandle_t q, void *item, TickType_t ticks, bool peek)
+{
+  std::unique_lock<std::mutex> lock(q->mutex);
+  if (!waitFor(q->can_receive, lock, ticks, [q] { return q->count > 0; })) {
+    return pdFALSE;
+  }
+  memcpy(item, q->at(q->head), q->item_size);
+  if (!peek) {
+    q->head = (q->head + 1) % q->length;
+    q->count--;
+    q->can_send.notify_one();
+  }
+  return pdTRUE;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+  return queueSend(queue, item, ticks, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+  return queueSend(queue, item, ticks, true);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+  return queueReceive(queue, item, ticks, false);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+  return queueReceive(queue, item, ticks, true);
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue)
+{
+  std::lock_guard<std::mutex> lock(queue->mutex);
+  queue->head = 0;
+  queue->count = 0;
+  queue->can_send.notify_all();
+  return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+  std::lock_guard<std::mutex> lock(queue->mutex);
+  return queue->count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue)
+{
+  std::lock_guard<std::mutex> lock(queue->mutex);
+  return queue->length - queue->count;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken)
+{
+  return queueSend(queue, item, 0, false);
+}
+
+BaseType_t xQueueReceiveFromISR(QueueHandle_t queue, void *item, BaseType_t *woken)
+{
+  return queueReceive(queue, item, 0, false);
+}
+
+UBaseType_t uxQueueMessagesWaitingFromISR(QueueHandle_t queue)
+{
+  return uxQueueMessagesWaiting(queue);
+}
+
+/* Event groups */
+
+struct EventGroupDefinition {
+  std::mutex mutex;
+  std::condition_variable changed;
+  EventBits_t bits = 0;
+};
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+  return new EventGroupDefinition();
+}
+
+EventGroupHandle_t xEventGroupCreateStatic(StaticEventGroup_t *buffer)
+{
+  return xEventGroupCreate();
+}
+
+void vEventGroupDelete(EventGroupHandle_t group)
+{
+  delete group;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+  std::lock_guard<std::mutex> lock(group->mutex);
+  group->bits |= bits;
+  group->changed.notify_all();
+  return group->bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+  std::lock_guard<std::mutex> lock(group->mutex);
+  EventBits_t before = group->bits;
+  group->bits &= ~bits;
+  return before;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+  std::lock_guard<std::mutex> lock(group->mutex);
+  return group->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all, TickType_t ticks)
+{
+  std::unique_lock<std::mutex> lock(group->mutex);
+  auto ready = [&] { return wait_for_all ? (group->bits & bits) == bits : (group->bits & bits) != 0; };
+  bool met = waitFor(group->changed, lock, ticks, ready);
+  EventBits_t result = group->bits;
+  if (met && clear_on_exit) {
+    group->bits &= ~bits;
+  }
+  return result;
+}
+
+/* Mutexes */
+
+struct SemaphoreDefinition {
+  std::timed_mutex mutex;
+};
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+  return new SemaphoreDefinition();
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer)
+{
+  return xSemaphoreCreateMutex();
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+  delete semaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks)
+{
+  if (ticks == portMAX_DELAY) {
+    semaphore->mutex.lock();
+    return pdTRUE;
+  }
+  return semaphore->mutex.try_lock_for(std::chrono::milliseconds(ticks)) ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+  semaphore->mutex.unlock();
+  return pdTRUE;
+}
+
+/* Message buffers */
+
+struct MessageBufferDefinition {
+  std::mutex mutex;
+  std::condition_variable can_send;
+  std::condition_variable can_receive;
+  std::deque<std::vector<uint8_t>> messages;
+  size_t size;
+  size_t used = 0;
+
+  explicit MessageBufferDefinition(size_t size) : size(size) {}
+};
+
+static const size_t message_overhead = sizeof(uint32_t);
+
+MessageBufferHandle_t xMessageBufferCreate(size_t size)
+{
+  return new MessageBufferDefinition(size);
+}
+
+void vMessageBufferDelete(MessageBufferHandle_t buffer)
+{
+  delete buffer;
+}
+
+size_t xMessageBufferSend(MessageBufferHandle_t b, const void *data, size_t len, TickType_t ticks)
+{
+  size_t need = len + message_overhead;
+  if (need > b->size) {
+    return 0;
+  }
+  std::unique_lock<std::mutex> lock(b->mutex);
+  if (!waitFor(b->can_send, lock, ticks, [&] { return b->size - b->used >= need; })) {
+    return 0;
+  }
+  const uint8_t *bytes = (const uint8_t *)data;
+  b->messages.emplace_back(bytes, bytes + len);
+  b->used += need;
+  b->can_receive.notify_one();
+  return len;
+}
+
+size_t xMessageBufferReceive(MessageBufferHandle_t b, void *data, size_t len, TickType_t ticks)
+{
+  std::unique_lock<std::mutex> lock(b->mutex);
+  if (!waitFor(b->can_receive, lock, ticks, [&] { return !b->messages.empty(); })) {
+    return 0;
+  }
+  std::vector<uint8_t> &message = b->messages.front();
+  if (message.size() > len) {
+    return 0;  // left in the buffer, as on the target
+  }
+  size_t n = message.size();
+  memcpy(data, message.data(), n);
+  b->messages.pop_front();
+  b->used -= n + message_overhead;
+  b->can_send.notify_all();
+  return n;
+}
+
+size_t xMessageBufferSpacesAvailable(MessageBufferHandle_t b)
+{
+  std::lock_guard<std::mutex> lock(b->mutex);
+  return b->size - b->used;
+}
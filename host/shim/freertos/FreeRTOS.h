@@ -0,0 +1,44 @@
+#pragma once
+/*
+ * Host shim: the subset of FreeRTOS the capture pipeline uses, on std::thread.
+ *
+ * One tick is one millisecond. Priorities and stack sizes are ignored; every
+ * task is a detached thread. "FromISR" variants never block and never report
+ * a woken task. Critical sections are a spin lock per portMUX_TYPE.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+typedef int32_t BaseType_t;
+typedef uint32_t UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+#define errQUEUE_FULL 0
+
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define configTICK_RATE_HZ 1000
+#define portTICK_PERIOD_MS ((TickType_t)1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+struct portMUX_TYPE {
+  std::atomic<bool> locked{false};
+};
+
+#define portMUX_INITIALIZER_UNLOCKED {}
+
+void vPortEnterCritical(portMUX_TYPE *mux);
+void vPortExitCritical(portMUX_TYPE *mux);
+
+#define taskENTER_CRITICAL(mux) vPortEnterCritical(mux)
+#define taskEXIT_CRITICAL(mux) vPortExitCritical(mux)
+#define taskENTER_CRITICAL_ISR(mux) vPortEnterCritical(mux)
+#define taskEXIT_CRITICAL_ISR(mux) vPortExitCritical(mux)
+#define portENTER_CRITICAL(mux) vPortEnterCritical(mux)
+#define portEXIT_CRITICAL(mux) vPortExitCritical(mux)
+
+#define portYIELD_FROM_ISR(...) ((void)0)
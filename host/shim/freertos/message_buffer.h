@@ -0,0 +1,13 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+struct MessageBufferDefinition;
+typedef MessageBufferDefinition *MessageBufferHandle_t;
+
+/* As on the target, every message also takes a 4-byte length out of `size`. */
+MessageBufferHandle_t xMessageBufferCreate(size_t size);
+void vMessageBufferDelete(MessageBufferHandle_t buffer);
+
+size_t xMessageBufferSend(MessageBufferHandle_t buffer, const void *data, size_t len, TickType_t ticks);
+size_t xMessageBufferReceive(MessageBufferHandle_t buffer, void *data, size_t len, TickType_t ticks);
+size_t xMessageBufferSpacesAvailable(MessageBufferHandle_t buffer);
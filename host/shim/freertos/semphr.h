@@ -0,0 +1,18 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+/* Mutexes only. */
+struct SemaphoreDefinition;
+typedef SemaphoreDefinition *SemaphoreHandle_t;
+
+/* Storage is always allocated on the heap; the static buffer is unused. */
+struct StaticSemaphore_t {
+  uint8_t unused;
+};
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer);
+void vSemaphoreDelete(SemaphoreHandle_t semaphore);
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
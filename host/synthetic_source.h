@@ -0,0 +1,156 @@
+#pragma once
+#include "rmt_source.h"
+#include "HCS301.h"
+#include "fixed_code.h"
+#include <random>
+
+/**
+ * @brief Generates button presses of the supported remotes, plus noise.
+ *
+ * Every press is a fresh random code sent `repeats` times, each repeat with
+ * a few percent of timing jitter, so raw captures differ while the decoded
+ * frames are identical, as they are on air. Presses cycle through HCS301,
+ * EV1527, PT2262, HS2303 and a burst of noise captures. HCS301 presses are
+ * KeeLoq encrypted with consecutive counters once a device key is set.
+ */
+class SyntheticSource : public RmtSource
+{
+public:
+  /**
+   * @param frames Captures to produce in total.
+   * @param repeats Captures per press.
+   * @param hcs301_serial Serial the HCS301 presses are sent from.
+   * @param seed Random seed; the same seed gives the same captures.
+   */
+  SyntheticSource(uint32_t frames, uint8_t repeats, uint32_t hcs301_serial, uint32_t seed = 1)
+    : frames_(frames), repeats_(MAX(repeats, 1)), serial_(hcs301_serial), rng_(seed) {}
+
+  /**
+   * @brief Encrypt HCS301 code words with `device_key`, counting from `counter`.
+   */
+  void setHcs301Key(uint64_t device_key, uint16_t counter) {
+    hcs301_key_ = device_key;
+    hcs301_counter_ = counter;
+  }
+
+  /** Counter of the next HCS301 press. */
+  uint16_t hcs301Counter() const { return hcs301_counter_; }
+
+  size_t next(rmt_data_t *buf, size_t max_symbols, int *rssi, int64_t *time_us) override {
+    if (produced_ == frames_) {
+      return 0;
+    }
+    if (left_ == 0) {
+      press();
+    }
+    left_--;
+    produced_++;
+    size_t n = MIN(length_, max_symbols);
+    for (size_t i = 0; i < n; i++) {
+      buf[i].level0 = 1;
+      buf[i].duration0 = jitter(pattern_[i].duration0);
+      buf[i].level1 = 0;
+      buf[i].duration1 = jitter(pattern_[i].duration1);
+    }
+    *rssi = rssi_ + (int)(rng_() % 5) - 2;
+    return n;
+  }
+
+private:
+  enum kind_t { KIND_HCS301, KIND_EV1527, KIND_PT2262, KIND_HS2303, KIND_NOISE, KIND_COUNT };
+
+  uint32_t frames_;
+  uint8_t repeats_;
+  uint32_t serial_;
+  uint64_t hcs301_key_ = 0;
+  uint16_t hcs301_counter_ = 0;
+  std::mt19937 rng_;
+  uint32_t produced_ = 0;
+  uint8_t left_ = 0;
+  int kind_ = KIND_COUNT - 1;
+  int rssi_ = -60;
+  size_t length_ = 0;
+  rmt_data_t pattern_[DECODER_MAX_SYMBOLS];
+
+  uint16_t jitter(uint16_t d) {
+    if (d == 0) {
+      return 0;
+    }
+    int spread = d / 20 + 1;
+    return MAX(1, (int)d + (int)(rng_() % (2 * spread + 1)) - spread);
+  }
+
+  void put(size_t i, uint16_t high, uint16_t low) {
+    pattern_[i].duration0 = high;
+    pattern_[i].duration1 = low;
+  }
+
+  void press() {
+    kind_ = (kind_ + 1) % KIND_COUNT;
+    left_ = repeats_;
+    rssi_ = -40 - (int)(rng_() % 50);
+    switch (kind_) {
+      case KIND_HCS301: hcs301(1 + rng_() % 15); break;
+      case KIND_EV1527: fixedCode<EV1527>(rng_() & 0xffffff); break;
+      case KIND_PT2262: fixedCode<PT2262>(tristate(rng_())); break;
+      case KIND_HS2303: fixedCode<HS2303>(rng_() & 0xffffff); break;
+      default: noise(); break;
+    }
+    pattern_[length_ - 1].duration1 = 0;  // the RMT ends the capture on the idle gap
+  }
+
+  /* Inverse of HCS301_t::update(): 12 preamble bits, then the code word LSB first, one symbol per bit. */
+  void hcs301(uint8_t buttons) {
+    const uint16_t te = 400;
+    uint8_t hop_buttons = reverse8(buttons) >> 4;
+    uint32_t encrypted = rng_();
+    if (hcs301_key_) {
+      uint32_t hop = (uint32_t)hop_buttons << 28 | (serial_ & 0x3ff) << 16 | hcs301_counter_++;
+      encrypted = keeloq::encrypt(hop, hcs301_key_);
+    }
+    uint64_t code = (uint64_t)(serial_ & 0x0fffffff) << 32 | encrypted;
+    length_ = 78;
+    for (size_t i = 0; i < length_; i++) {
+      bool one;
+      if (i < 12) {
+        put(i, te, te);
+        continue;
+      } else if (i < 72) {
+        one = (code >> (i - 12)) & 1;
+      } else if (i < 76) {
+        one = (buttons >> (75 - i)) & 1;
+      } else {
+        one = false;
+      }
+      put(i, one ? te : 2 * te, one ? 2 * te : te);
+    }
+  }
+
+  /* One code word and its sync; the sync gap is the idle gap that ends the capture. */
+  template <typename P>
+  void fixedCode(uint32_t code) {
+    length_ = 0;
+    for (int b = P::bits - 1; b >= 0; b--) {
+      const fixed_code_pulse_t &p = (code >> b) & 1 ? P::one : P::zero;
+      put(length_++, P::te * p.high, P::te * p.low);
+    }
+    put(length_++, P::te * P::sync.high, P::te * P::sync.low);
+  }
+
+  /* 12 random trits (00, 11 or 01) as 24 bits. */
+  static uint32_t tristate(uint32_t random) {
+    static const uint8_t trits[3] = { 0b00, 0b11, 0b01 };
+    uint32_t code = 0;
+    for (int t = 0; t < 12; t++, random /= 3) {
+      code = (code << 2) | trits[random % 3];
+    }
+    return code;
+  }
+
+  void noise() {
+    length_ = 8 + rng_() % 192;
+    for (size_t i = 0; i < length_; i++) {
+      put(i, 60 + rng_() % 3000, 60 + rng_() % 3000);
+    }
+  }
+};
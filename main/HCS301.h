@@ -1,9 +1,73 @@
 #pragma once
 
-#include "main.h"
+#include "rmt_message.h"
 #include "decoders.h"
+#include "decoded_event.h"
+#include "keeloq.h"
+#include "button_tracker.h"
+#include "freertos/semphr.h"
+#include <cJSON.h>
 
-#define HCS_BTNS_EVENTS_BITS BIT0 | BIT1 | BIT2 | BIT3
+#define TAG_HCS301 "HCS301"
+
+
+/*
+ * 12 preamble bits + 66 data bits. TE is 260..660 us, data pulses are 1 or 2 TE.
+ */
+#define HCS301_SIGNATURE { 78, 78, 100, 800, 300, 1600, 12, 0xfff }
+
+/* Manufacturer key the remotes were programmed with, set by main/CMakeLists.txt. 0 disables decryption. */
+#ifndef HCS301_MANUFACTURER_KEY
+#define HCS301_MANUFACTURER_KEY 0
+#endif
+
+/* Counter steps accepted from a single frame, and the steps that are resynchronized by two consecutive frames. */
+#define HCS301_OPEN_WINDOW 16
+#define HCS301_RESYNC_WINDOW 32768
+
+/* Remotes that can be learned at once. */
+#define HCS301_MAX_REMOTES 32
+
+/* Button map that reports each button combination as itself: nibble i is the mapping of buttons i. */
+#define HCS301_BUTTONS_IDENTITY 0xFEDCBA9876543210ULL
+
+/*
+ * Flag of a serial as read before the parser took the code word LSB first:
+ * frame bits 48..71, a byte at a time, first byte most significant (see
+ * hcs301_legacy_serial()). Remotes enrolled with it are matched by that
+ * reading until their first frame, which gives the whole serial; they are
+ * then re-enrolled under it.
+ */
+#define HCS301_SERIAL_LEGACY 0x80000000u
+
+/* Frames waiting for the event task. */
+#define HCS301_EVENT_QUEUE_SIZE 16
+
+/* Advanced sync counters are handed to set_on_counters_changed() at most this often. */
+#define HCS301_COUNTER_SAVE_MS 5000
+
+/**
+ * @brief An authentic frame, or a change of the learned remotes, for the event task.
+ *
+ * A message with no buttons only wakes the task up. `repeat` is set for the
+ * retransmission of a code word already accepted (HCS301_REPEATED), which
+ * only keeps its press going.
+ */
+struct hcs301_frame_t {
+  uint32_t serial;
+  uint32_t time;
+  uint8_t buttons;
+  bool remotes_changed;
+  bool repeat;
+};
+
+/**
+ * @brief The sync counter of a remote, as saved across reboots.
+ */
+struct hcs301_counter_t {
+  uint32_t serial;
+  uint16_t counter;
+};
 
 inline uint8_t reverse8(uint8_t b)
 {
@@ -13,7 +77,32 @@ inline uint8_t reverse8(uint8_t b)
   return b;
 }
 
+/**
+ * @brief Read `count` bits transmitted LSB first from a PWM message.
+ *
+ * @param d PWM message bits, MSB first.
+ * @param first Position of the first (least significant) bit.
+ */
+inline uint32_t lsb_first(const uint8_t *d, uint16_t first, uint8_t count)
+{
+  uint32_t value = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    uint16_t pos = first + i;
+    value |= (uint32_t)((d[pos / 8] >> (7 - pos % 8)) & 1) << i;
+  }
+  return value;
+}
 
+/**
+ * @brief The serial the old parser read from a frame of `serial`.
+ *
+ * It dropped frame bits 44..47, the low nibble, so it cannot be converted
+ * back: 0x001C4A01 is 0x014A1Cx with x unknown.
+ */
+inline uint32_t hcs301_legacy_serial(uint32_t serial)
+{
+  return ((serial >> 4) & 0xff) << 16 | ((serial >> 12) & 0xff) << 8 | ((serial >> 20) & 0xff);
+}
 
 struct __attribute__((packed)) HCS301_t
 {
@@ -28,49 +117,337 @@ struct __attribute__((packed)) HCS301_t
 
   bool is_valid() const { return preamble == 0xfff; }
 
+  /**
+   * @brief Parse a PWM message.
+   *
+   * The code word is sent LSB first: 32-bit hopping code, 28-bit serial, then
+   * the button bits, VLOW and RPT. `buttons` keeps the button bits in the order
+   * they are sent (first bit in bit 3).
+   */
   void update(const uint8_t *d)
   {
-    this->preamble = ((uint16_t)d[0] << 4) | ((d[1] >> 4) & 0x0F);                                                                                                                                       // 12 bits
-    this->encrypted = ((uint32_t)reverse8(d[1] & 0x0F) << 28) | ((uint32_t)reverse8(d[2]) << 20) | ((uint32_t)reverse8(d[3]) << 12) | ((uint32_t)reverse8(d[4]) << 4) | ((uint32_t)reverse8(d[5]) >> 4); // 32 bits
-    this->serial = ((uint32_t)reverse8(d[5] & 0x0F) << 24) | ((uint32_t)reverse8(d[6]) << 16) | ((uint32_t)reverse8(d[7]) << 8) | reverse8(d[8]);                                                        // 28 bits
+    this->preamble = ((uint16_t)d[0] << 4) | ((d[1] >> 4) & 0x0F); // 12 bits
+    this->encrypted = lsb_first(d, 12, 32);
+    this->serial = lsb_first(d, 44, 28);
     this->buttons = (d[9] >> 4) & 0xf;
     this->vlow = (d[9] >> 3) & 0x1;
     this->fixed = (d[9] >> 2) & 0x1;
   }
+
+  uint32_t legacy_serial() const { return hcs301_legacy_serial(serial); }
+
+  /** The button bits as they appear in the hopping code. */
+  uint8_t hopping_buttons() const { return reverse8(buttons) >> 4; }
+};
+
+enum hcs301_result_t : uint8_t {
+  HCS301_ACCEPTED = 0,   // a new press
+  HCS301_REPEATED,       // the last accepted press, retransmitted
+  HCS301_RESYNC,         // counter far ahead; accepted if the next code word follows it
+  HCS301_BAD_DECRYPT,    // discrimination or button bits do not match: wrong key
+  HCS301_OUT_OF_WINDOW,  // counter at or behind the last accepted one, or a repeat after its press ended: a replay
+  HCS301_RESULT_COUNT
 };
 
+/**
+ * @brief Receiver state of one KeeLoq remote: its device key and sync counter.
+ *
+ * The hopping code decrypts to buttons (4 bits), overflow (2), discrimination
+ * (10, the low serial bits) and a 16-bit counter that the remote increments on
+ * every press. A code word is accepted if its counter is at most
+ * HCS301_OPEN_WINDOW ahead of the last accepted one. Further ahead, up to
+ * HCS301_RESYNC_WINDOW, it takes two consecutive code words, which is also how
+ * a remote is picked up after a reboot: ahead of the counter saved before it
+ * (see restore()), or anywhere if none was. Anything else is a replay. The last
+ * code word and its verdict are kept, so the repeats of a held button cost a
+ * compare instead of a decryption. A repeat only counts as one while it
+ * follows the previous frame of the press within the release time; the same
+ * code word later on is a replay of a press that has ended.
+ */
+struct hcs301_remote_t {
+  uint32_t serial;
+  keeloq_key_t key;
+  keeloq_learning_t learning = KEELOQ_LEARNING_NORMAL;
+  uint64_t button_map = HCS301_BUTTONS_IDENTITY;
+  uint16_t counter = 0;
+  uint16_t resync_counter = 0;
+  bool synced = false;
+  bool restored = false;  // `counter` is the one saved before a reboot; a resync must be ahead of it
+  bool resync_pending = false;
+  bool has_last = false;
+  hcs301_result_t last_result = HCS301_BAD_DECRYPT;
+  uint32_t last_encrypted = 0;
+  uint32_t last_ms = 0;  // time of the last accepted or repeated frame
+  uint32_t decrypts = 0;
 
-class HCS301 : public PWMDecoder {
+  hcs301_remote_t(uint32_t serial = 0, uint64_t device_key = 0) : serial(serial), key(device_key) {}
+
+  /**
+   * @brief Check a code word from this remote.
+   *
+   * @param frame The parsed code word; its serial is not checked.
+   * @param counter Set to the decrypted counter.
+   * @param now_ms Time of the frame.
+   * @param release_ms How long after the previous frame of a press a repeat may come.
+   */
+  hcs301_result_t check(const HCS301_t &frame, uint16_t *counter, uint32_t now_ms, uint32_t release_ms) {
+    hcs301_result_t result;
+    if (has_last && frame.encrypted == last_encrypted) {
+      *counter = this->counter;
+      result = last_result == HCS301_ACCEPTED ? HCS301_REPEATED : last_result;
+    } else {
+      decrypts++;
+      uint32_t hop = keeloq::decrypt(frame.encrypted, key);
+      *counter = hop & 0xffff;
+      has_last = true;
+      last_encrypted = frame.encrypted;
+      result = last_result = verify(hop, frame.hopping_buttons());
+    }
+    return timed(result, now_ms, release_ms);
+  }
+
+  /**
+   * @brief Take `frame`, already checked, as the last accepted code word.
+   */
+  void sync(const HCS301_t &frame, uint16_t counter, uint32_t now_ms) {
+    this->counter = counter;
+    synced = true;
+    resync_pending = false;
+    has_last = true;
+    last_encrypted = frame.encrypted;
+    last_result = HCS301_ACCEPTED;
+    last_ms = now_ms;
+  }
+
+  /**
+   * @brief Take `counter`, saved before a reboot, as the one a resync must be ahead of.
+   */
+  void restore(uint16_t counter) {
+    this->counter = counter;
+    synced = false;
+    restored = true;
+    resync_pending = false;
+    has_last = false;
+  }
+
+  /**
+   * @brief Check a code word by itself, for remotes without a manufacturer key.
+   *
+   * A new code word is a new press, the last one a repeat while the press
+   * lasts; there is no counter to check.
+   */
+  hcs301_result_t checkPlain(const HCS301_t &frame, uint32_t now_ms, uint32_t release_ms) {
+    bool repeat = has_last && frame.encrypted == last_encrypted;
+    has_last = true;
+    last_encrypted = frame.encrypted;
+    return timed(repeat ? HCS301_REPEATED : HCS301_ACCEPTED, now_ms, release_ms);
+  }
+
+  /** The button combination `buttons` is reported as. */
+  uint8_t mapButtons(uint8_t buttons) const { return (button_map >> (4 * (buttons & 0xf))) & 0xf; }
+
+private:
+  /**
+   * @brief A repeat more than `release_ms` after the last frame of its press is a replay.
+   */
+  hcs301_result_t timed(hcs301_result_t result, uint32_t now_ms, uint32_t release_ms) {
+    if (result == HCS301_REPEATED && now_ms - last_ms > release_ms) {
+      return HCS301_OUT_OF_WINDOW;
+    }
+    if (result <= HCS301_REPEATED) {
+      last_ms = now_ms;
+    }
+    return result;
+  }
+
+  hcs301_result_t verify(uint32_t hop, uint8_t buttons) {
+    if (((hop >> 16) & 0x3ff) != (serial & 0x3ff) || (hop >> 28) != buttons) {
+      return HCS301_BAD_DECRYPT;
+    }
+    uint16_t received = hop & 0xffff;
+    uint16_t ahead = received - counter;
+    if (synced && ahead == 0) {
+      return HCS301_REPEATED;
+    }
+    if (synced && ahead <= HCS301_OPEN_WINDOW) {
+      counter = received;
+      resync_pending = false;
+      return HCS301_ACCEPTED;
+    }
+    if ((!synced && !restored) || (ahead > 0 && ahead < HCS301_RESYNC_WINDOW)) {
+      if (resync_pending && received == (uint16_t)(resync_counter + 1)) {
+        counter = received;
+        synced = true;
+        resync_pending = false;
+        return HCS301_ACCEPTED;
+      }
+      resync_pending = true;
+      resync_counter = received;
+      return HCS301_RESYNC;
+    }
+    return HCS301_OUT_OF_WINDOW;
+  }
+};
+
+/**
+ * @brief The learned remotes, by serial.
+ *
+ * Open addressing with linear probing in a table of twice HCS301_MAX_REMOTES
+ * slots, so finding a remote is a hash and a probe or two however many are
+ * learned. remove() moves the entries that follow back into the gap instead of
+ * leaving tombstones, so probes stay short as remotes come and go.
+ *
+ * Not thread safe; HCS301 guards it with its mutex.
+ */
+class HCS301Remotes
+{
 public:
-  EventGroupHandle_t eventGroup;
+  hcs301_remote_t *find(uint32_t serial) {
+    for (size_t i = home(serial); used_[i]; i = (i + 1) & MASK) {
+      if (slots_[i].serial == serial) {
+        return &slots_[i];
+      }
+    }
+    return nullptr;
+  }
+
+  /**
+   * @brief Add a remote, or replace the one with the same serial.
+   *
+   * @return The stored remote; nullptr if the table is full.
+   */
+  hcs301_remote_t *insert(const hcs301_remote_t &remote) {
+    size_t i = home(remote.serial);
+    for (; used_[i]; i = (i + 1) & MASK) {
+      if (slots_[i].serial == remote.serial) {
+        slots_[i] = remote;
+        return &slots_[i];
+      }
+    }
+    if (size_ == HCS301_MAX_REMOTES) {
+      return nullptr;
+    }
+    used_[i] = true;
+    slots_[i] = remote;
+    size_++;
+    return &slots_[i];
+  }
+
+  bool remove(uint32_t serial) {
+    size_t i = home(serial);
+    for (; used_[i] && slots_[i].serial != serial; i = (i + 1) & MASK) {
+    }
+    if (!used_[i]) {
+      return false;
+    }
+    // Backward shift: pull back every following entry whose probe passes the gap.
+    for (size_t j = (i + 1) & MASK; used_[j]; j = (j + 1) & MASK) {
+      size_t h = home(slots_[j].serial);
+      if (((j - h) & MASK) >= ((j - i) & MASK)) {
+        slots_[i] = slots_[j];
+        i = j;
+      }
+    }
+    used_[i] = false;
+    size_--;
+    return true;
+  }
+
+  void clear() {
+    memset(used_, 0, sizeof(used_));
+    size_ = 0;
+  }
+
+  size_t size() const { return size_; }
+
+  template <typename F>
+  void forEach(F f) const {
+    for (size_t i = 0; i < SLOTS; i++) {
+      if (used_[i]) {
+        f(slots_[i]);
+      }
+    }
+  }
+
+private:
+  static constexpr size_t SLOTS = 2 * HCS301_MAX_REMOTES;
+  static constexpr size_t MASK = SLOTS - 1;
+  static_assert((SLOTS & MASK) == 0, "HCS301_MAX_REMOTES must be a power of two");
+
+  static constexpr uint8_t log2(size_t n) { return n <= 1 ? 0 : 1 + log2(n / 2); }
 
+  /* Fibonacci hashing: the top bits of serial * 2^32 / phi. */
+  static size_t home(uint32_t serial) { return (uint32_t)(serial * 2654435769u) >> (32 - log2(SLOTS)); }
+
+  hcs301_remote_t slots_[SLOTS];
+  bool used_[SLOTS] = {};
+  size_t size_ = 0;
+};
+
+
+class HCS301 : public PWMDecoder {
+public:
   /**
-   * @brief Construct a new HCS301 object.
+   * @brief Construct a new HCS301 object with no remotes; see enroll() and learn().
    *
-   * @param serial a 28-bit serial number
+   * @param manufacturer_key KeeLoq manufacturer key; 0 accepts any code word from a learned serial
    */
-  HCS301(uint32_t serial = 0) {
-    serial_ = serial;
+  HCS301(uint64_t manufacturer_key = HCS301_MANUFACTURER_KEY) : PWMDecoder("HCS301", HCS301_SIGNATURE) {
+    manufacturer_key_ = manufacturer_key;
     data_ = HCS301_t();
-    eventGroup = xEventGroupCreateStatic(&eventGroupBuffer_);
+    mutex_ = xSemaphoreCreateMutexStatic(&mutexBuffer_);
+    queue_ = xQueueCreateStatic(HCS301_EVENT_QUEUE_SIZE, sizeof(hcs301_frame_t), queueStorage_, &queueBuffer_);
+    buttons_.setSink([this](const button_event_t &event) {
+      if (on_button_event_) {
+        on_button_event_(event);
+      }
+      if (event.type == BUTTON_PRESS && on_buttons_press_) {
+        on_buttons_press_(event.buttons);
+      }
+    });
     xTaskCreate(task_event_handler, "HCS301 event handler", 4*1024, this, 3, NULL);
   }
 
   /**
    * @brief Event handler task for HCS301 class.
    *
-   * Waits for bits in eventGroup to be set and calls on_buttons_press_
-   * callback with the set bits.
+   * Feeds the frames the decoder queued to the button tracker, which calls
+   * the button callbacks, and calls on_remotes_changed_ when a remote was
+   * learned and on_counters_changed_ when a counter advanced, at most every
+   * HCS301_COUNTER_SAVE_MS. The queue wait is bounded by the tracker's next
+   * deadline and the next save, so holds and releases are reported on time
+   * with one task for all remotes.
    *
    * @param args pointer to HCS301 object
    */
   static void task_event_handler(void *args) {
     HCS301 *this_ = (HCS301 *)args;
-    EventBits_t uxBits;
+    hcs301_frame_t frame;
     for(;;) {
-      uxBits = xEventGroupWaitBits(this_->eventGroup, HCS_BTNS_EVENTS_BITS, pdTRUE, pdFALSE, portMAX_DELAY);
-      if (this_->on_buttons_press_) {
-        this_->on_buttons_press_(uxBits);
+      uint32_t now = millis();
+      xSemaphoreTake(this_->mutex_, portMAX_DELAY);
+      this_->buttons_.setTiming(this_->timing_);
+      uint32_t save_ms = this_->msUntilCountersSave(now);
+      bool save = save_ms == 0;
+      if (save) {
+        this_->counters_changed_ = false;
+        this_->counters_saved_ms_ = now;
+        save_ms = UINT32_MAX;
+      }
+      xSemaphoreGive(this_->mutex_);
+      if (save && this_->on_counters_changed_) {
+        this_->on_counters_changed_();
+      }
+      uint32_t deadline_ms = MIN(this_->buttons_.msUntilDeadline(now), save_ms);
+      TickType_t wait = deadline_ms == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(deadline_ms) + 1;
+      if (xQueueReceive(this_->queue_, &frame, wait) != pdTRUE) {
+        this_->buttons_.poll(millis());
+      } else if (frame.remotes_changed) {
+        if (this_->on_remotes_changed_) {
+          this_->on_remotes_changed_();
+        }
+      } else if (frame.buttons) {
+        this_->buttons_.frame(frame.serial, frame.buttons, frame.time, frame.repeat);
       }
     }
     vTaskDelete(NULL);
@@ -79,8 +456,8 @@ public:
   /**
    * @brief Set a callback for button press events.
    *
-   * The callback will be called with the set bits in the eventGroup as
-   * argument when a new set of buttons is detected.
+   * The callback will be called once per press, with the remote's mapping of
+   * the pressed buttons. Holding the buttons does not call it again.
    *
    * @param cb a std::function<void(EventBits_t)> callback
    */
@@ -88,34 +465,416 @@ public:
     on_buttons_press_ = cb;
   }
 
+  /**
+   * @brief Set a callback for every press, hold and release, with the remote's serial.
+   */
+  void set_on_button_event(std::function<void(const button_event_t &)> cb) {
+    on_button_event_ = cb;
+  }
+
+  /**
+   * @brief Set a callback for when learning mode enrolled a remote, to persist the remotes.
+   *
+   * Called from the event handler task, not from the decoder.
+   */
+  void set_on_remotes_changed(std::function<void()> cb) {
+    on_remotes_changed_ = cb;
+  }
+
+  /**
+   * @brief Set a callback for when a sync counter advanced, to save them with counters().
+   *
+   * Called from the event handler task, HCS301_COUNTER_SAVE_MS apart at the
+   * closest, so flash is not written on every press; the presses of the last
+   * few seconds before a power cut are not saved.
+   */
+  void set_on_counters_changed(std::function<void()> cb) {
+    on_counters_changed_ = cb;
+  }
+
+  /**
+   * @brief The sync counters of the remotes that have one, for restoreCounters() after a reboot.
+   *
+   * @return How many were written to `counters`, at most HCS301_MAX_REMOTES.
+   */
+  size_t counters(hcs301_counter_t *counters) {
+    size_t count = 0;
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    remotes_.forEach([&](const hcs301_remote_t &remote) {
+      if (remote.synced || remote.restored) {
+        counters[count++] = { remote.serial, remote.counter };
+      }
+    });
+    xSemaphoreGive(mutex_);
+    return count;
+  }
+
+  /**
+   * @brief Give the learned remotes the counters saved before a reboot.
+   *
+   * A remote is then only resynchronized by code words ahead of its saved
+   * counter, so presses recorded before the reboot cannot be replayed.
+   */
+  void restoreCounters(const hcs301_counter_t *counters, size_t count) {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    for (size_t i = 0; i < count; i++) {
+      hcs301_remote_t *remote = remotes_.find(counters[i].serial);
+      if (remote && !remote->synced) {
+        remote->restore(counters[i].counter);
+      }
+    }
+    xSemaphoreGive(mutex_);
+  }
+
+  /**
+   * @brief Set the press, hold and release thresholds of all remotes.
+   */
+  void setButtonTiming(const button_timing_t &timing) {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    timing_ = timing;
+    xSemaphoreGive(mutex_);
+    notify({ 0, 0, 0, false, false });  // wake the event task to pick it up
+  }
+
+  button_timing_t buttonTiming() {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    button_timing_t timing = timing_;
+    xSemaphoreGive(mutex_);
+    return timing;
+  }
+
+  /**
+   * @brief Add a remote or update a learned one.
+   *
+   * @param serial a 28-bit serial number; or, with HCS301_SERIAL_LEGACY, a serial read by the old parser
+   * @param learning how the remote's device key derives from the manufacturer key
+   * @param button_map nibble i is what button combination i is reported as
+   * @return false if the table is full.
+   */
+  bool enroll(uint32_t serial, keeloq_learning_t learning = KEELOQ_LEARNING_NORMAL,
+              uint64_t button_map = HCS301_BUTTONS_IDENTITY) {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    bool ok = enrollLocked(serial, learning, button_map) != nullptr;
+    xSemaphoreGive(mutex_);
+    return ok;
+  }
+
+  bool remove(uint32_t serial) {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    bool ok = remotes_.remove(serial);
+    xSemaphoreGive(mutex_);
+    return ok;
+  }
+
+  /**
+   * @brief Enroll the remote of the next valid code word from an unknown serial.
+   *
+   * With a manufacturer key, the code word must decrypt under normal or simple
+   * learning. Learning ends with the first enrolled remote or after `timeout_ms`.
+   */
+  void learn(uint32_t timeout_ms) {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    learning_ = timeout_ms > 0;
+    learn_until_ms_ = millis() + timeout_ms;
+    xSemaphoreGive(mutex_);
+  }
+
+  /**
+   * @brief Replace the learned remotes with the `remotes` array of `json`, as written by serializeRemotes().
+   */
+  void deserializeRemotes(const cJSON *json) {
+    const cJSON *remotes = cJSON_GetObjectItem(json, "remotes");
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    remotes_.clear();
+    for (int i = 0; i < cJSON_GetArraySize(remotes); i++) {
+      const cJSON *remote = cJSON_GetArrayItem(remotes, i);
+      if (!cJSON_IsNumber(cJSON_GetObjectItem(remote, "serial"))) {
+        continue;
+      }
+      uint32_t serial = parseSerial(remote);
+      const char *learning = cJSON_GetStringValue(cJSON_GetObjectItem(remote, "learning"));
+      uint64_t button_map = HCS301_BUTTONS_IDENTITY;
+      parseButtons(cJSON_GetObjectItem(remote, "buttons"), &button_map);
+      enrollLocked(serial, parseLearning(learning), button_map);
+    }
+    timing_ = ButtonTracker::parseTiming(cJSON_GetObjectItem(json, "timing"), timing_);
+    xSemaphoreGive(mutex_);
+  }
+
+  /**
+   * @brief Write the learned remotes and the learning mode to `json`.
+   *
+   * @param state Include the counter state and learning mode, which are not kept here (see counters()).
+   */
+  void serializeRemotes(cJSON *json, bool state = false) {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    if (state) {
+      uint32_t now = millis();
+      bool learning = learning_ && (int32_t)(learn_until_ms_ - now) > 0;
+      cJSON_AddBoolToObject(json, "learning", learning);
+      cJSON_AddNumberToObject(json, "learn_ms_left", learning ? learn_until_ms_ - now : 0);
+      cJSON_AddNumberToObject(json, "capacity", HCS301_MAX_REMOTES);
+    }
+    ButtonTracker::serializeTiming(cJSON_AddObjectToObject(json, "timing"), timing_);
+    cJSON *remotes = cJSON_AddArrayToObject(json, "remotes");
+    remotes_.forEach([&](const hcs301_remote_t &remote) {
+      cJSON *item = cJSON_CreateObject();
+      cJSON_AddNumberToObject(item, "serial", remote.serial & ~HCS301_SERIAL_LEGACY);
+      if (remote.serial & HCS301_SERIAL_LEGACY) {
+        cJSON_AddBoolToObject(item, "legacy", true);
+      }
+      cJSON_AddStringToObject(item, "learning", remote.learning == KEELOQ_LEARNING_SIMPLE ? "simple" : "normal");
+      cJSON *buttons = cJSON_AddArrayToObject(item, "buttons");
+      for (uint8_t b = 0; b < 16; b++) {
+        cJSON_AddItemToArray(buttons, cJSON_CreateNumber(remote.mapButtons(b)));
+      }
+      if (state) {
+        cJSON_AddNumberToObject(item, "counter", remote.counter);
+        cJSON_AddBoolToObject(item, "synced", remote.synced);
+      }
+      cJSON_AddItemToArray(remotes, item);
+    });
+    xSemaphoreGive(mutex_);
+  }
+
+  /**
+   * @brief The `serial` of a remote object, with HCS301_SERIAL_LEGACY if `legacy` is true.
+   */
+  static uint32_t parseSerial(const cJSON *json) {
+    uint32_t serial = (uint32_t)cJSON_GetNumberValue(cJSON_GetObjectItem(json, "serial")) & 0x0fffffff;
+    return cJSON_IsTrue(cJSON_GetObjectItem(json, "legacy")) ? serial | HCS301_SERIAL_LEGACY : serial;
+  }
+
+  static keeloq_learning_t parseLearning(const char *learning) {
+    return learning && strcmp(learning, "simple") == 0 ? KEELOQ_LEARNING_SIMPLE : KEELOQ_LEARNING_NORMAL;
+  }
+
+  /**
+   * @brief Read a button map from an array of up to 16 numbers: entry i is what buttons i are reported as.
+   *
+   * @return false if `json` is not an array.
+   */
+  static bool parseButtons(const cJSON *json, uint64_t *button_map) {
+    if (!cJSON_IsArray(json)) {
+      return false;
+    }
+    for (int b = 0; b < 16 && b < cJSON_GetArraySize(json); b++) {
+      uint64_t mapped = (uint8_t)cJSON_GetNumberValue(cJSON_GetArrayItem(json, b)) & 0xf;
+      *button_map = (*button_map & ~(0xfULL << (4 * b))) | mapped << (4 * b);
+    }
+    return true;
+  }
+
   /**
    * @brief Decode the given PWM message and trigger button press events
    *
    * @param pwm_msg The PWM message to decode
    * @param rmt_msg The RMT message that was decoded into pwm_msg
    *
-   * This function decodes the given PWM message and checks if it is a valid
-   * message for the given serial number and if the encrypted value has changed.
-   * If so, it triggers the button press event by setting the corresponding
-   * bits in the eventGroup.
+   * This function decodes the given PWM message and looks its serial up in
+   * the learned remotes. With a manufacturer key, the hopping code is
+   * decrypted and checked against the remote's counter (see
+   * hcs301_remote_t); without one, any code word from the serial is taken.
+   * A remote enrolled with a legacy serial is moved to the frame's serial
+   * first (see migrateLocked()). In learning mode, an unknown serial is
+   * enrolled first. Authentic frames
+   * are published as decoded events and queued, with the remote's mapping
+   * of their buttons, for the button tracker.
+   *
+   * @return true if the message is a valid frame from a learned remote that
+   * passed the counter check (accepted or repeated); a frame waiting for a
+   * resync or rejected by KeeLoq is a miss, counted under the KeeLoq verdicts.
    */
-  void decode_pwm(pwm_message_t *pwm_msg, rmt_message_t *rmt_msg) override {
+  bool decode_pwm(pwm_message_t *pwm_msg, rmt_message_t *rmt_msg) override {
     if (rmt_msg->length != 78) {
-      return;
+      return false;
     }
     data_.update(pwm_msg->buf);
-    if (data_.is_valid() && data_.serial == serial_ && data_.encrypted != last_encripted_) {
-      xEventGroupSetBits(eventGroup, data_.buttons);
-      last_encripted_ = data_.encrypted;
+    if (!data_.is_valid()) {
+      return false;
+    }
+    uint16_t counter = 0;
+    hcs301_result_t result;
+    uint8_t buttons;
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    hcs301_remote_t *remote = remotes_.find(data_.serial);
+    if (!remote) {
+      remote = migrateLocked(rmt_msg->time);
+    }
+    if (!remote && learning_) {
+      remote = learnLocked(rmt_msg->time, &counter);
+      result = HCS301_ACCEPTED;
+    } else if (!remote) {
+      xSemaphoreGive(mutex_);
+      return false;
+    } else if (manufacturer_key_) {
+      result = remote->check(data_, &counter, rmt_msg->time, timing_.release_ms);
+    } else {
+      result = remote->checkPlain(data_, rmt_msg->time, timing_.release_ms);
     }
+    if (remote) {
+      buttons = remote->mapButtons(data_.buttons);
+      results_[result]++;
+      counters_changed_ |= manufacturer_key_ && result == HCS301_ACCEPTED;
+    }
+    xSemaphoreGive(mutex_);
+    if (!remote) {
+      return false;
+    }
+    if (result > HCS301_REPEATED) {
+      ESP_LOGD(TAG_HCS301, "%07lx: rejected 0x%08lx: %d", (unsigned long)data_.serial, (unsigned long)data_.encrypted, result);
+      return false;
+    }
+    decoded_event_t event(PROTOCOL_HCS301, rmt_msg);
+    event.setPayload(pwm_msg->buf, 12, 66);
+    event.addField(FIELD_SERIAL, data_.serial);
+    event.addField(FIELD_ENCRYPTED, data_.encrypted);
+    event.addField(FIELD_BUTTONS, data_.buttons);
+    event.addField(FIELD_VLOW, data_.vlow);
+    if (manufacturer_key_) {
+      event.addField(FIELD_COUNTER, counter);
+    }
+    DecodedEvents::publish(event);
+    if (buttons || result == HCS301_ACCEPTED) {  // a new code word also wakes the task to save its counter
+      notify({ data_.serial, (uint32_t)rmt_msg->time, buttons, false, result == HCS301_REPEATED });
+    }
+    return true;
   }
 
-
+  /**
+   * @brief Add the KeeLoq verdicts to a stats object.
+   */
+  void serializeKeeloqStats(cJSON *json) {
+    static const char *names[HCS301_RESULT_COUNT] = { "accepted", "repeated", "resync", "bad_decrypt", "out_of_window" };
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    uint32_t decrypts = 0;
+    remotes_.forEach([&](const hcs301_remote_t &remote) { decrypts += remote.decrypts; });
+    for (int i = 0; i < HCS301_RESULT_COUNT; i++) {
+      cJSON_AddNumberToObject(json, names[i], results_[i]);
+    }
+    cJSON_AddNumberToObject(json, "decrypts", decrypts);
+    cJSON_AddNumberToObject(json, "remotes", remotes_.size());
+    xSemaphoreGive(mutex_);
+  }
 
 private:
   std::function<void(EventBits_t)> on_buttons_press_;
+  std::function<void(const button_event_t &)> on_button_event_;
+  std::function<void()> on_remotes_changed_;
+  std::function<void()> on_counters_changed_;
   HCS301_t data_;
-  uint32_t serial_;
-  uint32_t last_encripted_ = 0;
-  StaticEventGroup_t eventGroupBuffer_;
+  uint64_t manufacturer_key_;
+  HCS301Remotes remotes_;
+  bool learning_ = false;
+  uint32_t learn_until_ms_ = 0;
+  uint32_t results_[HCS301_RESULT_COUNT] = {};
+  bool counters_changed_ = false;
+  uint32_t counters_saved_ms_ = 0;
+  SemaphoreHandle_t mutex_;
+  StaticSemaphore_t mutexBuffer_;
+  ButtonTracker buttons_;
+  button_timing_t timing_ = { BUTTON_RELEASE_MS, BUTTON_HOLD_MS, BUTTON_REPEAT_MS };
+  QueueHandle_t queue_;
+  StaticQueue_t queueBuffer_;
+  uint8_t queueStorage_[HCS301_EVENT_QUEUE_SIZE * sizeof(hcs301_frame_t)];
+
+  /**
+   * @brief Time until changed counters are due to be saved, UINT32_MAX if none changed.
+   */
+  uint32_t msUntilCountersSave(uint32_t now_ms) const {
+    if (!counters_changed_) {
+      return UINT32_MAX;
+    }
+    int32_t due = (int32_t)(counters_saved_ms_ + HCS301_COUNTER_SAVE_MS - now_ms);
+    return due > 0 ? due : 0;
+  }
+
+  void notify(const hcs301_frame_t &frame) {
+    if (xQueueSend(queue_, &frame, 0) != pdTRUE) {
+      ESP_LOGW(TAG_HCS301, "Event queue full");
+    }
+  }
+
+  hcs301_remote_t *enrollLocked(uint32_t serial, keeloq_learning_t learning, uint64_t button_map) {
+    hcs301_remote_t *known = remotes_.find(serial);
+    if (known && known->learning == learning) {
+      known->button_map = button_map;  // keep the counter state
+      return known;
+    }
+    // A legacy serial lacks the low nibble the device key derives from; it gets its key when migrated.
+    bool keyed = manufacturer_key_ && !(serial & HCS301_SERIAL_LEGACY);
+    hcs301_remote_t remote(serial, keyed ? keeloq::deviceKey(serial, manufacturer_key_, learning) : 0);
+    remote.learning = learning;
+    remote.button_map = button_map;
+    return remotes_.insert(remote);
+  }
+
+  /**
+   * @brief Move the remote enrolled with data_'s legacy serial to its whole serial.
+   *
+   * With a manufacturer key, the code word must decrypt under the key derived
+   * from the whole serial, so a neighbour's remote whose serial happens to
+   * share the legacy bits is not taken for it. The learning mode and button
+   * map are kept; the counter is picked up by the usual resync.
+   *
+   * @return The migrated remote, nullptr if there is none for data_.
+   */
+  hcs301_remote_t *migrateLocked(uint32_t now_ms) {
+    hcs301_remote_t *legacy = remotes_.find(HCS301_SERIAL_LEGACY | data_.legacy_serial());
+    if (!legacy) {
+      return nullptr;
+    }
+    hcs301_remote_t remote(data_.serial,
+                           manufacturer_key_ ? keeloq::deviceKey(data_.serial, manufacturer_key_, legacy->learning) : 0);
+    remote.learning = legacy->learning;
+    remote.button_map = legacy->button_map;
+    if (manufacturer_key_) {
+      hcs301_remote_t probe = remote;
+      uint16_t counter;
+      if (probe.check(data_, &counter, now_ms, timing_.release_ms) == HCS301_BAD_DECRYPT) {
+        return nullptr;
+      }
+    }
+    remotes_.remove(legacy->serial);
+    hcs301_remote_t *migrated = remotes_.insert(remote);
+    ESP_LOGI(TAG_HCS301, "Legacy serial %06lx is remote %07lx", (unsigned long)data_.legacy_serial(),
+             (unsigned long)data_.serial);
+    notify({ 0, 0, 0, true, false });
+    return migrated;
+  }
+
+  /**
+   * @brief Enroll the remote data_ came from, if learning has not timed out and it decrypts.
+   */
+  hcs301_remote_t *learnLocked(uint32_t now_ms, uint16_t *counter) {
+    if ((int32_t)(learn_until_ms_ - now_ms) <= 0) {
+      learning_ = false;
+      return nullptr;
+    }
+    hcs301_remote_t remote(data_.serial);
+    if (manufacturer_key_) {
+      const keeloq_learning_t modes[2] = { KEELOQ_LEARNING_NORMAL, KEELOQ_LEARNING_SIMPLE };
+      bool found = false;
+      for (keeloq_learning_t mode : modes) {
+        remote = hcs301_remote_t(data_.serial, keeloq::deviceKey(data_.serial, manufacturer_key_, mode));
+        remote.learning = mode;
+        // A fresh remote has no counter yet, so anything but a wrong key asks for a resync.
+        if (remote.check(data_, counter, now_ms, timing_.release_ms) != HCS301_BAD_DECRYPT) {
+          found = true;
+          break;
+        }
+      }
+      if (!found) {
+        return nullptr;
+      }
+    }
+    remote.sync(data_, *counter, now_ms);
+    hcs301_remote_t *learned = remotes_.insert(remote);
+    if (learned) {
+      learning_ = false;
+      ESP_LOGI(TAG_HCS301, "Learned remote %07lx", (unsigned long)data_.serial);
+      notify({ 0, 0, 0, true, false });
+    }
+    return learned;
+  }
 };
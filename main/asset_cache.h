@@ -0,0 +1,219 @@
+#pragma once
+#include <Arduino.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "esp_heap_caps.h"
+
+#define TAG_ASSETS "ASSETS"
+
+/* Directory the web UI is served from. */
+#define ASSET_CACHE_ROOT "/spiffs/www"
+
+#define ASSET_CACHE_MAX_ENTRIES 16
+#define ASSET_CACHE_NAME_MAX 48
+
+/*
+ * Bytes of asset bodies kept in RAM, and heap left free after loading them.
+ * Without PSRAM the S2 cannot spare the 170 KiB of index.html.gz, so only the
+ * small assets are kept there; the rest keep their metadata and ETag and are
+ * read from SPIFFS when a client does not have them yet.
+ */
+#ifndef ASSET_CACHE_MAX_BYTES
+#if CONFIG_SPIRAM
+#define ASSET_CACHE_MAX_BYTES (1024 * 1024)
+#else
+#define ASSET_CACHE_MAX_BYTES (32 * 1024)
+#endif
+#endif
+#define ASSET_CACHE_HEAP_RESERVE (96 * 1024)
+
+#if CONFIG_SPIRAM
+#define ASSET_CACHE_CAPS (MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
+#else
+#define ASSET_CACHE_CAPS MALLOC_CAP_8BIT
+#endif
+
+/* Clients may use an asset for a week without asking again. HTML is always revalidated. */
+#define ASSET_CACHE_CONTROL "public, max-age=604800"
+
+#define ASSET_CHECK_EXTENSION(filename, ext) \
+  (strlen(filename) >= strlen(ext) && strcasecmp(&filename[strlen(filename) - strlen(ext)], ext) == 0)
+
+/**
+ * @brief MIME type of a file, by its extension; a trailing ".gz" is looked through.
+ */
+static const char *asset_content_type(const char *filepath)
+{
+  if (ASSET_CHECK_EXTENSION(filepath, ".html") || ASSET_CHECK_EXTENSION(filepath, ".html.gz")) {
+    return "text/html";
+  } else if (ASSET_CHECK_EXTENSION(filepath, ".json")) {
+    return "application/json";
+  } else if (ASSET_CHECK_EXTENSION(filepath, ".js") || ASSET_CHECK_EXTENSION(filepath, ".js.gz")) {
+    return "application/javascript";
+  } else if (ASSET_CHECK_EXTENSION(filepath, ".css") || ASSET_CHECK_EXTENSION(filepath, ".css.gz")) {
+    return "text/css";
+  } else if (ASSET_CHECK_EXTENSION(filepath, ".png")) {
+    return "image/png";
+  } else if (ASSET_CHECK_EXTENSION(filepath, ".ico")) {
+    return "image/x-icon";
+  } else if (ASSET_CHECK_EXTENSION(filepath, ".svg") || ASSET_CHECK_EXTENSION(filepath, ".svg.gz")) {
+    return "text/xml";
+  } else if (ASSET_CHECK_EXTENSION(filepath, ".pvc")) {
+    return "application/octet-stream";
+  }
+  return "text/plain";
+}
+
+/**
+ * @brief A file of the web UI.
+ *
+ * `data` is NULL for a file too large for the cache; it is then streamed
+ * from `ASSET_CACHE_ROOT "/" name`.
+ */
+struct asset_t {
+  char name[ASSET_CACHE_NAME_MAX];  // path below ASSET_CACHE_ROOT, without the leading '/'
+  const char *type;
+  const char *cache_control;
+  bool gzip;
+  char etag[11];                    // quoted FNV-1a of the body
+  uint32_t size;
+  const uint8_t *data;
+};
+
+/**
+ * @brief Web UI files, indexed at startup.
+ *
+ * Every file below ASSET_CACHE_ROOT is read once at boot to compute its ETag,
+ * and kept in RAM if it fits ASSET_CACHE_MAX_BYTES. Requests are then resolved
+ * against the index instead of the filesystem: the `stat()` chain of the
+ * original handler (the file, the file with ".gz", then index.html.gz) becomes
+ * a lookup, and a client that already has the file gets a 304.
+ */
+class AssetCache
+{
+public:
+  void init() {
+    DIR *dir = opendir(ASSET_CACHE_ROOT);
+    if (dir == NULL) {
+      ESP_LOGE(TAG_ASSETS, "Cannot open %s", ASSET_CACHE_ROOT);
+      return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL && count_ < ASSET_CACHE_MAX_ENTRIES) {
+      if (strlen(entry->d_name) >= ASSET_CACHE_NAME_MAX) {
+        ESP_LOGW(TAG_ASSETS, "Name too long, not served: %s", entry->d_name);
+        continue;
+      }
+      if (load(entry->d_name, &assets_[count_])) {
+        count_++;
+      }
+    }
+    closedir(dir);
+    ESP_LOGI(TAG_ASSETS, "%u assets, %lu bytes in RAM", count_, (unsigned long)cached_bytes_);
+  }
+
+  bool empty() const { return count_ == 0; }
+
+  /**
+   * @brief Resolve a request path as the file, the file with ".gz", or index.html.gz.
+   *
+   * The query string, if any, is ignored.
+   *
+   * @return The asset, NULL if not even index.html.gz is there.
+   */
+  const asset_t *resolve(const char *uri) const {
+    char name[ASSET_CACHE_NAME_MAX + 3];
+    while (*uri == '/') {
+      uri++;
+    }
+    size_t len = strcspn(uri, "?#");
+    if (len > 0 && len < ASSET_CACHE_NAME_MAX) {
+      memcpy(name, uri, len);
+      name[len] = '\0';
+      const asset_t *asset = find(name);
+      if (asset) {
+        return asset;
+      }
+      strcpy(name + len, ".gz");
+      if ((asset = find(name))) {
+        return asset;
+      }
+    }
+    return find("index.html.gz");
+  }
+
+  const asset_t *find(const char *name) const {
+    for (uint8_t i = 0; i < count_; i++) {
+      if (strcmp(assets_[i].name, name) == 0) {
+        return &assets_[i];
+      }
+    }
+    return NULL;
+  }
+
+private:
+  asset_t assets_[ASSET_CACHE_MAX_ENTRIES] = {};
+  uint8_t count_ = 0;
+  size_t cached_bytes_ = 0;
+
+  bool load(const char *name, asset_t *asset) {
+    char path[sizeof(ASSET_CACHE_ROOT) + ASSET_CACHE_NAME_MAX];
+    snprintf(path, sizeof(path), ASSET_CACHE_ROOT "/%s", name);
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+      return false;
+    }
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+      return false;
+    }
+    strlcpy(asset->name, name, sizeof(asset->name));
+    asset->type = asset_content_type(name);
+    asset->gzip = ASSET_CHECK_EXTENSION(name, ".gz");
+    asset->cache_control = strcmp(asset->type, "text/html") == 0 ? "no-cache" : ASSET_CACHE_CONTROL;
+    asset->size = st.st_size;
+    uint8_t *data = NULL;
+    if (cached_bytes_ + asset->size <= ASSET_CACHE_MAX_BYTES &&
+        heap_caps_get_free_size(ASSET_CACHE_CAPS) >= asset->size + ASSET_CACHE_HEAP_RESERVE) {
+      data = (uint8_t *)heap_caps_malloc(asset->size ? asset->size : 1, ASSET_CACHE_CAPS);
+    }
+
+    uint32_t hash = 2166136261u;
+    bool ok = true;
+    if (data) {
+      ok = fread(data, 1, asset->size, f) == asset->size;
+      hash = fnv1a(hash, data, asset->size);
+    } else {
+      // Hash it anyway, a chunk at a time; the ETag must not depend on the cache.
+      uint8_t buf[512];
+      size_t n;
+      size_t total = 0;
+      while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        hash = fnv1a(hash, buf, n);
+        total += n;
+      }
+      ok = total == asset->size;
+    }
+    fclose(f);
+    if (!ok) {
+      ESP_LOGE(TAG_ASSETS, "Failed to read %s", path);
+      free(data);
+      return false;
+    }
+    asset->data = data;
+    cached_bytes_ += data ? asset->size : 0;
+    snprintf(asset->etag, sizeof(asset->etag), "\"%08lx\"", (unsigned long)hash);
+    ESP_LOGD(TAG_ASSETS, "%s: %lu bytes, %s, ETag %s%s", name, (unsigned long)asset->size, asset->type, asset->etag,
+             asset->data ? ", cached" : "");
+    return true;
+  }
+
+  static uint32_t fnv1a(uint32_t hash, const uint8_t *p, size_t len) {
+    while (len--) {
+      hash = (hash ^ *p++) * 16777619u;
+    }
+    return hash;
+  }
+};
+
+AssetCache asset_cache;
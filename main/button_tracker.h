@@ -0,0 +1,206 @@
+#pragma once
+#include <Arduino.h>
+#include <cJSON.h>
+
+#define TAG_BUTTONS "BUTTONS"
+
+/* A press ends when no frame of it came for this long. */
+#define BUTTON_RELEASE_MS 300
+/* A press held this long is reported as held... */
+#define BUTTON_HOLD_MS 800
+/* ...and again every this long while it stays held. */
+#define BUTTON_REPEAT_MS 400
+
+/* Remotes pressed at the same time that are tracked; a further one ends the oldest press. */
+#define BUTTON_TRACKER_SLOTS 4
+
+enum button_event_type_t : uint8_t {
+  BUTTON_PRESS = 0,
+  BUTTON_HOLD,
+  BUTTON_RELEASE,
+};
+
+struct button_timing_t {
+  uint32_t release_ms;
+  uint32_t hold_ms;
+  uint32_t repeat_ms;
+};
+
+/**
+ * @brief A button press, hold or release.
+ *
+ * `held_ms` is how long the buttons have been down: 0 for a press, at least
+ * the hold time for a hold, the whole press for a release. `holds` counts the
+ * hold events of the press so far.
+ */
+struct button_event_t {
+  button_event_type_t type;
+  uint32_t source;
+  uint8_t buttons;
+  uint32_t time;
+  uint32_t held_ms;
+  uint16_t holds;
+};
+
+/**
+ * @brief Turns the frames a remote sends while its buttons are down into press,
+ *        hold and release events.
+ *
+ * Remotes keep transmitting for as long as a button is held, so a press is a
+ * run of frames with the same buttons from the same remote, none more than
+ * the release time after the previous one. It is reported once as a press,
+ * then as held after the hold time and every repeat time after that, and as
+ * released once its frames stop. Everything is derived from frame times, so
+ * the events do not depend on when frames are processed; deadlines are
+ * handled by poll(), which the owner calls by msUntilDeadline() at the latest.
+ *
+ * Not thread safe: frame() and poll() must be called from the same task.
+ */
+class ButtonTracker
+{
+public:
+  ButtonTracker() : timing_({ BUTTON_RELEASE_MS, BUTTON_HOLD_MS, BUTTON_REPEAT_MS }), slots_() {}
+
+  void setSink(std::function<void(const button_event_t &)> sink) {
+    sink_ = sink;
+  }
+
+  void setTiming(const button_timing_t &timing) {
+    timing_ = timing;
+    timing_.repeat_ms = MAX(timing_.repeat_ms, 1);
+  }
+
+  const button_timing_t &timing() const { return timing_; }
+
+  /**
+   * @brief A frame from `source` with `buttons` down arrived at `time_ms`.
+   *
+   * @param repeat The frame retransmits one already seen, so it can keep its
+   * press going but not start one: a replayed frame is not a new press.
+   */
+  void frame(uint32_t source, uint8_t buttons, uint32_t time_ms, bool repeat = false) {
+    poll(time_ms);
+    slot_t *free_slot = nullptr;
+    slot_t *oldest = nullptr;
+    for (auto &slot : slots_) {
+      if (!slot.used) {
+        free_slot = free_slot ? free_slot : &slot;
+        continue;
+      }
+      if (slot.source != source) {
+        if (!oldest || (int32_t)(slot.last - oldest->last) < 0) {
+          oldest = &slot;
+        }
+        continue;
+      }
+      if (slot.buttons == buttons) {
+        slot.last = time_ms;
+        return;
+      }
+      if (repeat) {
+        return;
+      }
+      release(slot, time_ms);  // other buttons of the same remote: a new press
+      free_slot = &slot;
+      break;
+    }
+    if (repeat) {
+      return;
+    }
+    if (!free_slot) {
+      release(*oldest, time_ms);
+      free_slot = oldest;
+    }
+    *free_slot = { true, source, buttons, time_ms, time_ms, time_ms + timing_.hold_ms, 0 };
+    emit(BUTTON_PRESS, *free_slot, time_ms);
+  }
+
+  /**
+   * @brief Emit the holds and releases due at `now_ms`.
+   */
+  void poll(uint32_t now_ms) {
+    for (auto &slot : slots_) {
+      if (!slot.used) {
+        continue;
+      }
+      uint32_t released = slot.last + timing_.release_ms;
+      // Holds due before the press ended, then the release.
+      while ((int32_t)(slot.next_hold - now_ms) <= 0 && (int32_t)(slot.next_hold - released) < 0) {
+        slot.holds++;
+        emit(BUTTON_HOLD, slot, slot.next_hold);
+        slot.next_hold += timing_.repeat_ms;
+      }
+      if ((int32_t)(released - now_ms) <= 0) {
+        release(slot, released);
+      }
+    }
+  }
+
+  /**
+   * @brief Time until the next hold or release is due, UINT32_MAX if no press is open.
+   */
+  uint32_t msUntilDeadline(uint32_t now_ms) const {
+    uint32_t next = UINT32_MAX;
+    for (auto &slot : slots_) {
+      if (slot.used) {
+        int32_t release_in = (int32_t)(slot.last + timing_.release_ms - now_ms);
+        int32_t hold_in = (int32_t)(slot.next_hold - now_ms);
+        int32_t due = MIN(release_in, hold_in);
+        next = MIN(next, due <= 0 ? 0 : (uint32_t)due);
+      }
+    }
+    return next;
+  }
+
+  static void serializeTiming(cJSON *json, const button_timing_t &timing) {
+    cJSON_AddNumberToObject(json, "release_ms", timing.release_ms);
+    cJSON_AddNumberToObject(json, "hold_ms", timing.hold_ms);
+    cJSON_AddNumberToObject(json, "repeat_ms", timing.repeat_ms);
+  }
+
+  /**
+   * @brief Read a timing object as written by serializeTiming(); missing members keep their value.
+   */
+  static button_timing_t parseTiming(const cJSON *json, button_timing_t timing) {
+    const cJSON *item;
+    if (cJSON_IsNumber(item = cJSON_GetObjectItem(json, "release_ms"))) {
+      timing.release_ms = cJSON_GetNumberValue(item);
+    }
+    if (cJSON_IsNumber(item = cJSON_GetObjectItem(json, "hold_ms"))) {
+      timing.hold_ms = cJSON_GetNumberValue(item);
+    }
+    if (cJSON_IsNumber(item = cJSON_GetObjectItem(json, "repeat_ms"))) {
+      timing.repeat_ms = cJSON_GetNumberValue(item);
+    }
+    return timing;
+  }
+
+private:
+  struct slot_t {
+    bool used;
+    uint32_t source;
+    uint8_t buttons;
+    uint32_t first;
+    uint32_t last;
+    uint32_t next_hold;
+    uint16_t holds;
+  };
+
+  button_timing_t timing_;
+  slot_t slots_[BUTTON_TRACKER_SLOTS];
+  std::function<void(const button_event_t &)> sink_;
+
+  void release(slot_t &slot, uint32_t time_ms) {
+    emit(BUTTON_RELEASE, slot, time_ms);
+    slot.used = false;
+  }
+
+  void emit(button_event_type_t type, const slot_t &slot, uint32_t time_ms) {
+    ESP_LOGD(TAG_BUTTONS, "%07lx: buttons %d %s after %lu ms", (unsigned long)slot.source, slot.buttons,
+             type == BUTTON_PRESS ? "pressed" : type == BUTTON_HOLD ? "held" : "released",
+             (unsigned long)(time_ms - slot.first));
+    if (sink_) {
+      sink_({ type, slot.source, slot.buttons, time_ms, time_ms - slot.first, slot.holds });
+    }
+  }
+};
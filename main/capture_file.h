@@ -0,0 +1,132 @@
+#pragma once
+#include "rmt_message.h"
+#include "ws_frame.h"
+#include <Arduino.h>
+#include <stdio.h>
+
+/*
+ * Capture recording file format, version 1.
+ *
+ * A 16-byte header followed by records, back to back until the end of the
+ * file. Records are self-contained, so recording is a plain append and a file
+ * cut short by a power loss is still readable up to its last whole record.
+ * All multi-byte fields are little-endian.
+ *
+ * Header:
+ *
+ *   offset  size  field
+ *   0       4     magic        "PVCF"
+ *   4       1     version      (CAPTURE_FILE_VERSION)
+ *   5       1     header size  (CAPTURE_FILE_HEADER_SIZE)
+ *   6       2     flags        0
+ *   8       4     tick         symbol duration unit, ns (1000: RMT at 1 MHz)
+ *   12      4     reserved     0
+ *
+ * Record:
+ *
+ *   0       2     size         size of the frame that follows
+ *   2       size  frame        ws_frame capture frame: time, delta, RSSI, symbols
+ */
+
+#define CAPTURE_FILE_MAGIC "PVCF"
+#define CAPTURE_FILE_VERSION 1
+#define CAPTURE_FILE_HEADER_SIZE 16
+#define CAPTURE_FILE_TICK_NS 1000
+
+/**
+ * @brief Appends captures to a recording.
+ */
+class CaptureFileWriter
+{
+public:
+  /**
+   * @brief Start writing to `file`, opened for appending. The header is written
+   *        if the file is empty.
+   *
+   * @return false if the header could not be written.
+   */
+  bool begin(FILE *file) {
+    file_ = file;
+    fseek(file_, 0, SEEK_END);
+    if (ftell(file_) > 0) {
+      return true;
+    }
+    uint8_t header[CAPTURE_FILE_HEADER_SIZE] = {};
+    memcpy(header, CAPTURE_FILE_MAGIC, 4);
+    header[4] = CAPTURE_FILE_VERSION;
+    header[5] = CAPTURE_FILE_HEADER_SIZE;
+    ws_frame::putU32(header + 8, CAPTURE_FILE_TICK_NS);
+    return fwrite(header, 1, sizeof(header), file_) == sizeof(header);
+  }
+
+  /**
+   * @brief Append one capture.
+   *
+   * @return Bytes written, 0 on error.
+   */
+  size_t write(const rmt_message_t *msg) {
+    uint8_t record[2 + WS_FRAME_MAX_SIZE];
+    size_t len = ws_frame::encodeCapture(msg, record + 2, WS_FRAME_MAX_SIZE);
+    ws_frame::putU16(record, len);
+    return fwrite(record, 1, len + 2, file_) == len + 2 ? len + 2 : 0;
+  }
+
+private:
+  FILE *file_ = nullptr;
+};
+
+/**
+ * @brief Reads captures back from a recording.
+ */
+class CaptureFileReader
+{
+public:
+  /**
+   * @brief Check the header of `file`, opened for reading at its start.
+   *
+   * @return false if it is not a version 1 capture file.
+   */
+  bool begin(FILE *file) {
+    file_ = file;
+    uint8_t header[CAPTURE_FILE_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), file_) != sizeof(header) || memcmp(header, CAPTURE_FILE_MAGIC, 4) != 0 ||
+        header[4] != CAPTURE_FILE_VERSION || header[5] < CAPTURE_FILE_HEADER_SIZE) {
+      return false;
+    }
+    tick_ns_ = ws_frame::getU32(header + 8);
+    return fseek(file_, header[5], SEEK_SET) == 0;
+  }
+
+  /**
+   * @brief Read the next capture.
+   *
+   * @return false at the end of the file, or at the first truncated or invalid record.
+   */
+  bool next(rmt_message_t *msg) {
+    uint8_t size[2];
+    uint8_t frame[WS_FRAME_MAX_SIZE];
+    if (fread(size, 1, 2, file_) != 2) {
+      return false;
+    }
+    size_t len = ws_frame::getU16(size);
+    if (len > sizeof(frame) || fread(frame, 1, len, file_) != len) {
+      truncated_ = true;
+      return false;
+    }
+    if (!ws_frame::decodeCapture(frame, len, msg)) {
+      truncated_ = true;
+      return false;
+    }
+    return true;
+  }
+
+  /** true if reading stopped at a damaged record rather than at the end of the file. */
+  bool truncated() const { return truncated_; }
+
+  uint32_t tickNs() const { return tick_ns_; }
+
+private:
+  FILE *file_ = nullptr;
+  uint32_t tick_ns_ = CAPTURE_FILE_TICK_NS;
+  bool truncated_ = false;
+};
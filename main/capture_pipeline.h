@@ -0,0 +1,217 @@
+#pragma once
+#include "rmt_message.h"
+#include "capture_pool.h"
+#include "decoders.h"
+#include "pulse_analyzer.h"
+#include "line_decoders.h"
+#include "decoded_event.h"
+#include "repeat_folder.h"
+#include "ws_frame.h"
+#include "ws_filter.h"
+#include <Arduino.h>
+#include <cJSON.h>
+
+#define TAG_PIPELINE "PIPELINE"
+
+/*
+ * Everything between a finished RMT receive and the WebSocket: hand-over queue,
+ * pulse analysis, decoders, repeat folding and frame serialization. Nothing in
+ * here touches the radio, the RMT driver or the network, so the same code runs
+ * in the host build (host/) with captures from a synthetic or recorded source.
+ */
+
+typedef void (*capture_broadcast_t)(uint8_t *data, size_t len, uint32_t subscribers);
+typedef uint32_t (*capture_subscribers_t)(const ws_frame_info_t &frame);
+typedef void (*capture_tap_t)(const rmt_message_t *msg);
+
+QueueHandle_t rmt_parse_queue;
+
+static capture_broadcast_t capture_broadcast = nullptr;
+static capture_subscribers_t capture_subscribers = nullptr;
+static capture_tap_t capture_tap = nullptr;
+static pulse_analysis_t pulse_analysis;
+static uint32_t pulse_analysis_frames = 0;
+static int64_t pulse_analysis_time_us = 0;
+static int64_t capture_last_time_us = 0;
+
+/**
+ * @brief Who wants a frame, asked before it is serialized.
+ *
+ * @return Subscriber mask for capture_broadcast; 0 if no one does, and the frame is skipped.
+ */
+static uint32_t capture_subscribed(uint8_t type, uint8_t protocol, int rssi, uint16_t symbols)
+{
+  return capture_subscribers ? capture_subscribers({ type, protocol, rssi, symbols }) : WS_SUBSCRIBERS_ALL;
+}
+
+/**
+ * @brief DecodedEvents sink: broadcast each event as a ws_frame event frame.
+ *
+ * Used when folding is disabled (REPEAT_FOLD_WINDOW_MS 0).
+ */
+static void capture_publish_event(const decoded_event_t &event)
+{
+  uint32_t subscribers = capture_subscribed(WS_FRAME_EVENT, event.protocol, event.rssi, 0);
+  if (subscribers == 0) {
+    return;
+  }
+  uint8_t frame[WS_FRAME_EVENT_MAX_SIZE];
+  size_t len = ws_frame::encodeEvent(&event, frame, sizeof(frame));
+  if (len) {
+    capture_broadcast(frame, len, subscribers);
+  }
+}
+
+/**
+ * @brief repeat_folder sink: broadcast each burst as a ws_frame repeat frame.
+ */
+static void capture_publish_repeat(const folded_event_t &folded)
+{
+  uint32_t subscribers = capture_subscribed(WS_FRAME_REPEAT, folded.event.protocol, folded.rssi_max, 0);
+  if (subscribers == 0) {
+    return;
+  }
+  uint8_t frame[WS_FRAME_REPEAT_MAX_SIZE];
+  size_t len = ws_frame::encodeRepeat(&folded, frame, sizeof(frame));
+  if (len) {
+    capture_broadcast(frame, len, subscribers);
+  }
+}
+
+/**
+ * @brief Set up the pool, the parse queue and the event sinks.
+ *
+ * @param broadcast Called with every serialized frame and the mask `subscribers`
+ *        returned for it (ws_broadcast_to on the device).
+ * @param subscribers Asked who wants each frame before it is serialized; frames
+ *        it returns 0 for are dropped. nullptr: every frame goes to WS_SUBSCRIBERS_ALL.
+ * @return true on success.
+ */
+static bool capture_pipeline_init(capture_broadcast_t broadcast, capture_subscribers_t subscribers = nullptr)
+{
+  capture_broadcast = broadcast;
+  capture_subscribers = subscribers;
+  if (repeat_folder.window() > 0) {
+    repeat_folder.setSink(capture_publish_repeat);
+    DecodedEvents::setSink([](const decoded_event_t &event) { repeat_folder.submit(event); });
+  } else {
+    DecodedEvents::setSink(capture_publish_event);
+  }
+  if (!capture_pool.init()) {
+    ESP_LOGE(TAG_PIPELINE, "Failed to create capture pool");
+    return false;
+  }
+  // Holds slot pointers only; sized to the pool so it can never overflow.
+  rmt_parse_queue = xQueueCreate(CAPTURE_POOL_SIZE, sizeof(rmt_message_t *));
+  if (rmt_parse_queue == NULL) {
+    ESP_LOGE(TAG_PIPELINE, "Failed to create RMT queue");
+    return false;
+  }
+  capture_last_time_us = esp_timer_get_time();
+  return true;
+}
+
+/**
+ * @brief Hand a filled capture_pool slot to rmt_parse_task.
+ *
+ * Fills in the capture metadata: length, RSSI, time and the time since the
+ * previous capture. Both times derive from `time_us`, so a replayed recording
+ * gets exactly its recorded timing.
+ *
+ * @param message The slot the symbols were received into.
+ * @param num_symbols Number of symbols received.
+ * @param time_us esp_timer time at the end of the receive.
+ * @param rssi RSSI of the capture, dBm.
+ */
+static void capture_submit(rmt_message_t *message, size_t num_symbols, int64_t time_us, int rssi)
+{
+  message->rssi = rssi;
+  message->length = num_symbols;
+  message->time = time_us / 1000;
+  message->delta = time_us - capture_last_time_us;
+  capture_last_time_us = time_us;
+  ESP_LOGD(TAG_PIPELINE, "Got %d symbols, RSSI: %d, delta: %lld", message->length, message->rssi, message->delta);
+
+  xQueueSend(rmt_parse_queue, &message, 0);
+}
+
+/**
+ * @brief Decode one capture, broadcast it and release its slot.
+ *
+ * The capture first goes through PulseAnalyzer, which clusters its timings
+ * independently of any protocol, then through each decoder family (PWM,
+ * Manchester, pulse-distance) once. It is broadcast as a compact ws_frame
+ * capture frame holding only the valid symbols, unless it only repeated
+ * bursts repeat_folder already has open. Bursts are closed by capture time
+ * first, so the output only depends on the captures, not on when they are
+ * processed. Nor is it serialized when no subscriber wants it. If a tap is
+ * installed (the recorder), it sees every capture first.
+ *
+ * @param msg A slot from capture_pool.
+ * @param frame Scratch buffer of WS_FRAME_MAX_SIZE bytes for the capture frame.
+ */
+static void capture_process(rmt_message_t *msg, uint8_t *frame)
+{
+  if (capture_tap) {
+    capture_tap(msg);
+  }
+  repeat_folder.flush(msg->time);
+  repeat_folder.beginFrame();
+  int64_t start = esp_timer_get_time();
+  PulseAnalyzer::analyze(msg, &pulse_analysis);
+  pulse_analysis_time_us += esp_timer_get_time() - start;
+  pulse_analysis_frames++;
+  ESP_LOGV(TAG_PIPELINE, "Pulses: short %d, long %d, sync %d, bit period %d us",
+           pulse_analysis.short_us, pulse_analysis.long_us, pulse_analysis.sync_us, pulse_analysis.bit_period);
+
+  PWMDecoder::decode(msg);
+  ManchesterDecoder::decode(msg, &pulse_analysis);
+  PulseDistanceDecoder::decode(msg, &pulse_analysis);
+  if (msg->length >= 2 && !repeat_folder.frameRepeated()) {
+    uint32_t subscribers = capture_subscribed(WS_FRAME_CAPTURE, PROTOCOL_UNKNOWN, msg->rssi, msg->length);
+    if (subscribers) {
+      size_t len = ws_frame::encodeCapture(msg, frame, WS_FRAME_MAX_SIZE);
+      capture_broadcast(frame, len, subscribers);
+    }
+  }
+  capture_pool.release(msg);
+}
+
+/**
+ * @brief Decodes captures handed over by capture_submit().
+ *
+ * The queue carries pointers into capture_pool, so the capture is never copied.
+ * The queue wait is bounded by repeat_folder's next deadline so a burst is
+ * reported as soon as its window closes, even when no other capture follows.
+ */
+static void rmt_parse_task(void *pvParameters) {
+  rmt_message_t *msg;
+  uint8_t frame[WS_FRAME_MAX_SIZE];
+  while (1)
+  {
+    uint32_t flush_ms = repeat_folder.msUntilFlush(millis());
+    TickType_t wait = flush_ms == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(flush_ms) + 1;
+    if (xQueueReceive(rmt_parse_queue, &msg, wait) == pdTRUE) {
+      capture_process(msg, frame);
+    } else {
+      repeat_folder.flush(millis());
+    }
+  }
+  vTaskDelete(NULL);
+}
+
+/**
+ * @brief Add the pool, analyzer, folder and decoder counters to a stats object.
+ */
+static void capture_pipeline_serialize_stats(cJSON *json)
+{
+  capture_pool.serializeStats(cJSON_AddObjectToObject(json, "capture_pool"));
+  cJSON *analyzer = cJSON_AddObjectToObject(json, "pulse_analyzer");
+  cJSON_AddNumberToObject(analyzer, "frames", pulse_analysis_frames);
+  cJSON_AddNumberToObject(analyzer, "time_us", pulse_analysis_time_us);
+  repeat_folder.serializeStats(cJSON_AddObjectToObject(json, "repeat_folder"));
+  cJSON *decoders = cJSON_AddArrayToObject(json, "decoders");
+  pwm_decoders.serializeStats(decoders);
+  manchester_decoders.serializeStats(decoders);
+  pulse_distance_decoders.serializeStats(decoders);
+}
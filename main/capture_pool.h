@@ -0,0 +1,148 @@
+#pragma once
+#include "rmt_message.h"
+#include <Arduino.h>
+#include <cJSON.h>
+
+#define TAG_POOL "CAPTURE_POOL"
+
+#ifndef CAPTURE_POOL_SIZE
+#define CAPTURE_POOL_SIZE 16
+#endif
+
+/**
+ * @brief Preallocated pool of capture slots shared by the radio tasks.
+ *
+ * The receive side acquires a slot, fills it in place and hands only the
+ * pointer downstream. Whoever consumes the capture last (the parse task, after
+ * decoding and broadcasting) releases the slot back to the pool. Free slots are
+ * kept in a FreeRTOS queue of pointers, so acquire and release are O(1) and
+ * safe to call from an ISR.
+ */
+class CapturePool {
+public:
+  struct stats_t {
+    uint32_t size;
+    uint32_t in_use;
+    uint32_t high_water;
+    uint32_t acquired;
+    uint32_t exhausted;
+  };
+
+  /**
+   * @brief Create the free list and put every slot on it.
+   *
+   * @return true on success, false if the free list could not be created.
+   */
+  bool init() {
+    free_queue_ = xQueueCreateStatic(CAPTURE_POOL_SIZE, sizeof(rmt_message_t *), free_queue_storage_, &free_queue_buffer_);
+    if (free_queue_ == NULL) {
+      return false;
+    }
+    for (size_t i = 0; i < CAPTURE_POOL_SIZE; i++) {
+      rmt_message_t *slot = &slots_[i];
+      xQueueSend(free_queue_, &slot, 0);
+    }
+    return true;
+  }
+
+  /**
+   * @brief Take a free slot without blocking.
+   *
+   * @return Pointer to the slot, or nullptr if the pool is exhausted.
+   */
+  rmt_message_t *acquire() {
+    rmt_message_t *slot = nullptr;
+    if (xQueueReceive(free_queue_, &slot, 0) != pdTRUE) {
+      taskENTER_CRITICAL(&lock_);
+      exhausted_++;
+      taskEXIT_CRITICAL(&lock_);
+      return nullptr;
+    }
+    UBaseType_t in_use = CAPTURE_POOL_SIZE - uxQueueMessagesWaiting(free_queue_);
+    taskENTER_CRITICAL(&lock_);
+    acquired_++;
+    if (in_use > high_water_) high_water_ = in_use;
+    taskEXIT_CRITICAL(&lock_);
+    return slot;
+  }
+
+  /**
+   * @brief ISR variant of acquire().
+   *
+   * @param high_task_wakeup Set to pdTRUE if a higher priority task was woken.
+   * @return Pointer to the slot, or nullptr if the pool is exhausted.
+   */
+  rmt_message_t *acquireFromISR(BaseType_t *high_task_wakeup) {
+    rmt_message_t *slot = nullptr;
+    if (xQueueReceiveFromISR(free_queue_, &slot, high_task_wakeup) != pdTRUE) {
+      taskENTER_CRITICAL_ISR(&lock_);
+      exhausted_++;
+      taskEXIT_CRITICAL_ISR(&lock_);
+      return nullptr;
+    }
+    UBaseType_t in_use = CAPTURE_POOL_SIZE - uxQueueMessagesWaitingFromISR(free_queue_);
+    taskENTER_CRITICAL_ISR(&lock_);
+    acquired_++;
+    if (in_use > high_water_) high_water_ = in_use;
+    taskEXIT_CRITICAL_ISR(&lock_);
+    return slot;
+  }
+
+  /**
+   * @brief Return a slot to the pool. Passing nullptr is a no-op.
+   *
+   * @param slot A slot previously returned by acquire().
+   */
+  void release(rmt_message_t *slot) {
+    if (slot == nullptr) {
+      return;
+    }
+    xQueueSend(free_queue_, &slot, 0);
+  }
+
+  /**
+   * @brief ISR variant of release().
+   *
+   * @param slot A slot previously returned by acquire().
+   * @param high_task_wakeup Set to pdTRUE if a higher priority task was woken.
+   */
+  void releaseFromISR(rmt_message_t *slot, BaseType_t *high_task_wakeup) {
+    if (slot == nullptr) {
+      return;
+    }
+    xQueueSendFromISR(free_queue_, &slot, high_task_wakeup);
+  }
+
+  stats_t getStats() {
+    stats_t stats;
+    stats.size = CAPTURE_POOL_SIZE;
+    stats.in_use = CAPTURE_POOL_SIZE - uxQueueMessagesWaiting(free_queue_);
+    taskENTER_CRITICAL(&lock_);
+    stats.high_water = high_water_;
+    stats.acquired = acquired_;
+    stats.exhausted = exhausted_;
+    taskEXIT_CRITICAL(&lock_);
+    return stats;
+  }
+
+  void serializeStats(cJSON *json) {
+    stats_t stats = getStats();
+    cJSON_AddNumberToObject(json, "size", stats.size);
+    cJSON_AddNumberToObject(json, "in_use", stats.in_use);
+    cJSON_AddNumberToObject(json, "high_water", stats.high_water);
+    cJSON_AddNumberToObject(json, "acquired", stats.acquired);
+    cJSON_AddNumberToObject(json, "exhausted", stats.exhausted);
+  }
+
+private:
+  rmt_message_t slots_[CAPTURE_POOL_SIZE];
+  QueueHandle_t free_queue_ = NULL;
+  StaticQueue_t free_queue_buffer_;
+  uint8_t free_queue_storage_[CAPTURE_POOL_SIZE * sizeof(rmt_message_t *)];
+  portMUX_TYPE lock_ = portMUX_INITIALIZER_UNLOCKED;
+  uint32_t high_water_ = 0;
+  uint32_t acquired_ = 0;
+  uint32_t exhausted_ = 0;
+};
+
+CapturePool capture_pool;
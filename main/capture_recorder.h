@@ -0,0 +1,123 @@
+#pragma once
+#include "rmt_message.h"
+#include "capture_file.h"
+#include "freertos/semphr.h"
+#include <Arduino.h>
+#include <cJSON.h>
+
+#define TAG_RECORDER "RECORDER"
+
+#define CAPTURE_RECORD_PATH "/spiffs/capture.pvc"
+#define CAPTURE_RECORD_MAX_BYTES (128 * 1024)
+
+/**
+ * @brief Records the captures rmt_parse_task sees to a capture file on SPIFFS.
+ *
+ * Installed as the pipeline's capture tap, so the file holds exactly what the
+ * decoders got, in order, and replays through the host build unchanged.
+ * Recording stops on its own once `max_bytes` is reached. start() and stop()
+ * are called from the HTTP server while record() runs in rmt_parse_task, so
+ * the file is guarded by a mutex; while not recording, record() is one load.
+ */
+class CaptureRecorder
+{
+public:
+  bool init() {
+    mutex_ = xSemaphoreCreateMutexStatic(&mutex_buffer_);
+    return mutex_ != NULL;
+  }
+
+  /**
+   * @brief Start recording to CAPTURE_RECORD_PATH.
+   *
+   * @param max_bytes Stop once the file grows by this much.
+   * @param append Keep the captures already in the file.
+   * @return false if the file could not be opened.
+   */
+  bool start(size_t max_bytes, bool append) {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    close();
+    file_ = fopen(CAPTURE_RECORD_PATH, append ? "a" : "w");
+    bool ok = file_ != NULL;
+    if (ok) {
+      setvbuf(file_, buffer_, _IOFBF, sizeof(buffer_));
+      ok = writer_.begin(file_);
+    }
+    if (ok) {
+      frames_ = 0;
+      bytes_ = 0;
+      max_bytes_ = max_bytes;
+      recording_ = true;
+      ESP_LOGI(TAG_RECORDER, "Recording to %s, up to %u bytes", CAPTURE_RECORD_PATH, (unsigned)max_bytes);
+    } else {
+      ESP_LOGE(TAG_RECORDER, "Failed to open %s", CAPTURE_RECORD_PATH);
+      close();
+    }
+    xSemaphoreGive(mutex_);
+    return ok;
+  }
+
+  void stop() {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    close();
+    xSemaphoreGive(mutex_);
+  }
+
+  bool isRecording() const { return recording_; }
+
+  /**
+   * @brief Append a capture if recording.
+   */
+  void record(const rmt_message_t *msg) {
+    if (!recording_) {
+      return;
+    }
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    if (recording_) {
+      size_t written = writer_.write(msg);
+      if (written == 0) {
+        ESP_LOGE(TAG_RECORDER, "Write failed, recording stopped");
+        close();
+      } else {
+        frames_++;
+        bytes_ += written;
+        if (bytes_ >= max_bytes_) {
+          ESP_LOGI(TAG_RECORDER, "Size limit reached, recording stopped");
+          close();
+        }
+      }
+    }
+    xSemaphoreGive(mutex_);
+  }
+
+  void serializeStatus(cJSON *json) {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    cJSON_AddBoolToObject(json, "recording", recording_);
+    cJSON_AddStringToObject(json, "path", CAPTURE_RECORD_PATH);
+    cJSON_AddNumberToObject(json, "frames", frames_);
+    cJSON_AddNumberToObject(json, "bytes", bytes_);
+    cJSON_AddNumberToObject(json, "max_bytes", max_bytes_);
+    xSemaphoreGive(mutex_);
+  }
+
+private:
+  SemaphoreHandle_t mutex_ = NULL;
+  StaticSemaphore_t mutex_buffer_;
+  FILE *file_ = NULL;
+  CaptureFileWriter writer_;
+  char buffer_[1024];
+  volatile bool recording_ = false;
+  uint32_t frames_ = 0;
+  size_t bytes_ = 0;
+  size_t max_bytes_ = CAPTURE_RECORD_MAX_BYTES;
+
+  void close() {
+    recording_ = false;
+    if (file_ != NULL) {
+      fclose(file_);
+      file_ = NULL;
+    }
+  }
+};
+
+CaptureRecorder capture_recorder;
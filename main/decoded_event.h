@@ -0,0 +1,109 @@
+#pragma once
+#include "rmt_message.h"
+#include <Arduino.h>
+
+#define DECODED_EVENT_MAX_PAYLOAD 16
+#define DECODED_EVENT_MAX_FIELDS 6
+
+typedef enum : uint8_t {
+  PROTOCOL_UNKNOWN = 0,
+  PROTOCOL_HCS301 = 1,
+  PROTOCOL_EV1527 = 2,
+  PROTOCOL_PT2262 = 3,
+  PROTOCOL_HS2303 = 4,
+} protocol_id_t;
+
+typedef enum : uint8_t {
+  FIELD_SERIAL = 1,
+  FIELD_ENCRYPTED = 2,
+  FIELD_BUTTONS = 3,
+  FIELD_VLOW = 4,
+  FIELD_ADDRESS = 5,
+  FIELD_DATA = 6,
+  FIELD_COUNTER = 7,
+} field_id_t;
+
+struct decoded_field_t {
+  uint8_t id;
+  uint32_t value;
+};
+
+/**
+ * @brief A frame a decoder recognized, in protocol terms.
+ *
+ * `payload` holds the decoded bits MSB first; `fields` the values parsed out of
+ * them. Time, delta and RSSI come from the capture.
+ */
+struct decoded_event_t {
+  uint8_t protocol;
+  uint8_t nbits;
+  uint8_t payload[DECODED_EVENT_MAX_PAYLOAD];
+  uint8_t n_fields;
+  decoded_field_t fields[DECODED_EVENT_MAX_FIELDS];
+  uint32_t time;
+  int64_t delta;
+  int rssi;
+
+  decoded_event_t() = default;
+
+  /**
+   * @brief Start an event for a capture: protocol and capture metadata, no payload or fields.
+   */
+  decoded_event_t(uint8_t protocol, const rmt_message_t *msg)
+    : protocol(protocol), nbits(0), payload(), n_fields(0), fields(), time(msg->time), delta(msg->delta), rssi(msg->rssi) {}
+
+  /**
+   * @brief Copy `count` bits starting at bit `first` of an MSB-first bit buffer into
+   *        the payload. Bits beyond the payload size are dropped.
+   */
+  void setPayload(const uint8_t *bits, uint16_t first, uint16_t count) {
+    nbits = MIN(count, DECODED_EVENT_MAX_PAYLOAD * 8);
+    memset(payload, 0, sizeof(payload));
+    for (uint16_t i = 0; i < nbits; i++) {
+      uint16_t src = first + i;
+      payload[i / 8] |= ((bits[src / 8] >> (7 - src % 8)) & 1) << (7 - i % 8);
+    }
+  }
+
+  /**
+   * @brief Set the payload from the low `count` bits of a value.
+   */
+  void setPayload(uint64_t value, uint8_t count) {
+    uint8_t bytes = (count + 7) / 8;
+    value <<= bytes * 8 - count;
+    for (uint8_t i = 0; i < bytes; i++) {
+      payload[i] = value >> (8 * (bytes - 1 - i));
+    }
+    nbits = count;
+  }
+
+  void addField(uint8_t id, uint32_t value) {
+    if (n_fields < DECODED_EVENT_MAX_FIELDS) {
+      fields[n_fields++] = { id, value };
+    }
+  }
+};
+
+/**
+ * @brief Where decoders publish their decoded events.
+ *
+ * The radio pipeline installs the sink; decoders only call publish().
+ */
+class DecodedEvents
+{
+public:
+  static void setSink(std::function<void(const decoded_event_t &)> sink) {
+    sink_ = sink;
+  }
+
+  static void publish(const decoded_event_t &event) {
+    if (sink_) {
+      sink_(event);
+    }
+  }
+
+private:
+  static std::function<void(const decoded_event_t &)> sink_;
+};
+
+std::function<void(const decoded_event_t &)> DecodedEvents::sink_;
@@ -1,76 +1,309 @@
 #pragma once
-#include "main.h"
+#include "rmt_message.h"
 #include <Arduino.h>
+#include <cJSON.h>
 
+#define DECODER_MAX_SYMBOLS (RMT_MEM_NUM_BLOCKS_4 * RMT_SYMBOLS_PER_CHANNEL_BLOCK)
+#define DECODER_INDEX_MAX 32
+
+/**
+ * @brief What a frame has to look like for a decoder to be worth calling.
+ *
+ * Symbol counts are inclusive. `short_*` bounds the shortest high pulse of the
+ * frame, `long_*` the longest one, both in RMT ticks (us). The first
+ * `preamble_bits` decoded bits, MSB first, must equal the low bits of `preamble`.
+ */
+struct decoder_signature_t {
+  uint16_t min_symbols;
+  uint16_t max_symbols;
+  uint16_t short_min;
+  uint16_t short_max;
+  uint16_t long_min;
+  uint16_t long_max;
+  uint8_t preamble_bits;
+  uint32_t preamble;
+};
+
+#define DECODER_SIGNATURE_ANY { 0, DECODER_MAX_SYMBOLS, 0, UINT16_MAX, 0, UINT16_MAX, 0, 0 }
+
+/**
+ * @brief Per-frame values the signatures are matched against.
+ */
+struct frame_features_t {
+  uint16_t length;
+  uint16_t min_pulse;
+  uint16_t max_pulse;
+};
+
+struct decoder_stats_t {
+  uint32_t hits;
+  uint32_t misses;
+  int64_t time_us;
+};
+
+/**
+ * @brief Line-decoded bits of a frame, MSB first: bit 0 is bit 7 of buf[0].
+ */
+struct bit_message_t {
+  uint8_t buf[DECODER_MAX_SYMBOLS / 8];
+  uint16_t nbits;
+};
+
+/**
+ * @brief Packs bits MSB first into a byte buffer, a 32-bit word at a time.
+ *
+ * The buffer size must be a multiple of 4 bytes.
+ */
+struct BitWriter {
+  uint8_t *out;
+  uint8_t *const start;
+  const uint16_t capacity;
+  uint32_t word;
+  uint16_t nbits;
+
+  BitWriter(uint8_t *buf, size_t size) : out(buf), start(buf), capacity(size * 8), word(0), nbits(0) {}
+
+  /**
+   * @brief Append one bit (0 or 1). Bits past the end of the buffer are dropped.
+   */
+  inline void push(uint32_t bit) {
+    if (nbits >= capacity) {
+      return;
+    }
+    word = (word << 1) | bit;
+    if ((++nbits & 31) == 0) {
+      out[0] = word >> 24;
+      out[1] = word >> 16;
+      out[2] = word >> 8;
+      out[3] = word;
+      out += 4;
+    }
+  }
+
+  /**
+   * @brief Flush the partial word. Unused bits of the last byte are zero.
+   *
+   * @return Number of bytes used.
+   */
+  inline size_t finish() {
+    int rest = nbits & 31;
+    if (rest) {
+      uint32_t w = word << (32 - rest);
+      for (int shift = 24; rest > 0; rest -= 8, shift -= 8) {
+        *out++ = w >> shift;
+      }
+    }
+    return out - start;
+  }
+};
+
+/**
+ * @brief Name, signature and counters shared by every decoder family.
+ */
+class DecoderBase
+{
+public:
+  DecoderBase(const char *name, const decoder_signature_t &signature) : name(name), signature(signature), stats() {}
+
+  const char *name;
+  const decoder_signature_t signature;
+  decoder_stats_t stats;
+
+  void serializeStats(cJSON *json) const {
+    cJSON_AddStringToObject(json, "name", name);
+    cJSON_AddNumberToObject(json, "hits", stats.hits);
+    cJSON_AddNumberToObject(json, "misses", stats.misses);
+    cJSON_AddNumberToObject(json, "time_us", stats.time_us);
+  }
+};
+
+/**
+ * @brief Index of the decoders of one family, keyed by frame signature.
+ *
+ * For every possible symbol count the index keeps a bitmask of the decoders
+ * whose signature accepts that count, so the first cut is a single table load.
+ * The remaining candidates are then filtered by pulse widths and preamble.
+ *
+ * @tparam Decoder A DecoderBase subclass.
+ */
+template <typename Decoder>
+class DecoderIndex
+{
+public:
+  std::vector<Decoder *> decoders;
+
+  void add(Decoder *decoder) {
+    size_t idx = decoders.size();
+    assert(idx < DECODER_INDEX_MAX);
+    decoders.push_back(decoder);
+    const decoder_signature_t &sig = decoder->signature;
+    uint16_t max_symbols = MIN(sig.max_symbols, DECODER_MAX_SYMBOLS);
+    for (uint16_t len = sig.min_symbols; len <= max_symbols; len++) {
+      by_length_[len] |= 1UL << idx;
+    }
+  }
+
+  /**
+   * @brief Candidates for a frame of the given length.
+   */
+  uint32_t byLength(uint16_t length) const {
+    return by_length_[MIN(length, DECODER_MAX_SYMBOLS)];
+  }
+
+  /**
+   * @brief Drop the candidates whose pulse ranges or preamble do not match.
+   *
+   * @param mask Candidates, as returned by byLength().
+   * @param features Features of the frame.
+   * @param bits Decoded bits of the frame, MSB first.
+   * @param nbits Number of valid bits in `bits`.
+   * @return The remaining candidates.
+   */
+  uint32_t filter(uint32_t mask, const frame_features_t &features, const uint8_t *bits, uint16_t nbits) const {
+    for (uint32_t m = mask; m; m &= m - 1) {
+      int idx = __builtin_ctz(m);
+      const decoder_signature_t &sig = decoders[idx]->signature;
+      if (features.min_pulse < sig.short_min || features.min_pulse > sig.short_max ||
+          features.max_pulse < sig.long_min || features.max_pulse > sig.long_max ||
+          !matchPreamble(sig, bits, nbits)) {
+        mask &= ~(1UL << idx);
+      }
+    }
+    return mask;
+  }
+
+  /**
+   * @brief Call `fn` on each candidate, counting hits, misses and time.
+   *
+   * @param mask Candidates, as returned by filter().
+   * @param fn Callable taking a `Decoder *` and returning true on a hit.
+   */
+  template <typename Fn>
+  void dispatch(uint32_t mask, Fn fn) {
+    for (uint32_t m = mask; m; m &= m - 1) {
+      Decoder *decoder = decoders[__builtin_ctz(m)];
+      int64_t start = esp_timer_get_time();
+      bool hit = fn(decoder);
+      decoder->stats.time_us += esp_timer_get_time() - start;
+      hit ? decoder->stats.hits++ : decoder->stats.misses++;
+    }
+  }
+
+  void serializeStats(cJSON *array) const {
+    for (auto decoder : decoders) {
+      cJSON *json = cJSON_CreateObject();
+      decoder->serializeStats(json);
+      cJSON_AddItemToArray(array, json);
+    }
+  }
+
+private:
+  uint32_t by_length_[DECODER_MAX_SYMBOLS + 1] = {};
+
+  static bool matchPreamble(const decoder_signature_t &sig, const uint8_t *bits, uint16_t nbits) {
+    if (sig.preamble_bits == 0) {
+      return true;
+    }
+    if (nbits < sig.preamble_bits) {
+      return false;
+    }
+    uint32_t head = 0;
+    for (uint8_t i = 0; i < sig.preamble_bits; i++) {
+      head = (head << 1) | ((bits[i / 8] >> (7 - i % 8)) & 1);
+    }
+    uint32_t mask = sig.preamble_bits >= 32 ? UINT32_MAX : (1UL << sig.preamble_bits) - 1;
+    return head == (sig.preamble & mask);
+  }
+};
 
 class PWMDecoder;
 
-std::vector<PWMDecoder *> pwm_decoders;
+DecoderIndex<PWMDecoder> pwm_decoders;
 bool isPWMDecoderInit = false;
 
-class PWMDecoder
+class PWMDecoder : public DecoderBase
 {
 public:
   /**
-   * @brief Constructor for PWMDecoder class. This constructor adds the newly created object to the pwm_decoders vector.
-   *        It also initializes the vector if it has not been initialized before.
+   * @brief Constructor for PWMDecoder class. This constructor adds the newly created object to the pwm_decoders index.
+   *        It also initializes the index if it has not been initialized before.
+   *
+   * @param name Name reported in the decoder statistics.
+   * @param signature Frames this decoder can possibly accept; decode_pwm is only called for those.
    */
-  PWMDecoder()
+  PWMDecoder(const char *name, const decoder_signature_t &signature = DECODER_SIGNATURE_ANY) : DecoderBase(name, signature)
   {
     if (!isPWMDecoderInit) {
-      pwm_decoders.clear();
+      pwm_decoders = DecoderIndex<PWMDecoder>();
       isPWMDecoderInit = true;
     }
-    pwm_decoders.push_back(this);
+    pwm_decoders.add(this);
   }
   /**
-   * @brief Decodes the given RMT message and calls decode_pwm on all registered PWM decoders.
-   * @param msg The RMT message to decode.
+   * @brief Classify one RMT symbol as a PWM bit.
    *
-   * This function implements the decoding of a RMT message (a message that was received using the RMT library) into a PWM message.
-   * The decoding is done as follows: It loops over the given RMT message and for each pair of durations (duration0 and duration1) it calculates
-   * the difference and the average. If the difference is less than 20% of the average, it is considered a 0, otherwise it is considered a 1. These
-   * values are then packed into uint8_t values, with the first bit of each value being the first bit of the first pair, the second bit of each value
-   * being the second bit of the first pair and so on. The length of the PWM message is the number of these uint8_t values.
-   * After the PWM message is decoded, it calls decode_pwm on all registered PWM decoders.
+   * A symbol is a 1 when (d1 - d2) / ((d1 + d2) / 2) < 0.2, i.e. the high and low
+   * durations are roughly equal. Multiplying both sides by 5 * avg keeps it in
+   * integers: no soft-float on the S2, and the result is identical to the former
+   * float implementation for every pair of 15-bit durations (avg == 0 included).
    */
-  static void decode(rmt_message_t* msg) {
-    pwm_message_t pwm_msg;
-    pwm_msg.length = 0;
+  static inline uint32_t classify(uint16_t d1, uint16_t d2)
+  {
+    int32_t diff = (int32_t)d1 - d2;
+    int32_t avg = (d1 + d2) >> 1;
+    return 5 * diff < avg;
+  }
+
+  /**
+   * @brief Decode a RMT message into a PWM message.
+   *
+   * Each symbol is classified by classify() and packed by BitWriter, four bytes at a time, most significant bit first:
+   * the first symbol is bit 7 of buf[0]. Unused bits of the last byte are zero. The length of the PWM message is the
+   * number of bytes used. The shortest and longest high pulses are collected on the way.
+   */
+  static void pack(const rmt_message_t *msg, pwm_message_t *pwm_msg, frame_features_t *features) {
+    *features = { msg->length, UINT16_MAX, 0 };
+    BitWriter bits(pwm_msg->buf, sizeof(pwm_msg->buf));
 
     for (int i = 0; i < msg->length; i++)
     {
       uint16_t d1 = msg->buf[i].duration0;
       uint16_t d2 = msg->buf[i].duration1;
-
-      float diff = d1 - d2;
-      float avg = (d1 + d2) / 2;
-      float ratio = diff / avg;
-
-      uint8_t b = ratio < 0.2 ? 1 : 0;
-
-      if (i % 8 == 0)
-      {
-        pwm_msg.buf[i / 8] = 0;
-      }
-
-      if (b)
-      {
-        pwm_msg.buf[i / 8] |= (1 << (7 - i % 8));
-      }
-
-      if (i % 8 == 7 || i == msg->length - 1)
-      {
-        pwm_msg.length++;
-      }
-    }
-    for (auto decoder : pwm_decoders)
-    {
-      decoder->decode_pwm(&pwm_msg, msg);
+      features->min_pulse = MIN(features->min_pulse, d1);
+      features->max_pulse = MAX(features->max_pulse, d1);
+      bits.push(classify(d1, d2));
     }
+    pwm_msg->length = bits.finish();
   }
-  virtual void decode_pwm(pwm_message_t *pwm_msg, rmt_message_t *rmt_msg) {}
-};
 
+  /**
+   * @brief Decodes the given RMT message and calls decode_pwm on the PWM decoders whose signature matches.
+   * @param msg The RMT message to decode.
+   *
+   * Frames whose length no decoder accepts are dropped before any work. The rest are packed by pack(), the
+   * candidates are narrowed by pulse widths and preamble, and decode_pwm is called on each remaining one. Its result
+   * and run time are added to the decoder's statistics.
+   */
+  static void decode(rmt_message_t* msg) {
+    uint32_t candidates = pwm_decoders.byLength(msg->length);
+    if (!candidates) {
+      return;
+    }
+
+    pwm_message_t pwm_msg;
+    frame_features_t features;
+    pack(msg, &pwm_msg, &features);
 
+    candidates = pwm_decoders.filter(candidates, features, pwm_msg.buf, msg->length);
+    pwm_decoders.dispatch(candidates, [&](PWMDecoder *decoder) {
+      return decoder->decode_pwm(&pwm_msg, msg);
+    });
+  }
 
+  /**
+   * @brief Decode a PWM message.
+   *
+   * @return true if the frame was recognized by this decoder.
+   */
+  virtual bool decode_pwm(pwm_message_t *pwm_msg, rmt_message_t *rmt_msg) { return false; }
+};
@@ -0,0 +1,211 @@
+#pragma once
+#include "rmt_message.h"
+#include "decoders.h"
+#include "decoded_event.h"
+#include <Arduino.h>
+
+#define TAG_FIXED_CODE "FIXED_CODE"
+
+/*
+ * Compile-time protocol descriptions for fixed-code remotes.
+ *
+ * A protocol is a traits struct with static constexpr members:
+ *
+ *   name           Name reported in statistics and logs.
+ *   id             protocol_id_t of the decoded events.
+ *   te             Base pulse length, us.
+ *   tolerance_pct  Allowed deviation of every pulse and gap.
+ *   bits           Code length in bits (symbols).
+ *   sync, zero, one  {high, low} in multiples of te.
+ *   address_bits, data_bits  Field layout, MSB first: address, then data.
+ *   tristate       Bits come in pairs: 00 = '0', 11 = '1', 01 = 'F'; 10 is invalid.
+ *   yields_to_tristate  Leave codes that are valid tristate codes to the tristate
+ *                  protocol with the same timing, so a frame decodes as one protocol.
+ *
+ * FixedCodeDecoder<Protocol> turns that into a matcher whose windows are all
+ * immediate constants, so there is no table to walk at run time and each
+ * protocol costs one small specialized decode_pwm. Adding a chip is one struct.
+ */
+
+struct fixed_code_pulse_t {
+  uint8_t high;
+  uint8_t low;
+};
+
+struct fixed_code_t {
+  const char *protocol;
+  uint32_t code;
+  uint8_t bits;
+  uint32_t address;
+  uint32_t data;
+};
+
+/*
+ * EV1527 and clones (RT1527, FP1527, HS1527): 20-bit address, 4 data bits.
+ * Same timing as PT2262; a code with no '10' bit pair is PT2262's.
+ */
+struct EV1527 {
+  static constexpr const char *name = "EV1527";
+  static constexpr protocol_id_t id = PROTOCOL_EV1527;
+  static constexpr uint16_t te = 350;
+  static constexpr uint8_t tolerance_pct = 30;
+  static constexpr uint8_t bits = 24;
+  static constexpr fixed_code_pulse_t sync = { 1, 31 };
+  static constexpr fixed_code_pulse_t zero = { 1, 3 };
+  static constexpr fixed_code_pulse_t one = { 3, 1 };
+  static constexpr uint8_t address_bits = 20;
+  static constexpr uint8_t data_bits = 4;
+  static constexpr bool tristate = false;
+  static constexpr bool yields_to_tristate = true;
+};
+
+/* PT2262 / SC2262: 12 trits, 8 address and 4 data, each trit two bits. */
+struct PT2262 {
+  static constexpr const char *name = "PT2262";
+  static constexpr protocol_id_t id = PROTOCOL_PT2262;
+  static constexpr uint16_t te = 350;
+  static constexpr uint8_t tolerance_pct = 30;
+  static constexpr uint8_t bits = 24;
+  static constexpr fixed_code_pulse_t sync = { 1, 31 };
+  static constexpr fixed_code_pulse_t zero = { 1, 3 };
+  static constexpr fixed_code_pulse_t one = { 3, 1 };
+  static constexpr uint8_t address_bits = 16;
+  static constexpr uint8_t data_bits = 8;
+  static constexpr bool tristate = true;
+  static constexpr bool yields_to_tristate = false;
+};
+
+/* HS2303-PT: 24 bits with a short base pulse and very skewed duty. */
+struct HS2303 {
+  static constexpr const char *name = "HS2303";
+  static constexpr protocol_id_t id = PROTOCOL_HS2303;
+  static constexpr uint16_t te = 150;
+  static constexpr uint8_t tolerance_pct = 30;
+  static constexpr uint8_t bits = 24;
+  static constexpr fixed_code_pulse_t sync = { 2, 62 };
+  static constexpr fixed_code_pulse_t zero = { 1, 6 };
+  static constexpr fixed_code_pulse_t one = { 6, 1 };
+  static constexpr uint8_t address_bits = 20;
+  static constexpr uint8_t data_bits = 4;
+  static constexpr bool tristate = false;
+  static constexpr bool yields_to_tristate = false;
+};
+
+template <typename P>
+class FixedCodeDecoder : public PWMDecoder
+{
+  static_assert(P::bits > 0 && P::bits <= 32, "fixed codes must fit in 32 bits");
+  static_assert(P::address_bits + P::data_bits <= P::bits, "fields exceed the code length");
+  static_assert(!P::tristate || P::bits % 2 == 0, "tristate codes need an even bit count");
+  static_assert(!(P::tristate && P::yields_to_tristate), "a tristate protocol cannot yield to itself");
+
+  static constexpr uint16_t lo(uint8_t n) { return (uint32_t)P::te * n * (100 - P::tolerance_pct) / 100; }
+  static constexpr uint16_t hi(uint8_t n) { return (uint32_t)P::te * n * (100 + P::tolerance_pct) / 100; }
+  static constexpr uint8_t min_high = MIN(P::sync.high, MIN(P::zero.high, P::one.high));
+  static constexpr uint8_t max_high = MAX(P::sync.high, MAX(P::zero.high, P::one.high));
+
+  static inline bool in(uint16_t d, uint8_t n) { return d >= lo(n) && d <= hi(n); }
+
+  static inline bool isSync(const rmt_message_t *msg, uint16_t i) {
+    const rmt_data_t &s = msg->buf[i];
+    // A sync gap longer than the RMT idle threshold ends the capture instead.
+    return in(s.duration0, P::sync.high) && (in(s.duration1, P::sync.low) || (s.duration1 == 0 && i == msg->length - 1));
+  }
+
+  /** No bit pair of `c` is the invalid trit 10. */
+  static inline bool validTrits(uint32_t c) {
+    for (uint8_t t = 0; t < P::bits; t += 2) {
+      if (((c >> (P::bits - 2 - t)) & 0b11) == 0b10) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * @brief Read `P::bits` symbols starting at `first` into a code.
+   *
+   * @return false if any symbol is neither a zero nor a one, a trit is
+   * invalid, or the code is a tristate code this protocol yields.
+   */
+  static inline bool readCode(const rmt_message_t *msg, uint16_t first, uint32_t *code) {
+    uint32_t c = 0;
+    for (uint8_t b = 0; b < P::bits; b++) {
+      const rmt_data_t &s = msg->buf[first + b];
+      if (in(s.duration0, P::one.high) && in(s.duration1, P::one.low)) {
+        c = (c << 1) | 1;
+      } else if (in(s.duration0, P::zero.high) && in(s.duration1, P::zero.low)) {
+        c <<= 1;
+      } else {
+        return false;
+      }
+    }
+    if (P::tristate && !validTrits(c)) {
+      return false;
+    }
+    if (P::yields_to_tristate && P::bits % 2 == 0 && validTrits(c)) {
+      return false;
+    }
+    *code = c;
+    return true;
+  }
+
+public:
+  FixedCodeDecoder() : PWMDecoder(P::name, {
+    P::bits, DECODER_MAX_SYMBOLS,
+    lo(min_high), hi(max_high),
+    lo(min_high), hi(max_high),
+    0, 0 }) {}
+
+  /**
+   * @brief Set a callback for decoded codes.
+   *
+   * @param cb Called with every decoded code word.
+   */
+  void set_on_code(std::function<void(const fixed_code_t &)> cb) {
+    on_code_ = cb;
+  }
+
+  /**
+   * @brief Find a code word in the capture.
+   *
+   * Looks for a sync symbol and reads the `P::bits` symbols before it, or after it
+   * when the capture starts with the sync. The first valid code word wins; the
+   * repeats that follow it are ignored. The code is published as a decoded event.
+   *
+   * @return true if a code word was found.
+   */
+  bool decode_pwm(pwm_message_t *pwm_msg, rmt_message_t *rmt_msg) override {
+    uint32_t code;
+    for (uint16_t i = 0; i < rmt_msg->length; i++) {
+      if (!isSync(rmt_msg, i)) {
+        continue;
+      }
+      if ((i >= P::bits && readCode(rmt_msg, i - P::bits, &code)) ||
+          (i + P::bits < rmt_msg->length && readCode(rmt_msg, i + 1, &code))) {
+        fixed_code_t result = {
+          .protocol = P::name,
+          .code = code,
+          .bits = P::bits,
+          .address = (uint32_t)((code >> (P::bits - P::address_bits)) & ((1ULL << P::address_bits) - 1)),
+          .data = (uint32_t)((code >> (P::bits - P::address_bits - P::data_bits)) & ((1ULL << P::data_bits) - 1)),
+        };
+        ESP_LOGD(TAG_FIXED_CODE, "%s: code 0x%06lx address 0x%05lx data 0x%lx", P::name,
+                 (unsigned long)result.code, (unsigned long)result.address, (unsigned long)result.data);
+        decoded_event_t event(P::id, rmt_msg);
+        event.setPayload(code, P::bits);
+        event.addField(FIELD_ADDRESS, result.address);
+        event.addField(FIELD_DATA, result.data);
+        DecodedEvents::publish(event);
+        if (on_code_) {
+          on_code_(result);
+        }
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  std::function<void(const fixed_code_t &)> on_code_;
+};
@@ -0,0 +1,224 @@
+#pragma once
+#include <Arduino.h>
+#include "driver/pulse_cnt.h"
+#include "freertos/semphr.h"
+
+#define TAG_FLOW "FLOW"
+
+/* The hardware counter wraps here; the driver adds each wrap to the count. */
+#define FLOW_PCNT_LIMIT 30000
+/* Pulses shorter than this are filtered out in hardware. */
+#define FLOW_GLITCH_NS 1000
+
+/**
+ * @brief Counts the pulses of a flow sensor in the PCNT peripheral.
+ *
+ * Pulses are counted in hardware; the CPU only hears from the counter when
+ * it wraps (every FLOW_PCNT_LIMIT pulses) or reaches the watch point set for
+ * the target, never per pulse. The PCNT counter is 16 bits wide, so a target
+ * further away than one wrap is armed in steps: the watch point is only set
+ * once the target is within the current lap.
+ *
+ * A watch point added to a running unit only takes effect once the count is
+ * cleared, so arming adds it and then clears the count, keeping what was
+ * counted until then in `base_`. The watch point is thus always relative to
+ * the last clear. Pulses in the few instructions between reading the count
+ * and clearing it are lost.
+ *
+ * Both interrupts just set `event_bit` in the owner's event group; the owner
+ * then calls service() from its task, which rearms the watch point and tells
+ * whether the target has been reached. start(), extend() and service() may
+ * be called from different tasks.
+ */
+class FlowMeter
+{
+public:
+  /**
+   * @brief Set up the counter on `pin`.
+   *
+   * @param events Event group of the owner.
+   * @param event_bit Set from the interrupt when the counter wraps or reaches the target.
+   * @return false if the pin is not set or the PCNT unit could not be set up.
+   */
+  bool init(int pin, EventGroupHandle_t events, EventBits_t event_bit) {
+    if (pin < 0) {
+      return false;
+    }
+    events_ = events;
+    event_bit_ = event_bit;
+    mutex_ = xSemaphoreCreateMutexStatic(&mutex_buffer_);
+
+    pcnt_unit_config_t unit_config = {};
+    unit_config.low_limit = -1;
+    unit_config.high_limit = FLOW_PCNT_LIMIT;
+    unit_config.flags.accum_count = 1;
+    pcnt_glitch_filter_config_t filter_config = {};
+    filter_config.max_glitch_ns = FLOW_GLITCH_NS;
+    pcnt_chan_config_t chan_config = {};
+    chan_config.edge_gpio_num = pin;
+    chan_config.level_gpio_num = -1;
+    pcnt_event_callbacks_t callbacks = {};
+    callbacks.on_reach = onReach;
+
+    esp_err_t err = pcnt_new_unit(&unit_config, &unit_);
+    if (err == ESP_OK) err = pcnt_unit_set_glitch_filter(unit_, &filter_config);
+    if (err == ESP_OK) err = pcnt_new_channel(unit_, &chan_config, &channel_);
+    if (err == ESP_OK) err = pcnt_channel_set_edge_action(channel_, PCNT_CHANNEL_EDGE_ACTION_INCREASE, PCNT_CHANNEL_EDGE_ACTION_HOLD);
+    if (err == ESP_OK) err = pcnt_unit_add_watch_point(unit_, FLOW_PCNT_LIMIT);
+    if (err == ESP_OK) err = pcnt_unit_register_event_callbacks(unit_, &callbacks, this);
+    if (err == ESP_OK) err = pcnt_unit_enable(unit_);
+    if (err == ESP_OK) err = pcnt_unit_clear_count(unit_);
+    if (err == ESP_OK) err = pcnt_unit_start(unit_);
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG_FLOW, "PCNT setup on pin %d failed (%s)", pin, esp_err_to_name(err));
+      unit_ = NULL;
+      return false;
+    }
+    ESP_LOGI(TAG_FLOW, "Counting flow pulses on pin %d", pin);
+    return true;
+  }
+
+  bool available() const { return unit_ != NULL; }
+
+  /**
+   * @brief Start counting from zero.
+   *
+   * @param target_pulses Count at which service() reports the target reached, 0 for none.
+   */
+  void start(uint32_t target_pulses) {
+    if (!available()) {
+      return;
+    }
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    disarm();
+    pcnt_unit_clear_count(unit_);
+    base_ = 0;
+    target_ = target_pulses;
+    arm();
+    xSemaphoreGive(mutex_);
+  }
+
+  /**
+   * @brief Move the target `pulses` further; does nothing without a target.
+   */
+  void extend(uint32_t pulses) {
+    if (!available()) {
+      return;
+    }
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    if (target_ > 0) {
+      disarm();
+      target_ += pulses;
+      arm();
+    }
+    xSemaphoreGive(mutex_);
+  }
+
+  /**
+   * @brief Drop the target; the count goes on.
+   */
+  void clearTarget() {
+    if (!available()) {
+      return;
+    }
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    disarm();
+    target_ = 0;
+    xSemaphoreGive(mutex_);
+  }
+
+  /**
+   * @brief Handle `event_bit`: rearm the target watch point.
+   *
+   * @return true once the target has been reached; the target is cleared then.
+   */
+  bool service() {
+    if (!available()) {
+      return false;
+    }
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    bool reached = target_ > 0 && counted() >= target_;
+    if (reached) {
+      disarm();
+      target_ = 0;
+    } else if (target_ > 0 && armed_ == 0) {
+      arm();
+    }
+    xSemaphoreGive(mutex_);
+    return reached;
+  }
+
+  /**
+   * @brief Pulses since start().
+   */
+  uint32_t pulses() const {
+    if (!available()) {
+      return 0;
+    }
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    uint32_t count = counted();
+    xSemaphoreGive(mutex_);
+    return count;
+  }
+
+  uint32_t target() const { return target_; }
+
+private:
+  pcnt_unit_handle_t unit_ = NULL;
+  pcnt_channel_handle_t channel_ = NULL;
+  EventGroupHandle_t events_ = NULL;
+  EventBits_t event_bit_ = 0;
+  SemaphoreHandle_t mutex_ = NULL;
+  StaticSemaphore_t mutex_buffer_;
+  uint32_t target_ = 0;
+  uint32_t base_ = 0;  // pulses counted before the last clear
+  int armed_ = 0;      // the target watch point, as a counter value; 0: none
+
+  static bool IRAM_ATTR onReach(pcnt_unit_handle_t unit, const pcnt_watch_event_data_t *edata, void *arg) {
+    FlowMeter *this_ = static_cast<FlowMeter *>(arg);
+    BaseType_t woken = pdFALSE;
+    xEventGroupSetBitsFromISR(this_->events_, this_->event_bit_, &woken);
+    return woken == pdTRUE;
+  }
+
+  /* Pulses since start(); with the mutex held. */
+  uint32_t counted() const {
+    int count = 0;
+    pcnt_unit_get_count(unit_, &count);
+    return base_ + (count < 0 ? 0 : count);
+  }
+
+  /**
+   * @brief Set the watch point if the target is within one lap, and clear the count so it takes effect.
+   *
+   * Should the count reach the target while it is being set, the event bit
+   * is set here instead, so the target is never missed.
+   */
+  void arm() {
+    if (target_ == 0) {
+      return;
+    }
+    uint32_t done = counted();
+    uint32_t remaining = target_ > done ? target_ - done : 0;
+    if (remaining >= FLOW_PCNT_LIMIT) {
+      return;  // a later lap; the wrap event comes back here
+    }
+    if (remaining > 0 && pcnt_unit_add_watch_point(unit_, remaining) == ESP_OK) {
+      armed_ = remaining;
+      int count = 0;
+      pcnt_unit_get_count(unit_, &count);
+      pcnt_unit_clear_count(unit_);
+      base_ += count < 0 ? 0 : count;
+    }
+    if (counted() >= target_) {
+      xEventGroupSetBits(events_, event_bit_);
+    }
+  }
+
+  void disarm() {
+    if (armed_ != 0) {
+      pcnt_unit_remove_watch_point(unit_, armed_);
+      armed_ = 0;
+    }
+  }
+};
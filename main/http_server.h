@@ -5,18 +5,24 @@
 #include <esp_http_server.h>
 #include "mbedtls/base64.h"
 #include "freertos/message_buffer.h"
+#include "esp_timer.h"
 #include "WiFi.h"
 
 
 #include "main.h"
 #include "pump.h"
+#include "pump_scheduler.h"
+#include "ws_frame.h"
+#include "web_bundle.h"
+#include "ws_clients.h"
 
 
 #define TAG_HTTP "HTTPD"
 #define FILE_PATH_MAX (128 + 128)
 #define SCRATCH_BUFSIZE (10240)
 
-char chunk[1024] = { 0 };
+/* File reads fill the TCP send buffer in one go; each response has its own buffer. */
+#define SEND_FILE_CHUNK_SIZE CONFIG_LWIP_TCP_SND_BUF_DEFAULT
 
 httpd_handle_t server = NULL;
 
@@ -25,7 +31,13 @@ struct async_resp_arg {
     int fd;
 };
 
-static MessageBufferHandle_t wsMeassageBufferHandle = NULL;
+static esp_err_t radio_stats_get_handler(httpd_req_t *req);
+static esp_err_t radio_capture_get_handler(httpd_req_t *req);
+static esp_err_t radio_capture_post_handler(httpd_req_t *req);
+static esp_err_t radio_remotes_get_handler(httpd_req_t *req);
+static esp_err_t radio_remotes_post_handler(httpd_req_t *req);
+static esp_err_t zones_get_handler(httpd_req_t *req);
+static esp_err_t zones_post_handler(httpd_req_t *req);
 
 static inline bool file_exist(const char *path)
 {
@@ -39,38 +51,66 @@ static inline bool file_exist(const char *path)
 }
 
 
-#define CHECK_FILE_EXTENSION(filename, ext) (strcasecmp(&filename[strlen(filename) - strlen(ext)], ext) == 0)
-
 /* Set HTTP response content type according to file extension */
 static esp_err_t set_content_type_from_file(httpd_req_t *req, const char *filepath)
 {
-    if (CHECK_FILE_EXTENSION(filepath, ".gz")) {
+    if (ASSET_CHECK_EXTENSION(filepath, ".gz")) {
         httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
     }
-    const char *type = "text/plain";
-    if (CHECK_FILE_EXTENSION(filepath, ".html")) {
-        type = "text/html";
-    }
-    else if (CHECK_FILE_EXTENSION(filepath, ".html.gz")) {
-        type = "text/html";
-    } else if (CHECK_FILE_EXTENSION(filepath, ".json")) {
-        type = "application/json";
-    } else if (CHECK_FILE_EXTENSION(filepath, ".js")) {
-        type = "application/javascript";
-    } else if (CHECK_FILE_EXTENSION(filepath, ".css")) {
-        type = "text/css";
-    } else if (CHECK_FILE_EXTENSION(filepath, ".png")) {
-        type = "image/png";
-    } else if (CHECK_FILE_EXTENSION(filepath, ".ico")) {
-        type = "image/x-icon";
-    } else if (CHECK_FILE_EXTENSION(filepath, ".svg")) {
-        type = "text/xml";
-    }
-    return httpd_resp_set_type(req, type);
+    return httpd_resp_set_type(req, asset_content_type(filepath));
 }
 
 
 
+/**
+ * @brief Throughput of file and asset responses, for GET /http/stats.
+ *
+ * `busy_us` sums the time of every response, `wall_us` only counts the time
+ * at least one was being sent, so bytes / wall_us is the throughput of the
+ * server as a whole when several clients load the UI at once.
+ */
+struct http_send_stats_t {
+    uint32_t responses;
+    uint32_t chunks;
+    uint32_t max_chunks;
+    uint64_t bytes;
+    uint64_t busy_us;
+    uint64_t wall_us;
+    int64_t wall_start;
+    uint8_t active;
+    uint8_t max_active;
+};
+
+static http_send_stats_t http_send_stats = {};
+static portMUX_TYPE http_send_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static int64_t http_send_begin()
+{
+    int64_t now = esp_timer_get_time();
+    taskENTER_CRITICAL(&http_send_stats_lock);
+    if (http_send_stats.active++ == 0) {
+        http_send_stats.wall_start = now;
+    }
+    http_send_stats.max_active = MAX(http_send_stats.max_active, http_send_stats.active);
+    taskEXIT_CRITICAL(&http_send_stats_lock);
+    return now;
+}
+
+static void http_send_end(int64_t start, size_t bytes, uint32_t chunks)
+{
+    int64_t now = esp_timer_get_time();
+    taskENTER_CRITICAL(&http_send_stats_lock);
+    http_send_stats.responses++;
+    http_send_stats.chunks += chunks;
+    http_send_stats.max_chunks = MAX(http_send_stats.max_chunks, chunks);
+    http_send_stats.bytes += bytes;
+    http_send_stats.busy_us += now - start;
+    if (--http_send_stats.active == 0) {
+        http_send_stats.wall_us += now - http_send_stats.wall_start;
+    }
+    taskEXIT_CRITICAL(&http_send_stats_lock);
+}
+
 /**
  * Sends a file in chunks as an HTTP response.
  *
@@ -78,7 +118,8 @@ static esp_err_t set_content_type_from_file(httpd_req_t *req, const char *filepa
  * @param filepath The path to the file to be sent.
  * @return ESP_OK if the file was sent successfully, ESP_FAIL otherwise.
  *
- * This function opens the file specified by `filepath`, reads it in chunks, and sends each chunk as an HTTP response.
+ * This function opens the file specified by `filepath`, reads it in chunks of SEND_FILE_CHUNK_SIZE, and sends each
+ * chunk as an HTTP response. The buffer is allocated per call, so any number of httpd workers can send files at once.
  * The MIME type of the file is determined by its extension using the `set_content_type_from_file` function.
  * If an error occurs while reading the file or sending the response, an error message is logged and the function
  * returns ESP_FAIL.
@@ -89,40 +130,78 @@ static esp_err_t send_file(httpd_req_t *req, const char* filepath)
     if (fd < 0) {
         return ESP_FAIL;
     }
+    char *chunk = (char *)malloc(SEND_FILE_CHUNK_SIZE);
+    if (chunk == NULL) {
+        close(fd);
+        ESP_LOGE(TAG_HTTP, "No memory to send %s", filepath);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
     ESP_LOGD(TAG_HTTP, "Sending file: %s", filepath);
     set_content_type_from_file(req, filepath);
 
+    int64_t start = http_send_begin();
+    size_t sent = 0;
+    uint32_t chunks = 0;
+    esp_err_t ret = ESP_OK;
     /* Send file in chunks */
     ssize_t read_bytes;
-    do {
-        /* Read file in chunks into the scratch buffer */
-        read_bytes = read(fd, chunk, 1024);
-        if (read_bytes == -1) {
-            close(fd);
-            ESP_LOGE(TAG_HTTP, "Failed to read file");
-            /* Abort sending file */
-            httpd_resp_sendstr_chunk(req, NULL);
-            /* Respond with 500 Internal Server Error */
-            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to send file");
-            return ESP_FAIL;
-        }
+    while ((read_bytes = read(fd, chunk, SEND_FILE_CHUNK_SIZE)) != 0) {
         /* Send the buffer contents as HTTP response chunk */
-        if (httpd_resp_send_chunk(req, chunk, read_bytes) != ESP_OK) {
-            close(fd);
-            ESP_LOGE(TAG_HTTP, "File sending failed!");
+        if (read_bytes < 0 || httpd_resp_send_chunk(req, chunk, read_bytes) != ESP_OK) {
+            ESP_LOGE(TAG_HTTP, read_bytes < 0 ? "Failed to read file" : "File sending failed!");
             /* Abort sending file */
             httpd_resp_sendstr_chunk(req, NULL);
             /* Respond with 500 Internal Server Error */
             httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to send file");
-            return ESP_FAIL;
+            ret = ESP_FAIL;
+            break;
         }
-    } while (read_bytes > 0);
+        sent += read_bytes;
+        chunks++;
+    }
 
     close(fd);
-    ESP_LOGD(TAG_HTTP, "File sent: %s", filepath);
-    /* Respond with an empty chunk to signal HTTP response completion */
-    httpd_resp_send_chunk(req, NULL, 0);
-    return ESP_OK;
+    free(chunk);
+    if (ret == ESP_OK) {
+        ESP_LOGD(TAG_HTTP, "File sent: %s", filepath);
+        /* Respond with an empty chunk to signal HTTP response completion */
+        httpd_resp_send_chunk(req, NULL, 0);
+    }
+    http_send_end(start, sent, chunks);
+    return ret;
+}
+
+/**
+ * @brief Send a web UI asset, or 304 if the client's copy is current.
+ *
+ * Assets in memory, bundled in flash or cached in RAM, are handed to the
+ * socket in one call, straight from where they are; the others are
+ * streamed from SPIFFS. Either way the ETag and Cache-Control headers come from the index.
+ */
+static esp_err_t send_asset(httpd_req_t *req, const asset_t *asset)
+{
+  char if_none_match[16];
+  httpd_resp_set_hdr(req, "ETag", asset->etag);
+  httpd_resp_set_hdr(req, "Cache-Control", asset->cache_control);
+  if (httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match, sizeof(if_none_match)) == ESP_OK &&
+      strcmp(if_none_match, asset->etag) == 0) {
+    httpd_resp_set_status(req, "304 Not Modified");
+    return httpd_resp_send(req, NULL, 0);
+  }
+  if (asset->data == NULL) {
+    char filepath[FILE_PATH_MAX];
+    snprintf(filepath, sizeof(filepath), ASSET_CACHE_ROOT "/%s", asset->name);
+    return send_file(req, filepath);
+  }
+  if (asset->gzip) {
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+  }
+  httpd_resp_set_type(req, asset->type);
+  int64_t start = http_send_begin();
+  esp_err_t ret = httpd_resp_send(req, (const char *)asset->data, asset->size);
+  http_send_end(start, ret == ESP_OK ? asset->size : 0, 1);
+  return ret;
 }
 
 /**
@@ -131,15 +210,28 @@ static esp_err_t send_file(httpd_req_t *req, const char* filepath)
  * @param req The HTTP request object.
  * @return ESP_OK if the file was sent successfully, ESP_FAIL otherwise.
  *
- * This function tries to find the requested file in two locations: the original
- * location (i.e., filepath) and the location with the ".gz" extension. If the file
- * is found, it is sent as an HTTP response using the send_file function. If not,
- * the "index.html.gz" file is sent.
+ * The requested file is served from the UI bundle linked into the app. Built
+ * without it, the file is looked up in the asset index: the file itself, then
+ * the file with the ".gz" extension, then "index.html.gz". Only if the index
+ * is empty, e.g. /spiffs/www could not be read at boot, does it try the same
+ * files on the filesystem.
  */
 static esp_err_t rest_common_get_handler(httpd_req_t *req)
 {
   const char* uri = req->uri;
-  char filepath[FILE_PATH_MAX] = "/spiffs/www";
+  const asset_t *asset = web_bundle_resolve(uri);
+  if (asset) {
+    return send_asset(req, asset);
+  }
+  if (!asset_cache.empty()) {
+    asset = asset_cache.resolve(uri);
+    if (asset == NULL) {
+      return httpd_resp_send_404(req);
+    }
+    return send_asset(req, asset);
+  }
+
+  char filepath[FILE_PATH_MAX] = ASSET_CACHE_ROOT;
   strlcat(filepath, uri, sizeof(filepath));
 
   ESP_LOGD(TAG_HTTP, "File requested: %s", filepath);
@@ -154,7 +246,7 @@ static esp_err_t rest_common_get_handler(httpd_req_t *req)
     return send_file(req, filepath);
   }
 
-  strlcpy(filepath, "/spiffs/www/index.html.gz", sizeof(filepath));
+  strlcpy(filepath, ASSET_CACHE_ROOT "/index.html.gz", sizeof(filepath));
   return send_file(req, filepath);
 }
 
@@ -228,6 +320,156 @@ static esp_err_t pump_config_post_handler(httpd_req_t *req)
 }
 
 
+static esp_err_t pump_jobs_send(httpd_req_t *req)
+{
+  cJSON *json = cJSON_CreateObject();
+  pump_scheduler->serialize(json);
+  char *str = cJSON_PrintUnformatted(json);
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_sendstr(req, str);
+  cJSON_free(str);
+  cJSON_Delete(json);
+  return ESP_OK;
+}
+
+/**
+ * @brief Handle POST request to /pump/jobs. Add, edit or delete a scheduled job.
+ *
+ * Without an `id`, the body is a new job:
+ * `{"name": "lawn", "start": 1767247200, "period_s": 86400, "liters": 20}`, with
+ * `time_ms` instead of `liters` to run for a time; `period_s` 0 runs once. With
+ * an `id`, the members given replace those of that job, and `"remove": true`
+ * deletes it. Responds with all jobs, as GET does.
+ *
+ * @param req The HTTP request object
+ * @return esp_err_t ESP_FAIL on a bad request, ESP_OK otherwise.
+ */
+static esp_err_t pump_jobs_post_handler(httpd_req_t *req)
+{
+  cJSON *json = nullptr;
+  if (httpd_get_JSON(req, &json) != ESP_OK || json == nullptr) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Expected JSON");
+    return ESP_FAIL;
+  }
+  int id = JSON_OBJECT_NOT_NULL(json, "id", -1);
+  pump_job_t job = {};
+  job.enabled = true;
+  job.zone = -1;
+  bool ok;
+  if (id < 0) {
+    ok = PumpScheduler::deserializeJob(json, &job) && pump_scheduler->add(job) >= 0;
+  } else if (cJSON_IsTrue(cJSON_GetObjectItem(json, "remove"))) {
+    ok = pump_scheduler->remove(id);
+  } else {
+    ok = pump_scheduler->get(id, &job) && PumpScheduler::deserializeJob(json, &job) && pump_scheduler->update(id, job);
+  }
+  cJSON_Delete(json);
+  if (!ok) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid job, unknown id or too many jobs");
+    return ESP_FAIL;
+  }
+  return pump_jobs_send(req);
+}
+
+/**
+ * @brief Handle GET request to /pump/history. Stream a page of the run history, newest first.
+ *
+ * `?limit=` runs per page (default PUMP_HISTORY_PAGE, at most PUMP_HISTORY_PAGE_MAX)
+ * and `?before=` the `next` of the previous page. Records are read from flash
+ * and sent a chunk at a time, so the page size does not depend on RAM.
+ *
+ * @param req The HTTP request object
+ * @return esp_err_t ESP_OK.
+ */
+static esp_err_t pump_history_get_handler(httpd_req_t *req)
+{
+  uint32_t before = pump_history.head();
+  uint32_t limit = PUMP_HISTORY_PAGE;
+  char query[64];
+  char value[16];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+    if (httpd_query_key_value(query, "before", value, sizeof(value)) == ESP_OK) {
+      before = MIN(strtoul(value, NULL, 10), before);
+    }
+    if (httpd_query_key_value(query, "limit", value, sizeof(value)) == ESP_OK) {
+      limit = MIN(MAX(strtoul(value, NULL, 10), 1), PUMP_HISTORY_PAGE_MAX);
+    }
+  }
+  httpd_resp_set_type(req, "application/json");
+  char buf[512];
+  size_t len = snprintf(buf, sizeof(buf), "{\"head\":%lu,\"runs\":[", (unsigned long)pump_history.head());
+  uint32_t oldest = pump_history.oldest();
+  uint32_t seq = before;
+  uint32_t count = 0;
+  pump_run_record_t record;
+  char duration[12];
+  char volume[12];
+  while (seq > oldest && count < limit) {
+    if (!pump_history.read(--seq, &record)) {
+      continue;
+    }
+    if (len > sizeof(buf) - 224) {
+      httpd_resp_send_chunk(req, buf, len);
+      len = 0;
+    }
+    bool ended = record.duration_ms != PUMP_HISTORY_FREE;
+    snprintf(duration, sizeof(duration), ended ? "%lu" : "null", (unsigned long)record.duration_ms);
+    snprintf(volume, sizeof(volume), record.volume_ml != PUMP_HISTORY_FREE ? "%lu" : "null", (unsigned long)record.volume_ml);
+    len += snprintf(buf + len, sizeof(buf) - len,
+                    "%s{\"seq\":%lu,\"start\":%lu,\"uptime_ms\":%lu,\"mode\":\"%s\",\"target\":%lu,"
+                    "\"duration_ms\":%s,\"volume_ml\":%s,\"reason\":\"%s\"}",
+                    count ? "," : "", (unsigned long)record.seq, (unsigned long)record.start, (unsigned long)record.uptime_ms,
+                    record.mode == PUMP_RUN_VOLUME ? "volume" : "time", (unsigned long)record.target, duration, volume,
+                    PumpHistory::reasonName(record.reason_check == (uint8_t)~record.reason ? record.reason : PUMP_STOP_RUNNING));
+    count++;
+  }
+  if (seq > oldest) {
+    len += snprintf(buf + len, sizeof(buf) - len, "],\"next\":%lu}", (unsigned long)seq);
+  } else {
+    len += snprintf(buf + len, sizeof(buf) - len, "],\"next\":null}");
+  }
+  httpd_resp_send_chunk(req, buf, len);
+  httpd_resp_send_chunk(req, NULL, 0);
+  return ESP_OK;
+}
+
+
+/**
+ * @brief Handle GET request to /http/stats. Throughput of file and asset responses.
+ *
+ * `bytes_per_s` is over the time any response was being sent, so it grows
+ * with concurrent clients; `response_bytes_per_s` is that of one response.
+ *
+ * @param req The HTTP request object
+ * @return esp_err_t ESP_OK.
+ */
+static esp_err_t http_stats_get_handler(httpd_req_t *req)
+{
+  taskENTER_CRITICAL(&http_send_stats_lock);
+  http_send_stats_t stats = http_send_stats;
+  taskEXIT_CRITICAL(&http_send_stats_lock);
+  if (stats.active) {
+    stats.wall_us += esp_timer_get_time() - stats.wall_start;
+  }
+  cJSON *json = cJSON_CreateObject();
+  cJSON_AddNumberToObject(json, "responses", stats.responses);
+  cJSON_AddNumberToObject(json, "bytes", stats.bytes);
+  cJSON_AddNumberToObject(json, "chunk_size", SEND_FILE_CHUNK_SIZE);
+  cJSON_AddNumberToObject(json, "chunks_per_response", stats.responses ? (double)stats.chunks / stats.responses : 0);
+  cJSON_AddNumberToObject(json, "max_chunks", stats.max_chunks);
+  cJSON_AddNumberToObject(json, "bytes_per_s", stats.wall_us ? stats.bytes * 1000000.0 / stats.wall_us : 0);
+  cJSON_AddNumberToObject(json, "response_bytes_per_s", stats.busy_us ? stats.bytes * 1000000.0 / stats.busy_us : 0);
+  cJSON_AddNumberToObject(json, "active", stats.active);
+  cJSON_AddNumberToObject(json, "max_active", stats.max_active);
+  ws_clients.serializeStats(cJSON_AddObjectToObject(json, "ws"));
+  char *str = cJSON_PrintUnformatted(json);
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_sendstr(req, str);
+  cJSON_free(str);
+  cJSON_Delete(json);
+  return ESP_OK;
+}
+
 
 /**
  * @brief Register a URI handler for the given method and URI.
@@ -291,7 +533,10 @@ static void ws_async_send(void *arg)
 
 static esp_err_t trigger_async_send(httpd_handle_t handle, httpd_req_t *req)
 {
-    struct async_resp_arg *resp_arg = new async_resp_arg;
+    struct async_resp_arg *resp_arg = (async_resp_arg *)malloc(sizeof(async_resp_arg));
+    if (resp_arg == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
     resp_arg->hd = req->handle;
     resp_arg->fd = httpd_req_to_sockfd(req);
     return httpd_queue_work(handle, ws_async_send, resp_arg);
@@ -301,6 +546,8 @@ static esp_err_t trigger_async_send(httpd_handle_t handle, httpd_req_t *req)
 static esp_err_t echo_handler(httpd_req_t *req)
 {
     if (req->method == HTTP_GET) {
+        /* Handshake: a new client, possibly on a reused socket, starts with the defaults */
+        ws_clients.open(httpd_req_to_sockfd(req));
         return ESP_OK;
     }
     httpd_ws_frame_t ws_pkt;
@@ -333,6 +580,20 @@ static esp_err_t echo_handler(httpd_req_t *req)
         return trigger_async_send(req->handle, req);
     }
 
+    char *reply = NULL;
+    if (ws_pkt.type == HTTPD_WS_TYPE_TEXT && buf != NULL &&
+        ws_clients.configure(httpd_req_to_sockfd(req), (char*)buf, &reply)) {
+        free(buf);
+        if (reply == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+        ws_pkt.payload = (uint8_t*)reply;
+        ws_pkt.len = strlen(reply);
+        ret = httpd_ws_send_frame(req, &ws_pkt);
+        cJSON_free(reply);
+        return ret;
+    }
+
     ret = httpd_ws_send_frame(req, &ws_pkt);
     free(buf);
     return ret;
@@ -341,109 +602,45 @@ static esp_err_t echo_handler(httpd_req_t *req)
 
 
 /**
- * @brief Broadcasts a binary message to all connected websocket clients.
+ * @brief Broadcasts a binary message to the websocket clients in `subscribers`.
  *
- * This function sends a binary message to all connected websocket clients.
- * It first checks if the device is connected to a WiFi network. If not,
- * this function returns without doing anything.
- *
- * If the device is connected to WiFi, this function sends the binary
- * message to the message buffer using `xMessageBufferSend`.
+ * Called from the radio and pump tasks. Never blocks: the message is queued
+ * for the broadcast task, or dropped and counted if its queue is full.
+ * Each client then gets it through its own queue, see ws_clients.h.
  *
  * @param data Pointer to the binary message to be sent.
  * @param len Length of the binary message.
- *
- * @return void
- *
- * @throws None
+ * @param subscribers Client slots to send to, from ws_subscribers().
  */
-void ws_broadcast(uint8_t *data, size_t len) {
-    if (xMessageBufferSend(wsMeassageBufferHandle, data, len, 500 / portTICK_PERIOD_MS) == pdFALSE) {
-        ESP_LOGE(TAG_HTTP, "Failed to send data to message buffer");
-    }
+void ws_broadcast_to(uint8_t *data, size_t len, uint32_t subscribers) {
+    ws_clients.broadcast(data, len, subscribers);
 }
 
+/**
+ * @brief Client slots whose subscription wants a frame, asked before it is serialized.
+ */
+uint32_t ws_subscribers(const ws_frame_info_t &frame) {
+    return ws_clients.subscribers(frame);
+}
 
 /**
- * @brief Broadcasts a binary message to all connected websocket clients.
+ * @brief Broadcasts a binary message to the websocket clients subscribed to it.
  *
- * This function sends a binary message to all connected websocket clients.
- * It first checks if the device is connected to a WiFi network. If not,
- * this function returns without doing anything.
- *
- * If the device is connected to WiFi, this function retrieves the list of
- * connected clients and sends a binary message to each client. The binary
- * message is sent asynchronously using `httpd_ws_send_frame_async()`.
- *
- * @param buf Pointer to the buffer containing the binary message.
- * @param len Length of the binary message.
- *
- * @return void
+ * For frames serialized before asking (flow, zones); the subscriptions are
+ * matched against the frame header.
  */
-static void ws_broadcast_buf( uint8_t *buf, size_t len) {
-    if (WiFi.status() != WL_CONNECTED) {
-      ESP_LOGE(TAG_HTTP, "ws_broadcast_buf: Not connected to WiFi");
-      return;
-    }
-    static const size_t max_clients = 8;
-    size_t clients = max_clients;
-    int    client_fds[max_clients];
-    httpd_ws_frame_t ws_pkt;
-    
-    if (httpd_get_client_list(server, &clients, client_fds) == ESP_OK) {
-      for (size_t i=0; i < clients; ++i) {
-        int sock = client_fds[i];
-        if (httpd_ws_get_fd_info(server, sock) == HTTPD_WS_CLIENT_WEBSOCKET) {
-            ESP_LOGD(TAG_HTTP, "Active client (fd=%d) -> sending async message (length: %d)\n", sock, len);
-
-            struct async_resp_arg *resp_arg = new async_resp_arg;
-            resp_arg->hd = server;
-            resp_arg->fd = sock;
-            memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
-            ws_pkt.payload = buf;
-            ws_pkt.len = len;
-            ws_pkt.type = HTTPD_WS_TYPE_BINARY;
-
-            if (httpd_ws_send_frame_async(resp_arg->hd, resp_arg->fd, &ws_pkt) != ESP_OK) {
-                ESP_LOGE(TAG_HTTP, "httpd_ws_send_frame_async failed!");
-            }
-            vTaskDelay(5 / portTICK_PERIOD_MS);
-        }
-      }
-    } else {
-      ESP_LOGE(TAG_HTTP, "httpd_get_client_list failed!");
-      return;
-    }
+void ws_broadcast(uint8_t *data, size_t len) {
+    ws_broadcast_to(data, len, ws_subscribers(ws_frame::info(data, len)));
 }
 
+
 /**
- * @brief Task that receives message buffer messages and broadcasts
- * them to all websocket clients.
- *
- * This task is created by `start_webserver()` and is responsible for
- * receiving messages from the message buffer and sending them to all
- * connected websocket clients.
- *
- * @param pvParameters Pointer to `httpd_handle_t*` server handle.
+ * @brief Session close hook: drop the client's queue, then close the socket as httpd would.
  */
-static void ws_broadcast_task(void *pvParameters)
+static void ws_session_closed(httpd_handle_t hd, int sockfd)
 {
-    httpd_handle_t* server = (httpd_handle_t*)pvParameters;
-
-    wsMeassageBufferHandle = xMessageBufferCreate(512 * 6);
-    assert(wsMeassageBufferHandle != NULL);
-
-    char data[512*4];
-    size_t len = 512*4;
-    while (1) {
-        size_t len_out = xMessageBufferReceive(wsMeassageBufferHandle, data, len, portMAX_DELAY);
-        if (len_out > 0) {
-            ws_broadcast_buf((uint8_t *)data, len_out);
-        } else {
-            ESP_LOGE(TAG_HTTP, "xMessageBufferReceive failed");
-            vTaskDelay(1000 / portTICK_PERIOD_MS);
-        }
-    }
+    ws_clients.closed(sockfd);
+    close(sockfd);
 }
 
 
@@ -454,7 +651,9 @@ void start_webserver()
   config.stack_size = 1024 * 10;
   config.lru_purge_enable = true;
   config.uri_match_fn = httpd_uri_match_wildcard;
+  config.max_uri_handlers = 20;
   config.lru_purge_enable = true;
+  config.close_fn = ws_session_closed;
 
 
   if (httpd_start(&server, &config) == ESP_OK)
@@ -466,6 +665,22 @@ void start_webserver()
     
     register_uri_handler(server, "/pump_config", HTTP_POST, pump_config_post_handler);
 
+    register_uri_handler(server, "/pump/jobs", HTTP_GET, pump_jobs_send);
+    register_uri_handler(server, "/pump/jobs", HTTP_POST, pump_jobs_post_handler);
+    register_uri_handler(server, "/pump/history", HTTP_GET, pump_history_get_handler);
+
+    register_uri_handler(server, "/radio/stats", HTTP_GET, radio_stats_get_handler);
+    register_uri_handler(server, "/http/stats", HTTP_GET, http_stats_get_handler);
+
+    register_uri_handler(server, "/radio/capture", HTTP_GET, radio_capture_get_handler);
+    register_uri_handler(server, "/radio/capture", HTTP_POST, radio_capture_post_handler);
+
+    register_uri_handler(server, "/radio/remotes", HTTP_GET, radio_remotes_get_handler);
+    register_uri_handler(server, "/radio/remotes", HTTP_POST, radio_remotes_post_handler);
+
+    register_uri_handler(server, "/zones", HTTP_GET, zones_get_handler);
+    register_uri_handler(server, "/zones", HTTP_POST, zones_post_handler);
+
     static const httpd_uri_t ws = {
       .uri        = "/ws",
       .method     = HTTP_GET,
@@ -476,7 +691,7 @@ void start_webserver()
 
     httpd_register_uri_handler(server, &ws);
     
-    xTaskCreate(ws_broadcast_task, "ws_broadcast_task", 8*1024, &server, 1, NULL);
+    ws_clients.start(server);
 
     register_uri_handler(server, "/*", HTTP_OPTIONS, [](httpd_req_t *req) {
       httpd_resp_set_status(req, "200 OK");
@@ -0,0 +1,84 @@
+#pragma once
+#include <Arduino.h>
+
+/*
+ * KeeLoq block cipher: 32-bit block, 64-bit key, 528 rounds of a nonlinear
+ * feedback shift register. One bit enters the register per round, so the cipher
+ * is a plain loop over shifts and one table lookup in the NLF constant.
+ */
+
+#define KEELOQ_NLF 0x3A5C742E
+#define KEELOQ_ROUNDS 528
+
+/* Normal learning: the device key is derived from the serial number with these two words. */
+#define KEELOQ_LEARN_LOW 0x20000000
+#define KEELOQ_LEARN_HIGH 0x60000000
+
+enum keeloq_learning_t : uint8_t {
+  KEELOQ_LEARNING_SIMPLE = 0,  // the manufacturer key is the device key
+  KEELOQ_LEARNING_NORMAL = 1,  // device key derived from the serial number
+};
+
+/**
+ * @brief A device key and its decryption schedule.
+ *
+ * Decryption consumes key bits 15, 14, ... 0, 63, 62, ... Storing the key
+ * rotated so that the bit for the first round is bit 63 turns the schedule
+ * into a rotate by one per round, with nothing to recompute per frame.
+ */
+struct keeloq_key_t {
+  uint64_t key;
+  uint64_t decrypt_schedule;
+
+  keeloq_key_t(uint64_t key = 0) : key(key), decrypt_schedule(key << 48 | key >> 16) {}
+};
+
+namespace keeloq {
+
+inline uint32_t nlf(uint32_t index) {
+  return (KEELOQ_NLF >> index) & 1;
+}
+
+inline uint32_t encrypt(uint32_t data, uint64_t key) {
+  uint32_t x = data;
+  for (uint16_t i = 0; i < KEELOQ_ROUNDS; i++) {
+    uint32_t index = ((x >> 1) & 1) | ((x >> 8) & 2) | ((x >> 18) & 4) | ((x >> 23) & 8) | ((x >> 27) & 16);
+    uint32_t bit = (x ^ (x >> 16) ^ nlf(index) ^ (uint32_t)(key >> (i & 63))) & 1;
+    x = (x >> 1) | (bit << 31);
+  }
+  return x;
+}
+
+inline uint32_t decrypt(uint32_t data, const keeloq_key_t &key) {
+  uint32_t x = data;
+  uint64_t k = key.decrypt_schedule;
+  for (uint16_t i = 0; i < KEELOQ_ROUNDS; i++) {
+    uint32_t index = (x & 1) | ((x >> 7) & 2) | ((x >> 17) & 4) | ((x >> 22) & 8) | ((x >> 26) & 16);
+    uint32_t bit = ((x >> 31) ^ (x >> 15) ^ nlf(index) ^ (uint32_t)(k >> 63)) & 1;
+    x = (x << 1) | bit;
+    k = (k << 1) | (k >> 63);
+  }
+  return x;
+}
+
+inline uint32_t decrypt(uint32_t data, uint64_t key) {
+  return decrypt(data, keeloq_key_t(key));
+}
+
+/**
+ * @brief Device key of a remote.
+ *
+ * @param serial 28-bit serial number.
+ * @param manufacturer_key The manufacturer's key.
+ * @param learning How the remote's key was programmed.
+ */
+inline uint64_t deviceKey(uint32_t serial, uint64_t manufacturer_key, keeloq_learning_t learning) {
+  if (learning == KEELOQ_LEARNING_SIMPLE) {
+    return manufacturer_key;
+  }
+  keeloq_key_t mkey(manufacturer_key);
+  serial &= 0x0fffffff;
+  return (uint64_t)decrypt(serial | KEELOQ_LEARN_HIGH, mkey) << 32 | decrypt(serial | KEELOQ_LEARN_LOW, mkey);
+}
+
+} // namespace keeloq
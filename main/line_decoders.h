@@ -0,0 +1,206 @@
+#pragma once
+#include "rmt_message.h"
+#include "decoders.h"
+#include "pulse_analyzer.h"
+#include <Arduino.h>
+
+/*
+ * Decoder families besides PWMDecoder. Each family turns a capture into bits
+ * once per frame, into a bit buffer shared by all of its decoders, and only if
+ * at least one registered decoder accepts the frame length. Both families work
+ * from the timing classes PulseAnalyzer found for the frame.
+ */
+
+class ManchesterDecoder;
+
+DecoderIndex<ManchesterDecoder> manchester_decoders;
+bool isManchesterDecoderInit = false;
+
+class ManchesterDecoder : public DecoderBase
+{
+public:
+  /**
+   * @brief Constructor for ManchesterDecoder class. Adds the object to the manchester_decoders index.
+   *
+   * @param name Name reported in the decoder statistics.
+   * @param signature Frames this decoder can possibly accept.
+   */
+  ManchesterDecoder(const char *name, const decoder_signature_t &signature = DECODER_SIGNATURE_ANY) : DecoderBase(name, signature)
+  {
+    if (!isManchesterDecoderInit) {
+      manchester_decoders = DecoderIndex<ManchesterDecoder>();
+      isManchesterDecoderInit = true;
+    }
+    manchester_decoders.add(this);
+  }
+
+  /**
+   * @brief Recover the half-bit period of a Manchester frame.
+   *
+   * Manchester pulses are one or two half-bits long. The short class is the
+   * half-bit; when the long class is close to twice that, both are averaged in.
+   *
+   * @return Half-bit period in us, 0 if the frame has no usable timing.
+   */
+  static uint16_t recoverClock(const pulse_analysis_t *analysis) {
+    uint16_t half = analysis->short_us;
+    uint16_t full = analysis->long_us;
+    if (half && full != half && full * 2 >= half * 3 && full * 2 <= half * 5) {
+      half = (half + full / 2) / 2;
+    }
+    return half;
+  }
+
+  /**
+   * @brief Line-decode a capture as Manchester and call decode_manchester on the matching decoders.
+   *
+   * Every pulse and gap is split into one or two half-bits of its level. Half-bits
+   * are paired into bits, IEEE 802.3 style: the bit is the level of the second half,
+   * so a rising mid-bit edge is a 1. A pair without a transition before any bit was
+   * produced shifts the alignment by one half-bit; after that it ends the data, as
+   * does any pulse that is not one or two half-bits long.
+   *
+   * @param msg The capture.
+   * @param analysis PulseAnalyzer result for the capture.
+   */
+  static void decode(rmt_message_t *msg, const pulse_analysis_t *analysis) {
+    uint32_t candidates = manchester_decoders.byLength(msg->length);
+    uint16_t half = recoverClock(analysis);
+    if (!candidates || half == 0) {
+      return;
+    }
+
+    frame_features_t features = { msg->length, UINT16_MAX, 0 };
+    BitWriter bits(bits_.buf, sizeof(bits_.buf));
+    int pending = -1;
+    bool done = false;
+
+    for (uint16_t i = 0; i < msg->length; i++) {
+      const rmt_data_t &s = msg->buf[i];
+      features.min_pulse = MIN(features.min_pulse, s.duration0);
+      features.max_pulse = MAX(features.max_pulse, s.duration0);
+      if (done) continue;
+      uint16_t durations[2] = { (uint16_t)s.duration0, (uint16_t)s.duration1 };
+      uint8_t levels[2] = { (uint8_t)s.level0, (uint8_t)s.level1 };
+      for (int h = 0; h < 2 && !done; h++) {
+        uint32_t n = (2 * durations[h] + half) / (2 * half);
+        if (n < 1 || n > 2) {
+          if (bits.nbits) done = true;
+          pending = -1;
+          continue;
+        }
+        for (uint32_t k = 0; k < n; k++) {
+          if (pending < 0) {
+            pending = levels[h];
+          } else if (pending != levels[h]) {
+            bits.push(levels[h]);
+            pending = -1;
+          } else if (bits.nbits == 0) {
+            pending = levels[h];
+          } else {
+            done = true;
+            break;
+          }
+        }
+      }
+    }
+    bits.finish();
+    bits_.nbits = bits.nbits;
+
+    candidates = manchester_decoders.filter(candidates, features, bits_.buf, bits_.nbits);
+    manchester_decoders.dispatch(candidates, [&](ManchesterDecoder *decoder) {
+      return decoder->decode_manchester(&bits_, msg);
+    });
+  }
+
+  /**
+   * @brief Decode a Manchester bit stream.
+   *
+   * @return true if the frame was recognized by this decoder.
+   */
+  virtual bool decode_manchester(const bit_message_t *bits, rmt_message_t *rmt_msg) { return false; }
+
+private:
+  static bit_message_t bits_;
+};
+
+bit_message_t ManchesterDecoder::bits_;
+
+
+class PulseDistanceDecoder;
+
+DecoderIndex<PulseDistanceDecoder> pulse_distance_decoders;
+bool isPulseDistanceDecoderInit = false;
+
+class PulseDistanceDecoder : public DecoderBase
+{
+public:
+  /**
+   * @brief Constructor for PulseDistanceDecoder class. Adds the object to the pulse_distance_decoders index.
+   *
+   * @param name Name reported in the decoder statistics.
+   * @param signature Frames this decoder can possibly accept.
+   */
+  PulseDistanceDecoder(const char *name, const decoder_signature_t &signature = DECODER_SIGNATURE_ANY) : DecoderBase(name, signature)
+  {
+    if (!isPulseDistanceDecoderInit) {
+      pulse_distance_decoders = DecoderIndex<PulseDistanceDecoder>();
+      isPulseDistanceDecoderInit = true;
+    }
+    pulse_distance_decoders.add(this);
+  }
+
+  /**
+   * @brief Line-decode a capture as pulse-distance and call decode_pulse_distance on the matching decoders.
+   *
+   * The bit is carried by the gap after each pulse: a gap longer than the midpoint
+   * of the short and long classes is a 1. Data starts at the first symbol whose
+   * pulse and gap are both short or long; a sync or unclassified duration after
+   * that ends it.
+   *
+   * @param msg The capture.
+   * @param analysis PulseAnalyzer result for the capture.
+   */
+  static void decode(rmt_message_t *msg, const pulse_analysis_t *analysis) {
+    uint32_t candidates = pulse_distance_decoders.byLength(msg->length);
+    if (!candidates || analysis->short_us == analysis->long_us) {
+      return;
+    }
+
+    uint16_t threshold = (analysis->short_us + analysis->long_us) / 2;
+    frame_features_t features = { msg->length, UINT16_MAX, 0 };
+    BitWriter bits(bits_.buf, sizeof(bits_.buf));
+    bool done = false;
+
+    for (uint16_t i = 0; i < msg->length; i++) {
+      const rmt_data_t &s = msg->buf[i];
+      features.min_pulse = MIN(features.min_pulse, s.duration0);
+      features.max_pulse = MAX(features.max_pulse, s.duration0);
+      if (done) continue;
+      if (analysis->classes[2 * i] <= PULSE_LONG && analysis->classes[2 * i + 1] <= PULSE_LONG) {
+        bits.push(s.duration1 > threshold);
+      } else if (bits.nbits) {
+        done = true;
+      }
+    }
+    bits.finish();
+    bits_.nbits = bits.nbits;
+
+    candidates = pulse_distance_decoders.filter(candidates, features, bits_.buf, bits_.nbits);
+    pulse_distance_decoders.dispatch(candidates, [&](PulseDistanceDecoder *decoder) {
+      return decoder->decode_pulse_distance(&bits_, msg);
+    });
+  }
+
+  /**
+   * @brief Decode a pulse-distance bit stream.
+   *
+   * @return true if the frame was recognized by this decoder.
+   */
+  virtual bool decode_pulse_distance(const bit_message_t *bits, rmt_message_t *rmt_msg) { return false; }
+
+private:
+  static bit_message_t bits_;
+};
+
+bit_message_t PulseDistanceDecoder::bits_;
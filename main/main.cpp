@@ -14,12 +14,18 @@
 #include "esp_spiffs.h"
 #include "main.h"
 #include "pump.h"
+#include "pump_scheduler.h"
+#include "zones.h"
 #include "radio.h"
 #include "HCS301.h"
+#include "fixed_code.h"
 
 const char *TAG = "MAIN";
 
-HCS301* hcs301 = new HCS301(0x001C4A01);
+HCS301* hcs301 = new HCS301();
+FixedCodeDecoder<EV1527>* ev1527 = new FixedCodeDecoder<EV1527>();
+FixedCodeDecoder<PT2262>* pt2262 = new FixedCodeDecoder<PT2262>();
+FixedCodeDecoder<HS2303>* hs2303 = new FixedCodeDecoder<HS2303>();
 
 void setup_SPIFFS() {
   esp_vfs_spiffs_conf_t conf = {
@@ -77,21 +83,72 @@ extern "C" void app_main()
   }
 
   setup_SPIFFS();
+#if !WWW_BUNDLE
+  asset_cache.init();
+#endif
+
+  if (!hcs301_load_remotes()) {
+    hcs301->enroll(HCS301_SERIAL_LEGACY | 0x001C4A01);  // noted before the parser fix; migrated on its first frame
+    hcs301_save_remotes();
+  }
+  hcs301_load_counters();
+  hcs301->set_on_remotes_changed(hcs301_save_remotes);
+  hcs301->set_on_counters_changed(hcs301_save_counters);
 
   initRadio();
 
+  pump->set_on_flow([](const pump_flow_t &flow) {
+    uint8_t frame[WS_FRAME_FLOW_SIZE];
+    size_t len = ws_frame::encodeFlow(flow.time, flow.interval_ms, flow.on, flow.pulses, flow.volume_ml,
+                                      flow.flow_ml_min, flow.target_ml, frame, sizeof(frame));
+    ws_broadcast(frame, len);
+  });
+  pump_history.init();
   pump->init();
+
+  zones.set_on_status([]() {
+    uint8_t frame[WS_FRAME_ZONES_MAX_SIZE];
+    size_t len = zones.encodeStatus(frame, sizeof(frame));
+    ws_broadcast(frame, len);
+  });
+  zones.set_on_active([](uint8_t active, uint32_t remaining_ms) {
+    if (active > 0) {
+      pump->holdFor(remaining_ms + ZONES_PUMP_MARGIN_MS);
+    } else {
+      pump->stop(PUMP_STOP_ZONES);
+    }
+  });
+  // Valves left open with the pump stopped by a remote, a timer or HTTP would get no water.
+  pump->set_on_stop([](pump_stop_reason_t reason) {
+    if (reason != PUMP_STOP_ZONES) {
+      zones.stopAll();
+    }
+  });
+  zones.init();
+
+  pump_scheduler->setAction([](const pump_job_t &job) {
+    if (job.zone >= 0) {
+      uint32_t time_ms = job.liters > 0 ? zones.durationForLiters(job.zone, job.liters) : job.time_ms;
+      zones.enqueue(job.zone, time_ms);
+    } else if (job.liters > 0) {
+      pump->startByLiters(job.liters);
+    } else {
+      pump->startByTime(job.time_ms);
+    }
+  });
+  pump_scheduler->init();
   
   hcs301->set_on_buttons_press([](EventBits_t button) {
     ESP_LOGD(TAG, "HCS301: Pressed button: %d", (int)button);
     switch (button) {
       case 15:
         ESP_LOGE(TAG, "Restarting...");
+        hcs301_save_counters();  // not left to the next save, which the restart would cut off
         vTaskDelay(1000);
         ESP.restart();
         break;
       case 4:
-        pump->stop();
+        pump->stop(PUMP_STOP_REMOTE);
         break;
       case 2:
         if (pump->isOn()) {
@@ -4,6 +4,7 @@
 #include <cJSON.h>
 #include "json_config.h"
 #include "wifi.h"
+#include "rmt_message.h"
 
 #define CC1101_sck 36
 #define CC1101_miso 37
@@ -17,22 +18,6 @@
     cJSON_GetNumberValue(cJSON_GetObjectItem(jsonThing, name)) : default_val)
 
 
-typedef struct rmt_message_t
-{
-  uint16_t length;
-  unsigned long time;
-  int64_t delta;
-  int rssi;
-  rmt_data_t buf[RMT_MEM_NUM_BLOCKS_4 * RMT_SYMBOLS_PER_CHANNEL_BLOCK];
-} rmt_message_t;
-
-typedef struct pwm_message_t
-{
-  uint8_t buf[RMT_MEM_NUM_BLOCKS_4 * RMT_SYMBOLS_PER_CHANNEL_BLOCK / 8];
-  uint8_t length;
-} pwm_message_t;
-
-
 namespace bits
 {
   inline uint8_t getBit(uint8_t byte, uint8_t bitIndex)
@@ -0,0 +1,167 @@
+#pragma once
+#include "rmt_message.h"
+#include "decoders.h"
+#include <Arduino.h>
+
+#define TAG_PULSE "PULSE"
+
+#define PULSE_MAX_CLUSTERS 8
+#define PULSE_CLUSTER_TOLERANCE_PCT 25
+#define PULSE_SYNC_FACTOR 3
+
+typedef enum : uint8_t {
+  PULSE_SHORT = 0,
+  PULSE_LONG = 1,
+  PULSE_SYNC = 2,
+  PULSE_OTHER = 3,
+} pulse_class_t;
+
+struct pulse_cluster_t {
+  uint32_t sum;
+  uint16_t count;
+  uint16_t center;
+};
+
+/**
+ * @brief Timing classes found in one frame.
+ *
+ * `classes` holds one pulse_class_t per half-symbol: classes[2 * i] is the high
+ * part of symbol i, classes[2 * i + 1] the low part. `bit_period` is the mean
+ * duration of a data symbol (high + low, sync and unclassified symbols left
+ * out). Durations are in RMT ticks (us).
+ */
+struct pulse_analysis_t {
+  uint8_t n_clusters;
+  pulse_cluster_t clusters[PULSE_MAX_CLUSTERS];
+  uint16_t short_us;
+  uint16_t long_us;
+  uint16_t sync_us;
+  uint16_t bit_period;
+  uint16_t length;
+  uint8_t classes[DECODER_MAX_SYMBOLS * 2];
+};
+
+/**
+ * @brief Per-frame clustering of pulse and gap durations.
+ *
+ * This is the protocol-agnostic view of a frame: it does not assume PWM, so it
+ * also fits pulse-distance, PPM and Manchester remotes and transmitters with
+ * skewed timing.
+ */
+class PulseAnalyzer
+{
+public:
+  /**
+   * @brief Cluster the durations of a frame and classify every half-symbol.
+   *
+   * Every non-zero duration joins the first cluster whose running mean is within
+   * PULSE_CLUSTER_TOLERANCE_PCT, or opens a new one (up to PULSE_MAX_CLUSTERS;
+   * beyond that it is left unclassified). This is a single integer pass with at
+   * most PULSE_MAX_CLUSTERS compares per duration. Clusters are then sorted by
+   * duration. Clusters with too few members to be real symbols are ignored;
+   * of the rest the shortest is `short`, the next one at least 1.5x longer is
+   * `long`, and the longest one at least PULSE_SYNC_FACTOR times `long` is `sync`.
+   *
+   * @param msg The capture to analyze.
+   * @param out Result.
+   */
+  static void analyze(const rmt_message_t *msg, pulse_analysis_t *out) {
+    out->n_clusters = 0;
+    out->length = msg->length;
+    uint16_t total = 0;
+
+    for (uint16_t i = 0; i < msg->length; i++) {
+      out->classes[2 * i] = addDuration(out, msg->buf[i].duration0);
+      out->classes[2 * i + 1] = addDuration(out, msg->buf[i].duration1);
+    }
+    for (uint8_t c = 0; c < out->n_clusters; c++) {
+      total += out->clusters[c].count;
+    }
+
+    // Sort clusters by center, remembering where each one went.
+    uint8_t order[PULSE_MAX_CLUSTERS];
+    for (uint8_t c = 0; c < out->n_clusters; c++) {
+      order[c] = c;
+    }
+    for (uint8_t a = 1; a < out->n_clusters; a++) {
+      for (uint8_t b = a; b > 0 && out->clusters[order[b]].center < out->clusters[order[b - 1]].center; b--) {
+        std::swap(order[b], order[b - 1]);
+      }
+    }
+    pulse_cluster_t sorted[PULSE_MAX_CLUSTERS];
+    for (uint8_t c = 0; c < out->n_clusters; c++) {
+      sorted[c] = out->clusters[order[c]];
+    }
+    memcpy(out->clusters, sorted, sizeof(pulse_cluster_t) * out->n_clusters);
+
+    // Pick short, long and sync among the sorted clusters.
+    uint16_t min_count = MAX(2, total / 16);
+    int short_idx = -1, long_idx = -1, sync_idx = -1;
+    for (uint8_t c = 0; c < out->n_clusters; c++) {
+      if (out->clusters[c].count < min_count) continue;
+      if (short_idx < 0) {
+        short_idx = c;
+      } else if (long_idx < 0 && out->clusters[c].center * 2 >= out->clusters[short_idx].center * 3) {
+        long_idx = c;
+      }
+    }
+    if (long_idx < 0) long_idx = short_idx;
+    if (long_idx >= 0) {
+      for (int c = out->n_clusters - 1; c > long_idx; c--) {
+        if (out->clusters[c].center >= out->clusters[long_idx].center * PULSE_SYNC_FACTOR) {
+          sync_idx = c;
+          break;
+        }
+      }
+    }
+    out->short_us = short_idx >= 0 ? out->clusters[short_idx].center : 0;
+    out->long_us = long_idx >= 0 ? out->clusters[long_idx].center : 0;
+    out->sync_us = sync_idx >= 0 ? out->clusters[sync_idx].center : 0;
+
+    // Map original cluster ids to classes, then rewrite the stream in place.
+    uint8_t class_of[PULSE_MAX_CLUSTERS + 1];
+    for (uint8_t c = 0; c < out->n_clusters; c++) {
+      class_of[order[c]] = c == short_idx ? PULSE_SHORT : c == long_idx ? PULSE_LONG : c == sync_idx ? PULSE_SYNC : PULSE_OTHER;
+    }
+    class_of[PULSE_MAX_CLUSTERS] = PULSE_OTHER;
+
+    uint32_t period_sum = 0;
+    uint16_t period_count = 0;
+    for (uint16_t i = 0; i < msg->length; i++) {
+      uint8_t hi = out->classes[2 * i] = class_of[out->classes[2 * i]];
+      uint8_t lo = out->classes[2 * i + 1] = class_of[out->classes[2 * i + 1]];
+      if (hi <= PULSE_LONG && lo <= PULSE_LONG) {
+        period_sum += msg->buf[i].duration0 + msg->buf[i].duration1;
+        period_count++;
+      }
+    }
+    out->bit_period = period_count ? period_sum / period_count : 0;
+  }
+
+private:
+  /**
+   * @brief Add one duration to the cluster table.
+   *
+   * @return Index of the cluster it joined, PULSE_MAX_CLUSTERS if none.
+   */
+  static inline uint8_t addDuration(pulse_analysis_t *out, uint16_t d) {
+    if (d == 0) {
+      return PULSE_MAX_CLUSTERS;
+    }
+    for (uint8_t c = 0; c < out->n_clusters; c++) {
+      pulse_cluster_t &cl = out->clusters[c];
+      uint32_t dist = d > cl.center ? d - cl.center : cl.center - d;
+      if (dist * 100 <= (uint32_t)cl.center * PULSE_CLUSTER_TOLERANCE_PCT) {
+        cl.sum += d;
+        cl.count++;
+        cl.center = cl.sum / cl.count;
+        return c;
+      }
+    }
+    if (out->n_clusters == PULSE_MAX_CLUSTERS) {
+      return PULSE_MAX_CLUSTERS;
+    }
+    out->clusters[out->n_clusters] = { d, 1, d };
+    return out->n_clusters++;
+  }
+};
@@ -2,12 +2,32 @@
 #include <Arduino.h>
 #include <cJSON.h>
 #include "main.h"
+#include "flow_meter.h"
+#include "timer_service.h"
+#include "pump_history.h"
 
 #define TAG_PUMP "PUMP"
 
 #define PUMP_BIT_OFF BIT0
 #define PUMP_BIT_ON BIT1
-#define PUMP_BITS (PUMP_BIT_OFF | PUMP_BIT_ON)
+#define PUMP_BIT_FLOW BIT2
+#define PUMP_BITS (PUMP_BIT_OFF | PUMP_BIT_ON | PUMP_BIT_FLOW)
+
+/* While the pump runs, the flow is reported this often. */
+#define PUMP_FLOW_REPORT_MS 1000
+
+/**
+ * @brief A flow meter reading: delivered volume since the pump started and the current flow.
+ */
+struct pump_flow_t {
+  uint32_t time;         // ms since boot
+  bool on;
+  uint32_t pulses;
+  uint32_t volume_ml;
+  uint32_t flow_ml_min;  // over the interval
+  uint32_t interval_ms;  // time since the previous reading
+  uint32_t target_ml;    // 0 when not dispensing a volume
+};
 
 
 class Pump {
@@ -15,6 +35,8 @@ class Pump {
     int idle_time;
     float liters_per_minute;
     int max_off_time_ms;
+    int flow_pin;            // flow meter input, -1 for none
+    float pulses_per_liter;
   };
   
   /**
@@ -23,8 +45,12 @@ class Pump {
    * This function waits for bits in the event group to be set and then
    * performs the appropriate action based on the set bits. If the
    * PUMP_BIT_ON bit is set, the pump is turned on and a timer is started.
-   * If the PUMP_BIT_OFF bit is set, the pump is turned off and the timer
-   * is stopped.
+   * If the PUMP_BIT_OFF bit is set, or the flow meter reached its target,
+   * the pump is turned off and the timer is stopped. The flow meter is also
+   * serviced on every report wake while it has a target, as a backstop for
+   * a missed watch point event. While the pump is on,
+   * the flow is reported every PUMP_FLOW_REPORT_MS, and once more when it
+   * stops.
    *
    * @param arg A pointer to the Pump object.
    */
@@ -32,17 +58,38 @@ class Pump {
     Pump* this_ = static_cast<Pump*>(arg);
     EventBits_t uxBits;
     for(;;) {
-      uxBits = xEventGroupWaitBits(this_->eventGroup, PUMP_BITS, pdTRUE, pdFALSE, portMAX_DELAY);
+      TickType_t wait = this_->state == State::ON ? pdMS_TO_TICKS(PUMP_FLOW_REPORT_MS) : portMAX_DELAY;
+      uxBits = xEventGroupWaitBits(this_->eventGroup, PUMP_BITS, pdTRUE, pdFALSE, wait);
       if (uxBits & PUMP_BIT_ON) {
         ESP_LOGW(TAG_PUMP, "ON");
+        if (this_->state == State::ON) {
+          this_->logEnd(PUMP_STOP_RESTART);
+        }
+        this_->logBegin();
+        this_->flow_.start(this_->targetPulses_);
+        this_->flowStart();
         startTimer(this_);
         digitalWrite(this_->pin_, this_->isInverted_ ? LOW : HIGH);
         this_->state = State::ON;
-      } else if (uxBits & PUMP_BIT_OFF) {
-        ESP_LOGW(TAG_PUMP, "OFF");
+      } else if ((uxBits & PUMP_BIT_OFF) ||
+                 (((uxBits & PUMP_BIT_FLOW) || this_->flow_.target() > 0) && this_->flow_.service())) {
+        ESP_LOGW(TAG_PUMP, "OFF%s", uxBits & PUMP_BIT_OFF ? "" : ", volume reached");
         digitalWrite(this_->pin_, this_->isInverted_ ? HIGH : LOW);
         stopTimer(this_);
+        bool was_on = this_->state == State::ON;
+        pump_stop_reason_t reason = uxBits & PUMP_BIT_OFF ? this_->stopReason_ : PUMP_STOP_VOLUME;
+        if (was_on) {
+          this_->logEnd(reason);
+        }
+        this_->flow_.clearTarget();
         this_->state = State::OFF;
+        this_->flowReport();
+        if (was_on && this_->on_stop_) {
+          this_->on_stop_(reason);
+        }
+      }
+      if (this_->state == State::ON && millis() - this_->flowSampleTime_ >= PUMP_FLOW_REPORT_MS) {
+        this_->flowReport();
       }
     }
     vTaskDelete(NULL);
@@ -53,9 +100,9 @@ class Pump {
    *
    * This function starts the timer for the pump. If the offTime is 0, then
    * the function returns immediately. Otherwise, it stops the current timer
-   * (if it is running) and starts a new timer with period equal to the offTime
-   * in milliseconds. When the timer expires, it sets the PUMP_BIT_OFF bit in
-   * the event group, which triggers the pump to turn off.
+   * (if it is running) and arms the pump's timer in the shared timer_service
+   * to expire after offTime milliseconds. When the timer expires, it sets the
+   * PUMP_BIT_OFF bit in the event group, which triggers the pump to turn off.
    *
    * @param arg A pointer to the Pump object.
    */
@@ -63,70 +110,97 @@ class Pump {
     Pump *this_ = static_cast<Pump*>(arg);
     if (this_->offTime == 0)
       return;
-    stopTimer(this_);
-    this_->timer = timerBegin(1000000);
-    timerAttachInterruptArg(this_->timer, [](void* arg) {
-      EventGroupHandle_t eventGroup = static_cast<EventGroupHandle_t>(arg);
-      xEventGroupSetBits(eventGroup, PUMP_BIT_OFF);
-    }, this_->eventGroup);
-    timerAlarm(this_->timer, this_->offTime * 1000, false, 0);
+    timer_service.armMs(&this_->timer, this_->offTime);
     ESP_LOGD(TAG_PUMP, "startTimer < %d >", this_->offTime);
   }  
 
   /**
    * @brief Stops the timer for the pump.
    *
-   * This function stops the timer for the pump. If the timer is running,
-   * it is stopped and the timer handle is set to null.
-   *
    * @param arg A pointer to the Pump object.
    */
   static void stopTimer(void* arg) {
     Pump *this_ = static_cast<Pump*>(arg);
-    if (this_->timer != nullptr) {
-      timerEnd(this_->timer);
-      this_->timer = nullptr;
-    }
+    timer_service.cancel(&this_->timer);
+  }
+
+  static void onTimer(void* arg) {
+    Pump *this_ = static_cast<Pump*>(arg);
+    this_->stopReason_ = PUMP_STOP_TIMER;
+    xEventGroupSetBits(this_->eventGroup, PUMP_BIT_OFF);
   }
 
 public:
-  Pump(int pin, bool isInverted, const char* fileName = nullptr) : pin_(pin), isInverted_(isInverted), fileName_(fileName) {}
+  Pump(int pin, bool isInverted, const char* fileName = nullptr) : timer(onTimer, this), pin_(pin), isInverted_(isInverted), fileName_(fileName) {}
   enum class State {
     OFF, ON
   };
   State state = State::OFF;
   EventGroupHandle_t eventGroup;
   int offTime = 0;
-  hw_timer_t* timer = nullptr;
+  soft_timer_t timer;
 
   void init() {
     loadConfig();
     printPumpSettings();
     pinMode(pin_, OUTPUT);
     eventGroup = xEventGroupCreateStatic(&eventGroupBuffer_);
-    xTaskCreate(task, "pump_task", 1024 * 2, this, 3, NULL);
+    timer_service.init();
+    if (pump_settings_.pulses_per_liter > 0) {
+      flow_.init(pump_settings_.flow_pin, eventGroup, PUMP_BIT_FLOW);
+    }
+    // The task writes the run history to flash, encodes flow frames for on_flow_ and logs; 2 KiB is not enough.
+    xTaskCreate(task, "pump_task", 1024 * 4, this, 3, NULL);
     setState(State::OFF);
   }
   
   void start() {
     offTime = pump_settings_.max_off_time_ms;
+    targetPulses_ = 0;
     setState(State::ON);
   }
   void startByTime(int time_ms) {
     offTime = time_ms;
+    targetPulses_ = 0;
     setState(State::ON);
   }
+  /**
+   * @brief Keep the pump running for `time_ms` from now, for a run owned by a controller.
+   *
+   * Starts a timed run if the pump is off; otherwise only moves the end of
+   * the run in progress, so it is not logged as a restart. The caller calls
+   * it again whenever its need changes, e.g. the zones on every valve change,
+   * and max_off_time_ms does not apply.
+   */
+  void holdFor(uint32_t time_ms) {
+    if (state == State::ON && !(xEventGroupGetBits(eventGroup) & PUMP_BIT_OFF)) {
+      offTime = time_ms;
+      startTimer(this);
+      return;
+    }
+    startByTime(time_ms);
+  }
   /**
    * @brief Starts the pump by the given number of liters.
    *
-   * This function calculates the time in milliseconds that the pump needs to run
-   * to deliver the given number of liters based on the pump settings. The time
-   * is then set as the offTime for the pump. The function then sets the state of
+   * With a flow meter, the pump runs until the meter has counted the liters,
+   * and max_off_time_ms stays as the safety cutoff should the meter stall.
+   * Without one, this function calculates the time in milliseconds that the
+   * pump needs to run to deliver the given number of liters based on the pump
+   * settings and sets it as the offTime. The function then sets the state of
    * the pump to ON.
    *
    * @param liters The number of liters to deliver.
    */
   void startByLiters(float liters) {
+    if (flow_.available()) {
+      offTime = pump_settings_.max_off_time_ms;
+      targetPulses_ = MAX(litersToPulses(liters), 1);
+      ESP_LOGD(TAG_PUMP, "startByLiters: %f pulses: %lu", liters, (unsigned long)targetPulses_);
+      setState(State::ON);
+      return;
+    }
+    targetPulses_ = 0;
     int time_ms = liters / pump_settings_.liters_per_minute * 60000;
     offTime = time_ms;
     ESP_LOGD(TAG_PUMP, "startByLiters: %f time_ms: %d", liters, time_ms);
@@ -135,17 +209,17 @@ public:
   /**
    * @brief Adds time to the timer.
    *
-   * This function adds the given time to the timer. If the timer is not started,
-   * then a log error is printed. If the resulting offTime is negative, then the 
-   * pump is stopped.
+   * This function adds the given time to the time the timer has left. If the
+   * timer is not started, then a log error is printed. If the resulting offTime
+   * is not positive, then the pump is stopped.
    *
    * @param time_ms The time to add, in milliseconds.
    */
   void addTime(int time_ms) {
-    if (timer != nullptr) {
-      uint64_t t = timerReadMilis(timer);
-      offTime += time_ms - t;
-      if (offTime < 0) {
+    int32_t remaining = timer_service.remainingMs(&timer);
+    if (remaining >= 0) {
+      offTime = remaining + time_ms;
+      if (offTime <= 0) {
         stop();
         return;
       }
@@ -155,11 +229,20 @@ public:
     } 
   }  
   void addCapacityLiters(float liters) {
+    if (flow_.available() && flow_.target() > 0) {
+      ESP_LOGD(TAG_PUMP, "addCapacityLiters: %f", liters);
+      flow_.extend(litersToPulses(liters));
+      return;
+    }
     int time_ms = liters / pump_settings_.liters_per_minute * 60000;
     ESP_LOGD(TAG_PUMP, "addCapacityLiters: %f time_ms: %d", liters, time_ms);
     addTime(time_ms);
   }
-  void stop() {
+  /**
+   * @brief Stops the pump; `reason` goes into the run history.
+   */
+  void stop(pump_stop_reason_t reason = PUMP_STOP_MANUAL) {
+    stopReason_ = reason;
     setState(State::OFF);
   }
 
@@ -198,6 +281,7 @@ public:
     ESP_LOGD(TAG_PUMP, "Pin: %d", pin_);
     ESP_LOGD(TAG_PUMP, "settings: idle_time: %d ms; liters_per_minute: %.3f l/min", pump_settings_.idle_time, pump_settings_.liters_per_minute);
     ESP_LOGD(TAG_PUMP, "settings: max_off_time_ms: %d ms", pump_settings_.max_off_time_ms);
+    ESP_LOGD(TAG_PUMP, "settings: flow_pin: %d; pulses_per_liter: %.1f", pump_settings_.flow_pin, pump_settings_.pulses_per_liter);
   }
 
   void setPumpConfig(cJSON* json) {
@@ -208,16 +292,41 @@ public:
     cJSON_AddNumberToObject(json, "idle_time", pump_settings_.idle_time);
     cJSON_AddNumberToObject(json, "liters_per_minute", pump_settings_.liters_per_minute);
     cJSON_AddNumberToObject(json, "max_off_time_ms", pump_settings_.max_off_time_ms);
+    cJSON_AddNumberToObject(json, "flow_pin", pump_settings_.flow_pin);
+    cJSON_AddNumberToObject(json, "pulses_per_liter", pump_settings_.pulses_per_liter);
   }
 
   void deserializeSettings(cJSON* json) {
     pump_settings_.idle_time = JSON_OBJECT_NOT_NULL(json, "idle_time", pump_settings_.idle_time);
     pump_settings_.liters_per_minute = JSON_OBJECT_NOT_NULL(json, "liters_per_minute", pump_settings_.liters_per_minute);
     pump_settings_.max_off_time_ms = JSON_OBJECT_NOT_NULL(json, "max_off_time_ms", pump_settings_.max_off_time_ms);
+    pump_settings_.flow_pin = JSON_OBJECT_NOT_NULL(json, "flow_pin", pump_settings_.flow_pin);
+    pump_settings_.pulses_per_liter = JSON_OBJECT_NOT_NULL(json, "pulses_per_liter", pump_settings_.pulses_per_liter);
   }
   pump_settings_t getPumpSettings() {
     return pump_settings_;
   }
+
+  /**
+   * @brief Called with each flow reading, from the pump task.
+   */
+  void set_on_flow(std::function<void(const pump_flow_t &)> on_flow) {
+    on_flow_ = on_flow;
+  }
+
+  /**
+   * @brief Called from the pump task when a run ends, with the reason it ended.
+   */
+  void set_on_stop(std::function<void(pump_stop_reason_t)> on_stop) {
+    on_stop_ = on_stop;
+  }
+
+  /**
+   * @brief The latest flow reading.
+   */
+  pump_flow_t flow() const {
+    return flowLast_;
+  }
   int pin_;
   bool isInverted_;
   const char* fileName_;
@@ -225,7 +334,73 @@ public:
 private:
 
   StaticEventGroup_t eventGroupBuffer_;
-  pump_settings_t pump_settings_ = { 1000, 200.0f, 10*60000 };
+  pump_settings_t pump_settings_ = { 1000, 200.0f, 10*60000, -1, 450.0f };
+  FlowMeter flow_;
+  uint32_t targetPulses_ = 0;
+  volatile pump_stop_reason_t stopReason_ = PUMP_STOP_MANUAL;
+  uint32_t runStart_ = 0;
+  uint32_t flowSampleTime_ = 0;
+  uint32_t flowSamplePulses_ = 0;
+  pump_flow_t flowLast_ = {};
+  std::function<void(const pump_flow_t &)> on_flow_;
+  std::function<void(pump_stop_reason_t)> on_stop_;
+
+  uint32_t litersToPulses(float liters) const {
+    return liters > 0 ? liters * pump_settings_.pulses_per_liter + 0.5f : 0;
+  }
+
+  uint32_t pulsesToMilliliters(uint32_t pulses) const {
+    return pulses * 1000.0f / pump_settings_.pulses_per_liter + 0.5f;
+  }
+
+  void logBegin() {
+    runStart_ = millis();
+    if (targetPulses_ > 0) {
+      pump_history.begin(PUMP_RUN_VOLUME, pulsesToMilliliters(targetPulses_));
+    } else {
+      pump_history.begin(PUMP_RUN_TIME, offTime);
+    }
+  }
+
+  void logEnd(pump_stop_reason_t reason) {
+    uint32_t volume_ml = flow_.available() ? pulsesToMilliliters(flow_.pulses()) : PUMP_HISTORY_FREE;
+    pump_history.end(reason, millis() - runStart_, volume_ml);
+  }
+
+  void flowStart() {
+    flowSampleTime_ = millis();
+    flowSamplePulses_ = 0;
+  }
+
+  /**
+   * @brief Take a flow reading and hand it to the on_flow callback.
+   *
+   * The flow is the volume counted since the previous reading over the time
+   * between them, so it follows the supply pressure within one report interval.
+   */
+  void flowReport() {
+    if (!flow_.available()) {
+      return;
+    }
+    uint32_t now = millis();
+    uint32_t pulses = flow_.pulses();
+    uint32_t elapsed = now - flowSampleTime_;
+    pump_flow_t sample = {};
+    sample.time = now;
+    sample.interval_ms = elapsed;
+    sample.on = state == State::ON;
+    sample.pulses = pulses;
+    sample.volume_ml = pulsesToMilliliters(pulses);
+    sample.flow_ml_min = sample.on && elapsed > 0 ? pulsesToMilliliters(pulses - flowSamplePulses_) * 60000ull / elapsed : 0;
+    sample.target_ml = pulsesToMilliliters(flow_.target());
+    flowSampleTime_ = now;
+    flowSamplePulses_ = pulses;
+    flowLast_ = sample;
+    ESP_LOGV(TAG_PUMP, "Flow: %lu ml, %lu ml/min", (unsigned long)sample.volume_ml, (unsigned long)sample.flow_ml_min);
+    if (on_flow_) {
+      on_flow_(sample);
+    }
+  }
 };
 
 Pump* pump = new Pump(LED_BUILTIN, false, "/spiffs/pump_config.json");
@@ -0,0 +1,280 @@
+#pragma once
+#include <Arduino.h>
+#include <time.h>
+#include "esp_partition.h"
+#include "freertos/semphr.h"
+
+#define TAG_HISTORY "HISTORY"
+
+/* Data partition of the log, see partitions.csv. */
+#define PUMP_HISTORY_PARTITION "history"
+#define PUMP_HISTORY_SECTOR_SIZE 4096
+
+/* Empty flash reads as all ones. */
+#define PUMP_HISTORY_FREE 0xFFFFFFFF
+
+/* Runs per page of GET /pump/history, by default and at most. */
+#define PUMP_HISTORY_PAGE 50
+#define PUMP_HISTORY_PAGE_MAX 500
+
+enum pump_stop_reason_t : uint8_t {
+  PUMP_STOP_TIMER = 0,    // run time over, or the safety cutoff of a volume run
+  PUMP_STOP_VOLUME = 1,   // the flow meter counted the volume
+  PUMP_STOP_MANUAL = 2,
+  PUMP_STOP_REMOTE = 3,   // remote button
+  PUMP_STOP_ZONES = 4,    // the last zone closed
+  PUMP_STOP_RESTART = 5,  // started again while running
+  PUMP_STOP_REBOOT = 6,   // still running when the device restarted
+  PUMP_STOP_RUNNING = 0xFF,
+};
+
+enum pump_run_mode_t : uint8_t {
+  PUMP_RUN_TIME = 0,    // target in ms
+  PUMP_RUN_VOLUME = 1,  // target in ml
+};
+
+/**
+ * @brief One pump run, 32 bytes on flash.
+ *
+ * The first half is written when the pump starts, the second when it stops.
+ * Flash programming only clears bits, so the stop half is programmed into
+ * the still erased bytes of the same slot; a record whose stop half is
+ * still erased at boot is a run cut short by a restart.
+ */
+struct pump_run_record_t {
+  uint32_t seq;          // position in the log; PUMP_HISTORY_FREE: empty slot
+  uint32_t start;        // Unix time, 0 if the clock was not set
+  uint32_t uptime_ms;    // ms since boot at the start
+  uint32_t target;       // ms or ml, by mode; 0 for none
+  uint8_t mode;          // pump_run_mode_t
+  uint8_t reserved;
+  uint16_t crc;          // of the fields above
+  // Written at the stop:
+  uint32_t duration_ms;
+  uint32_t volume_ml;
+  uint8_t reason;        // pump_stop_reason_t
+  uint8_t reason_check;  // ~reason, to tell a torn write
+  uint16_t reserved2;
+};
+
+static_assert(sizeof(pump_run_record_t) == 32, "pump_run_record_t must stay 32 bytes");
+
+#define PUMP_HISTORY_START_SIZE offsetof(pump_run_record_t, duration_ms)
+#define PUMP_HISTORY_PER_SECTOR (PUMP_HISTORY_SECTOR_SIZE / sizeof(pump_run_record_t))
+
+/**
+ * @brief Append-only ring log of pump runs on a raw flash partition.
+ *
+ * Record `seq` always lives in slot `seq % capacity`, so finding a record
+ * is arithmetic and a page of the log is a handful of small reads. Slots are
+ * written once per pass over the partition: a sector is erased only when the
+ * log comes round to it again, taking its oldest records with it, so each
+ * sector wears once per PUMP_HISTORY_PER_SECTOR * sectors runs. At boot the
+ * head is found from the first slot of each sector and one sector scan. A
+ * partition without a single valid first slot does not hold a log and is
+ * erased.
+ */
+class PumpHistory
+{
+public:
+  bool init() {
+    partition_ = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, PUMP_HISTORY_PARTITION);
+    if (partition_ == NULL) {
+      ESP_LOGE(TAG_HISTORY, "No %s partition, run history disabled", PUMP_HISTORY_PARTITION);
+      return false;
+    }
+    mutex_ = xSemaphoreCreateMutexStatic(&mutexBuffer_);
+    sectors_ = partition_->size / PUMP_HISTORY_SECTOR_SIZE;
+    capacity_ = sectors_ * PUMP_HISTORY_PER_SECTOR;
+    findHead();
+    closeInterrupted();
+    ESP_LOGI(TAG_HISTORY, "%lu runs logged, %lu slots", (unsigned long)head_, (unsigned long)capacity_);
+    return true;
+  }
+
+  /**
+   * @brief Log the start of a run.
+   */
+  void begin(pump_run_mode_t mode, uint32_t target) {
+    if (partition_ == NULL) {
+      return;
+    }
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    uint32_t slot = head_ % capacity_;
+    if (slot % PUMP_HISTORY_PER_SECTOR == 0) {
+      esp_partition_erase_range(partition_, slot * sizeof(pump_run_record_t), PUMP_HISTORY_SECTOR_SIZE);
+    }
+    pump_run_record_t record;
+    memset(&record, 0xFF, sizeof(record));
+    uint32_t now = time(NULL);
+    record.seq = head_;
+    record.start = now >= 1700000000 ? now : 0;
+    record.uptime_ms = millis();
+    record.target = target;
+    record.mode = mode;
+    record.reserved = 0xFF;
+    record.crc = crc(record);
+    open_ = esp_partition_write(partition_, slot * sizeof(record), &record, PUMP_HISTORY_START_SIZE) == ESP_OK;
+    open_seq_ = head_++;
+    xSemaphoreGive(mutex_);
+  }
+
+  /**
+   * @brief Log the end of the run begun last.
+   */
+  void end(pump_stop_reason_t reason, uint32_t duration_ms, uint32_t volume_ml) {
+    if (partition_ == NULL) {
+      return;
+    }
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    if (open_) {
+      writeEnd(open_seq_, reason, duration_ms, volume_ml);
+      open_ = false;
+    }
+    xSemaphoreGive(mutex_);
+  }
+
+  /**
+   * @brief Read record `seq`.
+   *
+   * @return false if it was overwritten, never written or is damaged.
+   */
+  bool read(uint32_t seq, pump_run_record_t *record) {
+    if (partition_ == NULL || seq >= head_ || head_ - seq > capacity_) {
+      return false;
+    }
+    return esp_partition_read(partition_, (seq % capacity_) * sizeof(*record), record, sizeof(*record)) == ESP_OK &&
+           record->seq == seq && record->crc == crc(*record);
+  }
+
+  /**
+   * @brief Sequence number the next run gets; the newest record is head() - 1.
+   */
+  uint32_t head() const { return head_; }
+
+  /**
+   * @brief Oldest sequence number that may still be in the log.
+   */
+  uint32_t oldest() const {
+    uint32_t kept = capacity_ - PUMP_HISTORY_PER_SECTOR + head_ % PUMP_HISTORY_PER_SECTOR;
+    return head_ > kept ? head_ - kept : 0;
+  }
+
+  static const char *reasonName(uint8_t reason) {
+    switch (reason) {
+      case PUMP_STOP_TIMER: return "timer";
+      case PUMP_STOP_VOLUME: return "volume";
+      case PUMP_STOP_MANUAL: return "manual";
+      case PUMP_STOP_REMOTE: return "remote";
+      case PUMP_STOP_ZONES: return "zones";
+      case PUMP_STOP_RESTART: return "restart";
+      case PUMP_STOP_REBOOT: return "reboot";
+      case PUMP_STOP_RUNNING: return "running";
+      default: return "unknown";
+    }
+  }
+
+private:
+  const esp_partition_t *partition_ = NULL;
+  SemaphoreHandle_t mutex_ = NULL;
+  StaticSemaphore_t mutexBuffer_;
+  uint32_t sectors_ = 0;
+  uint32_t capacity_ = 0;
+  uint32_t head_ = 0;
+  bool open_ = false;
+  uint32_t open_seq_ = 0;
+
+  static uint16_t crc(const pump_run_record_t &record) {
+    // CRC-16/CCITT of the start half, without the crc itself.
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(&record);
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < offsetof(pump_run_record_t, crc); i++) {
+      crc ^= (uint16_t)p[i] << 8;
+      for (int bit = 0; bit < 8; bit++) {
+        crc = crc & 0x8000 ? crc << 1 ^ 0x1021 : crc << 1;
+      }
+    }
+    return crc;
+  }
+
+  uint32_t readSeq(uint32_t slot) {
+    uint32_t seq = PUMP_HISTORY_FREE;
+    esp_partition_read(partition_, slot * sizeof(pump_run_record_t), &seq, sizeof(seq));
+    return seq;
+  }
+
+  /**
+   * @brief Find the slot after the newest record.
+   *
+   * The sector holding the newest record is the one whose first record is the
+   * newest of all valid first records; the newest record is the last written
+   * slot in it. Sequence numbers are written before anything else, so a slot
+   * with one is taken even if the rest of it did not make it to flash. A
+   * first record that is not valid, torn by a power cut while begin() erased
+   * or wrote the sector, is passed over: the log goes on from the sector
+   * before, and the torn one is erased again when the log gets to it.
+   */
+  void findHead() {
+    uint32_t newest_sector = UINT32_MAX;
+    uint32_t newest_seq = 0;
+    bool torn = false;
+    for (uint32_t sector = 0; sector < sectors_; sector++) {
+      pump_run_record_t record;
+      uint32_t slot = sector * PUMP_HISTORY_PER_SECTOR;
+      esp_partition_read(partition_, slot * sizeof(record), &record, sizeof(record));
+      if (record.seq == PUMP_HISTORY_FREE) {
+        continue;
+      }
+      if (record.crc != crc(record) || record.seq % capacity_ != slot) {
+        torn = true;
+        continue;
+      }
+      if (newest_sector == UINT32_MAX || record.seq > newest_seq) {
+        newest_sector = sector;
+        newest_seq = record.seq;
+      }
+    }
+    if (newest_sector == UINT32_MAX) {
+      if (torn) {
+        // Not a log, e.g. the partition was used for something else before.
+        ESP_LOGW(TAG_HISTORY, "Formatting %s", PUMP_HISTORY_PARTITION);
+        esp_partition_erase_range(partition_, 0, sectors_ * PUMP_HISTORY_SECTOR_SIZE);
+      }
+      head_ = 0;
+      return;
+    }
+    if (torn) {
+      ESP_LOGW(TAG_HISTORY, "Skipped a damaged sector of %s", PUMP_HISTORY_PARTITION);
+    }
+    head_ = newest_seq + 1;
+    uint32_t first = newest_sector * PUMP_HISTORY_PER_SECTOR;
+    for (uint32_t i = 1; i < PUMP_HISTORY_PER_SECTOR && readSeq(first + i) != PUMP_HISTORY_FREE; i++) {
+      head_ = newest_seq + i + 1;
+    }
+  }
+
+  /**
+   * @brief Mark the newest run as ended by a restart if it never got its stop half.
+   */
+  void closeInterrupted() {
+    pump_run_record_t record;
+    if (head_ > 0 && read(head_ - 1, &record) && record.reason == PUMP_STOP_RUNNING &&
+        record.reason_check == PUMP_STOP_RUNNING && record.duration_ms == PUMP_HISTORY_FREE) {
+      ESP_LOGW(TAG_HISTORY, "Run %lu was cut short by a restart", (unsigned long)record.seq);
+      writeEnd(record.seq, PUMP_STOP_REBOOT, PUMP_HISTORY_FREE, PUMP_HISTORY_FREE);
+    }
+  }
+
+  void writeEnd(uint32_t seq, pump_stop_reason_t reason, uint32_t duration_ms, uint32_t volume_ml) {
+    pump_run_record_t record;
+    record.duration_ms = duration_ms;
+    record.volume_ml = volume_ml;
+    record.reason = reason;
+    record.reason_check = ~reason;
+    record.reserved2 = 0xFFFF;
+    esp_partition_write(partition_, (seq % capacity_) * sizeof(record) + PUMP_HISTORY_START_SIZE,
+                        &record.duration_ms, sizeof(record) - PUMP_HISTORY_START_SIZE);
+  }
+};
+
+PumpHistory pump_history;
@@ -0,0 +1,410 @@
+#pragma once
+#include <Arduino.h>
+#include <cJSON.h>
+#include <time.h>
+#include "freertos/semphr.h"
+#include "json_config.h"
+
+#define TAG_SCHEDULER "SCHEDULER"
+
+/*
+ * Jobs at once. The limit is the job file, not the heap: save() builds the
+ * whole cJSON tree, about half a KiB per job, which is as much as the S2
+ * without PSRAM can spare at 128.
+ */
+#ifndef PUMP_SCHEDULER_MAX_JOBS
+#define PUMP_SCHEDULER_MAX_JOBS 128
+#endif
+
+/* A run is still made this late, e.g. after a reboot; later runs are skipped. */
+#define PUMP_SCHEDULER_GRACE_S 60
+/* The task re-reads the clock at least this often, so SNTP corrections are picked up. */
+#define PUMP_SCHEDULER_MAX_WAIT_MS 60000
+/* Unix times before this mean the clock has not been set yet. */
+#define PUMP_SCHEDULER_VALID_TIME 1700000000
+
+#define PUMP_JOB_NAME_SIZE 24
+
+/**
+ * @brief A watering job: run the pump at `start`, then every `period_s` seconds.
+ *
+ * The pump runs for `time_ms`, or delivers `liters` when that is set. Times are
+ * Unix times in seconds, UTC; a daily job is a start time and a period of 86400.
+ * With a `zone`, the run is queued on the zone controller instead.
+ */
+struct pump_job_t {
+  char name[PUMP_JOB_NAME_SIZE];
+  uint32_t start;
+  uint32_t period_s;  // 0: run once, then the job is deleted
+  uint32_t time_ms;
+  float liters;
+  bool enabled;
+  int8_t zone;        // zone to run, -1 for the pump alone
+  uint32_t next;      // next run, maintained by the scheduler
+};
+
+/**
+ * @brief Runs pump jobs at their times, on the device clock, without the network.
+ *
+ * Enabled jobs sit in a binary min-heap on their next run time, so the task
+ * looks at the top only and each run costs O(log n) to reschedule however
+ * many jobs there are. `pos_` tracks where each job is in the heap, so editing
+ * or deleting one by id is O(log n) too. The id of a job is its slot.
+ *
+ * The jobs are kept in a JSON file and reloaded at boot. A recurring job is
+ * then due at its latest run, not at `start`, so a run up to
+ * PUMP_SCHEDULER_GRACE_S before the reboot is still made. Runs missed by more
+ * than that (the device was off, or the clock jumped) are skipped, not made
+ * up for. Nothing runs until the clock is set by SNTP.
+ */
+class PumpScheduler
+{
+public:
+  PumpScheduler(const char *fileName) : fileName_(fileName) {}
+
+  /**
+   * @brief Set what a job does when it runs. Called from the scheduler task.
+   */
+  void setAction(std::function<void(const pump_job_t &)> action) {
+    action_ = action;
+  }
+
+  /**
+   * @brief Load the jobs and start the scheduler task.
+   */
+  bool init() {
+    mutex_ = xSemaphoreCreateMutexStatic(&mutexBuffer_);
+    load();
+    return xTaskCreate(task, "pump_scheduler", 1024 * 4, this, 2, &task_) == pdPASS;
+  }
+
+  /**
+   * @brief Add a job.
+   *
+   * @return Its id, -1 if there are PUMP_SCHEDULER_MAX_JOBS jobs already.
+   */
+  int add(const pump_job_t &job) {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    int id = -1;
+    for (size_t i = 0; i < PUMP_SCHEDULER_MAX_JOBS; i++) {
+      if (!used_[i]) {
+        id = i;
+        used_[i] = true;
+        set(id, job);
+        save();
+        break;
+      }
+    }
+    xSemaphoreGive(mutex_);
+    wake();
+    return id;
+  }
+
+  bool update(int id, const pump_job_t &job) {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    bool ok = valid(id);
+    if (ok) {
+      unschedule(id);
+      set(id, job);
+      save();
+    }
+    xSemaphoreGive(mutex_);
+    wake();
+    return ok;
+  }
+
+  bool remove(int id) {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    bool ok = valid(id);
+    if (ok) {
+      unschedule(id);
+      used_[id] = false;
+      save();
+    }
+    xSemaphoreGive(mutex_);
+    return ok;
+  }
+
+  /**
+   * @brief Get a job, e.g. to edit some of its members.
+   */
+  bool get(int id, pump_job_t *job) {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    bool ok = valid(id);
+    if (ok) {
+      *job = jobs_[id];
+    }
+    xSemaphoreGive(mutex_);
+    return ok;
+  }
+
+  /**
+   * @brief Write the clock and all jobs, with their ids and next run times, to `json`.
+   */
+  void serialize(cJSON *json) {
+    uint32_t now = time(NULL);
+    cJSON_AddNumberToObject(json, "now", now);
+    cJSON_AddBoolToObject(json, "clock_valid", now >= PUMP_SCHEDULER_VALID_TIME);
+    cJSON *jobs = cJSON_AddArrayToObject(json, "jobs");
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    for (size_t i = 0; i < PUMP_SCHEDULER_MAX_JOBS; i++) {
+      if (used_[i]) {
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "id", i);
+        serializeJob(item, jobs_[i]);
+        if (pos_[i] != NOT_SCHEDULED) {
+          cJSON_AddNumberToObject(item, "next", jobs_[i].next);
+        }
+        cJSON_AddItemToArray(jobs, item);
+      }
+    }
+    xSemaphoreGive(mutex_);
+  }
+
+  static void serializeJob(cJSON *json, const pump_job_t &job) {
+    cJSON_AddStringToObject(json, "name", job.name);
+    cJSON_AddNumberToObject(json, "start", job.start);
+    cJSON_AddNumberToObject(json, "period_s", job.period_s);
+    if (job.liters > 0) {
+      cJSON_AddNumberToObject(json, "liters", job.liters);
+    } else {
+      cJSON_AddNumberToObject(json, "time_ms", job.time_ms);
+    }
+    cJSON_AddBoolToObject(json, "enabled", job.enabled);
+    if (job.zone >= 0) {
+      cJSON_AddNumberToObject(json, "zone", job.zone);
+    }
+  }
+
+  /**
+   * @brief Read the members of a job present in `json` into `job`.
+   *
+   * @return false if the job has no start time or nothing to do.
+   */
+  static bool deserializeJob(const cJSON *json, pump_job_t *job) {
+    const char *name = cJSON_GetStringValue(cJSON_GetObjectItem(json, "name"));
+    if (name) {
+      strlcpy(job->name, name, sizeof(job->name));
+    }
+    job->start = JSON_OBJECT_NOT_NULL(json, "start", job->start);
+    job->period_s = JSON_OBJECT_NOT_NULL(json, "period_s", job->period_s);
+    if (cJSON_GetObjectItem(json, "liters")) {
+      job->liters = cJSON_GetNumberValue(cJSON_GetObjectItem(json, "liters"));
+      job->time_ms = 0;
+    } else if (cJSON_GetObjectItem(json, "time_ms")) {
+      job->time_ms = cJSON_GetNumberValue(cJSON_GetObjectItem(json, "time_ms"));
+      job->liters = 0;
+    }
+    job->zone = JSON_OBJECT_NOT_NULL(json, "zone", job->zone);
+    const cJSON *enabled = cJSON_GetObjectItem(json, "enabled");
+    if (cJSON_IsBool(enabled)) {
+      job->enabled = cJSON_IsTrue(enabled);
+    }
+    return job->start > 0 && (job->liters > 0 || job->time_ms > 0);
+  }
+
+private:
+  static constexpr uint16_t NOT_SCHEDULED = UINT16_MAX;
+
+  const char *fileName_;
+  std::function<void(const pump_job_t &)> action_;
+  SemaphoreHandle_t mutex_ = NULL;
+  StaticSemaphore_t mutexBuffer_;
+  TaskHandle_t task_ = NULL;
+  pump_job_t jobs_[PUMP_SCHEDULER_MAX_JOBS];
+  bool used_[PUMP_SCHEDULER_MAX_JOBS] = {};
+  uint16_t heap_[PUMP_SCHEDULER_MAX_JOBS];  // job ids, earliest next run first
+  uint16_t pos_[PUMP_SCHEDULER_MAX_JOBS];   // heap position of each job, NOT_SCHEDULED if none
+  uint16_t heapSize_ = 0;
+
+  /**
+   * @brief Scheduler task: run the jobs at the top of the heap, then sleep until the next one.
+   *
+   * Woken early by add() and update(), which can put an earlier job on top.
+   */
+  static void task(void *arg) {
+    PumpScheduler *this_ = static_cast<PumpScheduler *>(arg);
+    for (;;) {
+      xSemaphoreTake(this_->mutex_, portMAX_DELAY);
+      uint32_t wait_ms = this_->runDue(time(NULL));
+      xSemaphoreGive(this_->mutex_);
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait_ms));
+    }
+    vTaskDelete(NULL);
+  }
+
+  void wake() {
+    if (task_) {
+      xTaskNotifyGive(task_);
+    }
+  }
+
+  /**
+   * @brief Run and reschedule the jobs due at `now`.
+   *
+   * @return How long the task can sleep.
+   */
+  uint32_t runDue(uint32_t now) {
+    if (now < PUMP_SCHEDULER_VALID_TIME) {
+      return PUMP_SCHEDULER_MAX_WAIT_MS;
+    }
+    bool changed = false;
+    while (heapSize_ > 0 && jobs_[heap_[0]].next <= now) {
+      uint16_t id = heap_[0];
+      pump_job_t &job = jobs_[id];
+      job.next = latestRun(job, now);  // loaded before the clock was set: still at `start`
+      if (now - job.next <= PUMP_SCHEDULER_GRACE_S) {
+        ESP_LOGI(TAG_SCHEDULER, "Running job %d \"%s\"", id, job.name);
+        if (action_) {
+          action_(job);
+        }
+      } else {
+        ESP_LOGW(TAG_SCHEDULER, "Skipping job %d \"%s\", %lu s late", id, job.name, (unsigned long)(now - job.next));
+      }
+      if (job.period_s == 0) {
+        unschedule(id);
+        used_[id] = false;
+        changed = true;
+      } else {
+        // Next run after now, skipping any missed ones.
+        job.next += ((now - job.next) / job.period_s + 1) * job.period_s;
+        siftDown(0);
+      }
+    }
+    if (changed) {
+      save();
+    }
+    if (heapSize_ == 0) {
+      return PUMP_SCHEDULER_MAX_WAIT_MS;
+    }
+    return MIN((uint64_t)(jobs_[heap_[0]].next - now) * 1000, (uint64_t)PUMP_SCHEDULER_MAX_WAIT_MS);
+  }
+
+  bool valid(int id) const {
+    return id >= 0 && id < PUMP_SCHEDULER_MAX_JOBS && used_[id];
+  }
+
+  /**
+   * @brief The latest run of `job` at or before `now`; `job.next` if that is later.
+   */
+  static uint32_t latestRun(const pump_job_t &job, uint32_t now) {
+    if (job.period_s == 0 || job.next >= now) {
+      return job.next;
+    }
+    return job.next + (now - job.next) / job.period_s * job.period_s;
+  }
+
+  /* Store a job and schedule it if enabled. */
+  void set(uint16_t id, const pump_job_t &job) {
+    jobs_[id] = job;
+    jobs_[id].next = job.start;
+    uint32_t now = time(NULL);
+    if (now >= PUMP_SCHEDULER_VALID_TIME) {
+      jobs_[id].next = latestRun(jobs_[id], now);
+    }
+    pos_[id] = NOT_SCHEDULED;
+    if (job.enabled) {
+      heap_[heapSize_] = id;
+      pos_[id] = heapSize_;
+      heapSize_++;
+      siftUp(heapSize_ - 1);
+    }
+  }
+
+  void unschedule(uint16_t id) {
+    uint16_t i = pos_[id];
+    if (i == NOT_SCHEDULED) {
+      return;
+    }
+    pos_[id] = NOT_SCHEDULED;
+    heapSize_--;
+    if (i == heapSize_) {
+      return;
+    }
+    // Fill the hole with the last entry, which may belong above or below it.
+    uint16_t moved = heap_[heapSize_];
+    place(i, moved);
+    siftUp(i);
+    siftDown(pos_[moved]);
+  }
+
+  void place(uint16_t i, uint16_t id) {
+    heap_[i] = id;
+    pos_[id] = i;
+  }
+
+  bool before(uint16_t a, uint16_t b) const {
+    return jobs_[heap_[a]].next < jobs_[heap_[b]].next;
+  }
+
+  void siftUp(uint16_t i) {
+    while (i > 0 && before(i, (i - 1) / 2)) {
+      uint16_t parent = (i - 1) / 2;
+      uint16_t id = heap_[i];
+      place(i, heap_[parent]);
+      place(parent, id);
+      i = parent;
+    }
+  }
+
+  void siftDown(uint16_t i) {
+    for (;;) {
+      uint16_t smallest = i;
+      uint16_t left = 2 * i + 1;
+      uint16_t right = left + 1;
+      if (left < heapSize_ && before(left, smallest)) {
+        smallest = left;
+      }
+      if (right < heapSize_ && before(right, smallest)) {
+        smallest = right;
+      }
+      if (smallest == i) {
+        return;
+      }
+      uint16_t id = heap_[i];
+      place(i, heap_[smallest]);
+      place(smallest, id);
+      i = smallest;
+    }
+  }
+
+  void load() {
+    cJSON *json = nullptr;
+    if (!JsonConfig::load(fileName_, &json)) {
+      ESP_LOGI(TAG_SCHEDULER, "No jobs");
+      return;
+    }
+    const cJSON *jobs = cJSON_GetObjectItem(json, "jobs");
+    int count = cJSON_GetArraySize(jobs);
+    for (int i = 0; i < count; i++) {
+      const cJSON *item = cJSON_GetArrayItem(jobs, i);
+      int id = JSON_OBJECT_NOT_NULL(item, "id", -1);
+      pump_job_t job = {};
+      job.enabled = true;
+      job.zone = -1;
+      if (id >= 0 && id < PUMP_SCHEDULER_MAX_JOBS && !used_[id] && deserializeJob(item, &job)) {
+        used_[id] = true;
+        set(id, job);
+      }
+    }
+    cJSON_Delete(json);
+    ESP_LOGI(TAG_SCHEDULER, "Loaded %d jobs, %d enabled", count, heapSize_);
+  }
+
+  void save() {
+    cJSON *json = cJSON_CreateObject();
+    cJSON *jobs = cJSON_AddArrayToObject(json, "jobs");
+    for (size_t i = 0; i < PUMP_SCHEDULER_MAX_JOBS; i++) {
+      if (used_[i]) {
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "id", i);
+        serializeJob(item, jobs_[i]);
+        cJSON_AddItemToArray(jobs, item);
+      }
+    }
+    JsonConfig::save(fileName_, json);
+    cJSON_Delete(json);
+  }
+};
+
+PumpScheduler* pump_scheduler = new PumpScheduler("/spiffs/pump_jobs.json");
@@ -5,15 +5,25 @@
 
 #include "http_server.h"
 
-#include "decoders.h"
+#include "capture_pipeline.h"
+#include "capture_recorder.h"
+#include "HCS301.h"
+#include "nvs.h"
 #include <stddef.h>
 
 
 
 #define TAG_RADIO "RADIO"
-QueueHandle_t rmt_parse_queue;
+#define HCS301_REMOTES_PATH "/spiffs/hcs301_remotes.json"
+#define HCS301_LEARN_TIMEOUT_MS 30000
+/* NVS namespace and key of the sync counters; NVS spreads the frequent writes, SPIFFS would not. */
+#define HCS301_NVS_NAMESPACE "hcs301"
+#define HCS301_NVS_COUNTERS "counters"
+
 QueueHandle_t receive_queue;
 
+extern HCS301 *hcs301;
+
 bool setup_CC1101()
 {
 
@@ -31,35 +41,94 @@ bool setup_CC1101()
   return true;
 }
 
-static void rmt_parse_task(void *pvParameters) {
-  rmt_message_t msg;
-  while (1)
-  {
-    if (xQueueReceive(rmt_parse_queue, &msg, portMAX_DELAY) == pdTRUE) {
-      PWMDecoder::decode(&msg);
-      if (msg.length < 2) continue;
-      uint8_t *bytePtr = (uint8_t*)&msg;
-      ws_broadcast(bytePtr, sizeof(msg));
-    }
-  }
-  vTaskDelete(NULL);
+/**
+ * @brief State shared between rmt_recive_task and the RX done ISR.
+ *
+ * The channel always receives straight into a capture_pool slot. `armed` is the
+ * slot the channel currently owns; it is nullptr only while the channel is idle
+ * because the pool ran dry, which is counted as a re-arm gap.
+ */
+struct rmt_rx_context_t {
+  rmt_channel_handle_t channel;
+  rmt_receive_config_t config;
+  QueueHandle_t queue;
+  rmt_message_t *volatile armed;
+  int64_t idle_since;
+  uint32_t frames;
+  uint32_t rearm_gaps;
+  uint32_t queue_overflows;
+  int64_t rearm_gap_us;
+};
+
+/**
+ * @brief A finished receive, as handed from the ISR to rmt_recive_task.
+ */
+struct rmt_rx_event_t {
+  rmt_message_t *slot;
+  size_t num_symbols;
+  int64_t time_us;
+};
+
+static rmt_rx_context_t rmt_rx_ctx = {};
+static portMUX_TYPE rmt_rx_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * @brief Hand a fresh pool slot to the RMT channel.
+ *
+ * @param ctx The receive context.
+ * @param slot A slot from capture_pool.
+ */
+static inline void rmt_rx_arm(rmt_rx_context_t *ctx, rmt_message_t *slot)
+{
+  ctx->armed = slot;
+  rmt_receive(ctx->channel, slot->buf, sizeof(slot->buf), &ctx->config);
 }
 
 /**
  * @brief This function is a callback for the RMT driver which is invoked when a RX is done.
- * Also, it sends the received data to the rmt_parse_task for decoding.
+ *
+ * Before anything else it re-arms the channel with a fresh slot from capture_pool,
+ * so a transmission that starts right after this one (remotes repeat back to back)
+ * is not lost while the task is still processing. The finished slot is then sent
+ * to rmt_recive_task. If no slot is free the channel stays idle and the gap is
+ * counted; rmt_recive_task re-arms it as soon as a slot is released.
+ *
+ * Requires CONFIG_RMT_RECV_FUNC_IN_IRAM so rmt_receive() may be called from the ISR.
  *
  * @param channel The RMT channel which has received the data.
  * @param edata Pointer to the RX done event data.
- * @param user_data Pointer to a `QueueHandle_t` which is the queue to send the data to.
+ * @param user_data Pointer to the `rmt_rx_context_t` of the channel.
  *
  * @return `true` if a higher priority task was woken by this function, `false` otherwise.
  */
 static bool rmt_rx_done_callback(rmt_channel_handle_t channel, const rmt_rx_done_event_data_t *edata, void *user_data)
 {
     BaseType_t high_task_wakeup = pdFALSE;
-    QueueHandle_t receive_queue = (QueueHandle_t)user_data;
-    xQueueSendFromISR(receive_queue, edata, &high_task_wakeup);
+    rmt_rx_context_t *ctx = (rmt_rx_context_t *)user_data;
+    int64_t now = esp_timer_get_time();
+
+    rmt_rx_event_t event = {
+      .slot = ctx->armed,
+      .num_symbols = edata->num_symbols,
+      .time_us = now,
+    };
+    rmt_message_t *next = capture_pool.acquireFromISR(&high_task_wakeup);
+    if (next != nullptr) {
+      rmt_rx_arm(ctx, next);
+    } else {
+      ctx->armed = nullptr;
+      taskENTER_CRITICAL_ISR(&rmt_rx_lock);
+      ctx->idle_since = now;
+      ctx->rearm_gaps++;
+      taskEXIT_CRITICAL_ISR(&rmt_rx_lock);
+    }
+
+    if (xQueueSendFromISR(ctx->queue, &event, &high_task_wakeup) != pdTRUE) {
+      capture_pool.releaseFromISR(event.slot, &high_task_wakeup);
+      taskENTER_CRITICAL_ISR(&rmt_rx_lock);
+      ctx->queue_overflows++;
+      taskEXIT_CRITICAL_ISR(&rmt_rx_lock);
+    }
     return high_task_wakeup == pdTRUE;
 }
 
@@ -70,21 +139,23 @@ static bool rmt_rx_done_callback(rmt_channel_handle_t channel, const rmt_rx_done
  * @param pvParameters unused
  *
  * This function creates an RMT RX channel and registers an on_recv_done callback
- * that passes received symbols to the rmt_parse_task for decoding. The timing
- * range is set to meet the NEC protocol specification. 
+ * that re-arms the channel and passes the filled capture_pool slot to this task.
+ * The timing range is set to meet the NEC protocol specification. 
  *
  * The function runs in an infinite loop, waiting for RMT symbols to be received.
  * Once symbols are received, it checks if the number of symbols is less than or
- * equal to 3. If so, it discards the symbols and continues to wait for more. If
- * the number of symbols is greater than 3, it creates a message with the RSSI,
- * the length of the symbols, the time the symbols were received, and the time
- * difference between the start of reception and the current time. It then sends
- * the message to the rmt_parse_task for decoding.
+ * equal to 3. If so, it releases the slot and continues to wait for more. If
+ * the number of symbols is greater than 3, it reads the RSSI and hands the slot
+ * to capture_submit(), which queues it for rmt_parse_task.
+ *
+ * While the channel is idle because the pool was exhausted, the task polls the
+ * pool and re-arms the channel as soon as a slot is free.
  *
  * This function should be run in a task with a high priority to ensure that
  * received symbols are processed as quickly as possible.
  */
 static void rmt_recive_task(void *pvParameters) {
+  rmt_rx_context_t *ctx = &rmt_rx_ctx;
   ESP_LOGD(TAG_RADIO, "create RMT RX channel");
   rmt_rx_channel_config_t rx_channel_cfg = {
       .gpio_num = (gpio_num_t)CC1101_gdo2,
@@ -92,58 +163,274 @@ static void rmt_recive_task(void *pvParameters) {
       .resolution_hz = 1000000,
       .mem_block_symbols = 256, // amount of RMT symbols that the channel can store at a time
   };
-  rmt_channel_handle_t rx_channel = NULL;
-  ESP_ERROR_CHECK(rmt_new_rx_channel(&rx_channel_cfg, &rx_channel));
+  ESP_ERROR_CHECK(rmt_new_rx_channel(&rx_channel_cfg, &ctx->channel));
 
   ESP_LOGD(TAG_RADIO, "register RX done callback");
-  QueueHandle_t receive_queue = xQueueCreate(3, sizeof(rmt_rx_done_event_data_t));
-  assert(receive_queue);
+  ctx->queue = xQueueCreate(CAPTURE_POOL_SIZE, sizeof(rmt_rx_event_t));
+  assert(ctx->queue);
 
   rmt_rx_event_callbacks_t cbs = {
       .on_recv_done = rmt_rx_done_callback,
   };
-  ESP_ERROR_CHECK(rmt_rx_register_event_callbacks(rx_channel, &cbs, receive_queue));
+  ESP_ERROR_CHECK(rmt_rx_register_event_callbacks(ctx->channel, &cbs, ctx));
 
   // the following timing requirement is based on NEC protocol
-  rmt_receive_config_t receive_config = {
+  ctx->config = {
       .signal_range_min_ns = 1250,     // the shortest duration for NEC signal is 560us, 1250ns < 560us, valid signal won't be treated as noise
       .signal_range_max_ns = 12000000, // the longest duration for NEC signal is 9000us, 12000000ns > 9000us, the receive won't stop early
   };
-  ESP_ERROR_CHECK(rmt_enable(rx_channel));
-  rmt_symbol_word_t raw_symbols[256];
-  ESP_ERROR_CHECK(rmt_receive(rx_channel, raw_symbols, sizeof(raw_symbols), &receive_config));
-  rmt_rx_done_event_data_t rx_data;
+  ESP_ERROR_CHECK(rmt_enable(ctx->channel));
+  rmt_message_t *first = capture_pool.acquire();
+  assert(first);
+  rmt_rx_arm(ctx, first);
 
-  int64_t time_start = 0;
-  int64_t delta = 0;
-  rmt_message_t message;
+  rmt_rx_event_t event;
 
   while (1) {
-    time_start = esp_timer_get_time() - delta;
+    TickType_t wait = ctx->armed == nullptr ? 5 / portTICK_PERIOD_MS : portMAX_DELAY;
+    BaseType_t received = xQueueReceive(ctx->queue, &event, wait);
 
-    if (xQueueReceive(receive_queue, &rx_data, portMAX_DELAY) == pdPASS) {
-
-      int64_t now = esp_timer_get_time();
-      delta = now - time_start;
-      
-      if (rx_data.num_symbols <= 3)
-      {
-        ESP_ERROR_CHECK(rmt_receive(rx_channel, raw_symbols, sizeof(raw_symbols), &receive_config));
-        continue;
+    if (ctx->armed == nullptr) {
+      rmt_message_t *slot = capture_pool.acquire();
+      if (slot != nullptr) {
+        int64_t gap = esp_timer_get_time() - ctx->idle_since;
+        rmt_rx_arm(ctx, slot);
+        taskENTER_CRITICAL(&rmt_rx_lock);
+        ctx->rearm_gap_us += gap;
+        taskEXIT_CRITICAL(&rmt_rx_lock);
       }
+    }
+
+    if (received != pdPASS) {
+      continue;
+    }
+    rmt_message_t *message = event.slot;
+    taskENTER_CRITICAL(&rmt_rx_lock);
+    ctx->frames++;
+    taskEXIT_CRITICAL(&rmt_rx_lock);
+
+    if (event.num_symbols <= 3)
+    {
+      capture_pool.release(message);
+      continue;
+    }
+
+    capture_submit(message, event.num_symbols, event.time_us, ELECHOUSE_cc1101.getRssi());
+  }
+}
+
+/**
+ * @brief HTTP GET handler for /radio/stats. Reports capture pool, RX, analyzer and decoder counters.
+ */
+static esp_err_t radio_stats_get_handler(httpd_req_t *req)
+{
+  cJSON *json = cJSON_CreateObject();
+  capture_pipeline_serialize_stats(json);
+  cJSON *rx = cJSON_AddObjectToObject(json, "rx");
+  taskENTER_CRITICAL(&rmt_rx_lock);
+  uint32_t frames = rmt_rx_ctx.frames;
+  uint32_t rearm_gaps = rmt_rx_ctx.rearm_gaps;
+  uint32_t queue_overflows = rmt_rx_ctx.queue_overflows;
+  int64_t rearm_gap_us = rmt_rx_ctx.rearm_gap_us;
+  taskEXIT_CRITICAL(&rmt_rx_lock);
+  cJSON_AddNumberToObject(rx, "frames", frames);
+  cJSON_AddNumberToObject(rx, "rearm_gaps", rearm_gaps);
+  cJSON_AddNumberToObject(rx, "rearm_gap_us", rearm_gap_us);
+  cJSON_AddNumberToObject(rx, "queue_overflows", queue_overflows);
+  capture_recorder.serializeStatus(cJSON_AddObjectToObject(json, "recorder"));
+  hcs301->serializeKeeloqStats(cJSON_AddObjectToObject(json, "hcs301"));
+  char *str = cJSON_PrintUnformatted(json);
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_sendstr(req, str);
+  cJSON_free(str);
+  cJSON_Delete(json);
+  return ESP_OK;
+}
+
+/**
+ * @brief HTTP GET handler for /radio/capture. Downloads the capture recording.
+ *
+ * Refused with 409 while a recording is in progress, as the file is still open.
+ */
+static esp_err_t radio_capture_get_handler(httpd_req_t *req)
+{
+  if (capture_recorder.isRecording()) {
+    httpd_resp_set_status(req, "409 Conflict");
+    return httpd_resp_sendstr(req, "Recording in progress");
+  }
+  httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"capture.pvc\"");
+  if (send_file(req, CAPTURE_RECORD_PATH) != ESP_OK) {
+    return httpd_resp_send_404(req);
+  }
+  return ESP_OK;
+}
+
+/**
+ * @brief HTTP POST handler for /radio/capture. Starts or stops the capture recorder.
+ *
+ * Body: `{"record": true, "max_bytes": 131072, "append": false}`; only `record`
+ * is required. Responds with the recorder status.
+ */
+static esp_err_t radio_capture_post_handler(httpd_req_t *req)
+{
+  cJSON *json = nullptr;
+  if (httpd_get_JSON(req, &json) != ESP_OK || json == nullptr) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Expected JSON");
+    return ESP_FAIL;
+  }
+  bool ok = true;
+  if (cJSON_IsTrue(cJSON_GetObjectItem(json, "record"))) {
+    size_t max_bytes = JSON_OBJECT_NOT_NULL(json, "max_bytes", CAPTURE_RECORD_MAX_BYTES);
+    ok = capture_recorder.start(max_bytes, cJSON_IsTrue(cJSON_GetObjectItem(json, "append")));
+  } else {
+    capture_recorder.stop();
+  }
+  cJSON_Delete(json);
+  if (!ok) {
+    httpd_resp_send_500(req);
+    return ESP_FAIL;
+  }
+  cJSON *status = cJSON_CreateObject();
+  capture_recorder.serializeStatus(status);
+  char *str = cJSON_PrintUnformatted(status);
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_sendstr(req, str);
+  cJSON_free(str);
+  cJSON_Delete(status);
+  return ESP_OK;
+}
+
+/**
+ * @brief Load the learned HCS301 remotes from HCS301_REMOTES_PATH.
+ *
+ * @return false if there is no such file yet.
+ */
+static bool hcs301_load_remotes()
+{
+  cJSON *json = nullptr;
+  if (!JsonConfig::load(HCS301_REMOTES_PATH, &json)) {
+    return false;
+  }
+  hcs301->deserializeRemotes(json);
+  cJSON_Delete(json);
+  return true;
+}
+
+static void hcs301_save_remotes()
+{
+  cJSON *json = cJSON_CreateObject();
+  hcs301->serializeRemotes(json);
+  if (!JsonConfig::save(HCS301_REMOTES_PATH, json)) {
+    ESP_LOGE(TAG_RADIO, "Failed to save %s", HCS301_REMOTES_PATH);
+  }
+  cJSON_Delete(json);
+}
 
-      message.rssi = ELECHOUSE_cc1101.getRssi();
-      message.length = rx_data.num_symbols;
-      message.time = millis();
-      message.delta = delta;
-      memcpy(message.buf, rx_data.received_symbols, rx_data.num_symbols * 4);
-      ESP_LOGD(TAG_RADIO, "Got %d symbols, RSSI: %d, delta: %lld", message.length, message.rssi, delta);
+/**
+ * @brief Give the learned HCS301 remotes their sync counters saved in NVS before the reboot.
+ */
+static void hcs301_load_counters()
+{
+  nvs_handle_t nvs;
+  if (nvs_open(HCS301_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+    return;  // nothing saved yet
+  }
+  hcs301_counter_t counters[HCS301_MAX_REMOTES];
+  size_t size = sizeof(counters);
+  if (nvs_get_blob(nvs, HCS301_NVS_COUNTERS, counters, &size) == ESP_OK) {
+    hcs301->restoreCounters(counters, size / sizeof(counters[0]));
+    ESP_LOGI(TAG_RADIO, "Restored %u HCS301 counters", (unsigned)(size / sizeof(counters[0])));
+  }
+  nvs_close(nvs);
+}
 
-      xQueueSend(rmt_parse_queue, &message, 0);
-      delta = 0;
-      ESP_ERROR_CHECK(rmt_receive(rx_channel, raw_symbols, sizeof(raw_symbols), &receive_config));
+static void hcs301_save_counters()
+{
+  hcs301_counter_t counters[HCS301_MAX_REMOTES];
+  size_t count = hcs301->counters(counters);
+  nvs_handle_t nvs;
+  esp_err_t err = nvs_open(HCS301_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+  if (err == ESP_OK) {
+    err = nvs_set_blob(nvs, HCS301_NVS_COUNTERS, counters, count * sizeof(counters[0]));
+    if (err == ESP_OK) {
+      err = nvs_commit(nvs);
     }
+    nvs_close(nvs);
+  }
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG_RADIO, "Failed to save the HCS301 counters: %s", esp_err_to_name(err));
+  }
+}
+
+static esp_err_t radio_remotes_send(httpd_req_t *req)
+{
+  cJSON *json = cJSON_CreateObject();
+  hcs301->serializeRemotes(json, true);
+  char *str = cJSON_PrintUnformatted(json);
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_sendstr(req, str);
+  cJSON_free(str);
+  cJSON_Delete(json);
+  return ESP_OK;
+}
+
+/**
+ * @brief HTTP GET handler for /radio/remotes. Lists the learned HCS301 remotes and the learning mode.
+ */
+static esp_err_t radio_remotes_get_handler(httpd_req_t *req)
+{
+  return radio_remotes_send(req);
+}
+
+/**
+ * @brief HTTP POST handler for /radio/remotes. Learns, edits and removes HCS301 remotes.
+ *
+ * Body, one of:
+ * - `{"learn": true, "timeout_ms": 30000}`: enroll the next remote heard; `false` cancels.
+ * - `{"serial": 1854977, "learning": "normal", "buttons": [0, 1, ...]}`: add or update a
+ *   remote; `buttons[i]` is what button combination i is reported as. Only `serial` is required.
+ *   With `"legacy": true`, `serial` is as the parser before KeeLoq support read it; the remote
+ *   is moved to its whole serial on its first frame.
+ * - `{"serial": 1854977, "remove": true}`: forget a remote.
+ * - `{"timing": {"release_ms": 300, "hold_ms": 800, "repeat_ms": 400}}`: set the press,
+ *   hold and release thresholds of all remotes; any member can be left out.
+ *
+ * Responds with the remotes, as GET does.
+ */
+static esp_err_t radio_remotes_post_handler(httpd_req_t *req)
+{
+  cJSON *json = nullptr;
+  if (httpd_get_JSON(req, &json) != ESP_OK || json == nullptr) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Expected JSON");
+    return ESP_FAIL;
+  }
+  const cJSON *learn = cJSON_GetObjectItem(json, "learn");
+  const cJSON *serial = cJSON_GetObjectItem(json, "serial");
+  const cJSON *timing = cJSON_GetObjectItem(json, "timing");
+  bool ok = true;
+  if (cJSON_IsObject(timing)) {
+    hcs301->setButtonTiming(ButtonTracker::parseTiming(timing, hcs301->buttonTiming()));
+    hcs301_save_remotes();
+  } else if (cJSON_IsBool(learn)) {
+    hcs301->learn(cJSON_IsTrue(learn) ? JSON_OBJECT_NOT_NULL(json, "timeout_ms", HCS301_LEARN_TIMEOUT_MS) : 0);
+  } else if (cJSON_IsNumber(serial) && cJSON_IsTrue(cJSON_GetObjectItem(json, "remove"))) {
+    ok = hcs301->remove(HCS301::parseSerial(json));
+    hcs301_save_remotes();
+  } else if (cJSON_IsNumber(serial)) {
+    uint64_t button_map = HCS301_BUTTONS_IDENTITY;
+    HCS301::parseButtons(cJSON_GetObjectItem(json, "buttons"), &button_map);
+    ok = hcs301->enroll(HCS301::parseSerial(json),
+                        HCS301::parseLearning(cJSON_GetStringValue(cJSON_GetObjectItem(json, "learning"))), button_map);
+    hcs301_save_remotes();
+  } else {
+    ok = false;
   }
+  cJSON_Delete(json);
+  if (!ok) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown remote, full table or bad request");
+    return ESP_FAIL;
+  }
+  return radio_remotes_send(req);
 }
 
 static void initRadio()
@@ -152,11 +439,12 @@ static void initRadio()
     ESP_LOGE(TAG_RADIO, "Failed to setup CC1101");
     return;
   }
-  rmt_parse_queue = xQueueCreate(4, sizeof(rmt_message_t));
-  if (rmt_parse_queue == NULL) {
-    ESP_LOGE(TAG_RADIO, "Failed to create RMT queue");
+  if (!capture_pipeline_init(ws_broadcast_to, ws_subscribers)) {
     return;
-  }  
+  }
+  if (capture_recorder.init()) {
+    capture_tap = [](const rmt_message_t *msg) { capture_recorder.record(msg); };
+  }
   xTaskCreate(rmt_recive_task, "rmt_recive_task", 1024 * 8, NULL, 6, NULL);
   xTaskCreate(rmt_parse_task, "rmt_parse_task", 1024 * 8, NULL, 1, NULL);
   ESP_LOGD(TAG_RADIO, "OK");
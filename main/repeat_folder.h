@@ -0,0 +1,216 @@
+#pragma once
+#include "rmt_message.h"
+#include "decoded_event.h"
+#include <Arduino.h>
+#include <cJSON.h>
+
+#define TAG_REPEAT_FOLDER "REPEAT_FOLDER"
+
+/* Identical events closer than this are folded into one record. 0 disables folding. */
+#ifndef REPEAT_FOLD_WINDOW_MS
+#define REPEAT_FOLD_WINDOW_MS 250
+#endif
+
+/* Bursts tracked at once; a frame several decoders accept opens one burst per decoder. */
+#define REPEAT_FOLD_SLOTS 4
+
+/**
+ * @brief A burst of identical decoded events, reported once.
+ *
+ * `event` is the first occurrence; its time, delta and RSSI are those of the
+ * first frame of the burst.
+ */
+struct folded_event_t {
+  decoded_event_t event;
+  uint16_t repeats;
+  uint32_t first_time;
+  uint32_t last_time;
+  int8_t rssi_min;
+  int8_t rssi_max;
+};
+
+struct repeat_folder_stats_t {
+  uint32_t events;
+  uint32_t folded;
+  uint32_t records;
+};
+
+/**
+ * @brief Folds retransmissions of the same frame into one record per button press.
+ *
+ * Remotes repeat every frame for as long as a button is held. Each decoded
+ * event is compared with the open bursts: an identical event (same protocol,
+ * payload and fields) arriving within the window of the burst's last frame
+ * extends it; anything else opens a new burst. A burst is emitted once nothing
+ * extended it for a whole window, so downstream work scales with presses
+ * instead of RF repeats.
+ *
+ * Not thread safe: submit() and flush() must be called from the same task,
+ * which also has to call flush() by msUntilFlush() at the latest.
+ */
+class RepeatFolder
+{
+public:
+  RepeatFolder(uint32_t window_ms = REPEAT_FOLD_WINDOW_MS) : window_ms_(window_ms), slots_(), stats_() {}
+
+  void setSink(std::function<void(const folded_event_t &)> sink) {
+    sink_ = sink;
+  }
+
+  /**
+   * @brief Set the folding window. Open bursts are emitted first.
+   */
+  void setWindow(uint32_t window_ms) {
+    flushAll();
+    window_ms_ = window_ms;
+  }
+
+  uint32_t window() const { return window_ms_; }
+
+  /**
+   * @brief Start a new capture; see frameRepeated().
+   */
+  void beginFrame() {
+    frame_events_ = 0;
+    frame_folded_ = 0;
+  }
+
+  /**
+   * @brief true if the current capture decoded to events that were all repeats.
+   *
+   * Such a capture adds nothing the folded record will not carry, so its raw
+   * frame need not be broadcast either.
+   */
+  bool frameRepeated() const {
+    return frame_events_ > 0 && frame_folded_ == frame_events_;
+  }
+
+  /**
+   * @brief Fold an event into its burst or open a new one.
+   */
+  void submit(const decoded_event_t &event) {
+    stats_.events++;
+    frame_events_++;
+    flush(event.time);
+
+    slot_t *free_slot = nullptr;
+    slot_t *oldest = nullptr;
+    for (auto &slot : slots_) {
+      if (!slot.used) {
+        free_slot = free_slot ? free_slot : &slot;
+        continue;
+      }
+      if (same(slot.folded.event, event)) {
+        folded_event_t &f = slot.folded;
+        f.repeats++;
+        f.last_time = event.time;
+        f.rssi_min = MIN(f.rssi_min, clampRssi(event.rssi));
+        f.rssi_max = MAX(f.rssi_max, clampRssi(event.rssi));
+        slot.seq = ++seq_;
+        stats_.folded++;
+        frame_folded_++;
+        return;
+      }
+      if (!oldest || (int32_t)(slot.seq - oldest->seq) < 0) {
+        oldest = &slot;
+      }
+    }
+    if (!free_slot) {
+      emit(*oldest);
+      free_slot = oldest;
+    }
+    int8_t rssi = clampRssi(event.rssi);
+    free_slot->used = true;
+    free_slot->seq = ++seq_;
+    free_slot->folded = { event, 1, event.time, event.time, rssi, rssi };
+    if (window_ms_ == 0) {
+      emit(*free_slot);
+    }
+  }
+
+  /**
+   * @brief Emit the bursts no frame extended within the window before `now_ms`.
+   */
+  void flush(uint32_t now_ms) {
+    for (auto &slot : slots_) {
+      if (slot.used && now_ms - slot.folded.last_time >= window_ms_) {
+        emit(slot);
+      }
+    }
+  }
+
+  void flushAll() {
+    for (auto &slot : slots_) {
+      if (slot.used) {
+        emit(slot);
+      }
+    }
+  }
+
+  /**
+   * @brief Time until the next burst is due, UINT32_MAX if none is open.
+   */
+  uint32_t msUntilFlush(uint32_t now_ms) const {
+    uint32_t next = UINT32_MAX;
+    for (auto &slot : slots_) {
+      if (slot.used) {
+        uint32_t age = now_ms - slot.folded.last_time;
+        next = MIN(next, age >= window_ms_ ? 0 : window_ms_ - age);
+      }
+    }
+    return next;
+  }
+
+  repeat_folder_stats_t getStats() const { return stats_; }
+
+  void serializeStats(cJSON *json) const {
+    cJSON_AddNumberToObject(json, "window_ms", window_ms_);
+    cJSON_AddNumberToObject(json, "events", stats_.events);
+    cJSON_AddNumberToObject(json, "folded", stats_.folded);
+    cJSON_AddNumberToObject(json, "records", stats_.records);
+  }
+
+private:
+  struct slot_t {
+    bool used;
+    uint32_t seq;  // order of the last update; frames can share a millisecond
+    folded_event_t folded;
+  };
+
+  uint32_t window_ms_;
+  slot_t slots_[REPEAT_FOLD_SLOTS];
+  repeat_folder_stats_t stats_;
+  uint16_t frame_events_ = 0;
+  uint16_t frame_folded_ = 0;
+  uint32_t seq_ = 0;
+  std::function<void(const folded_event_t &)> sink_;
+
+  static int8_t clampRssi(int rssi) {
+    return rssi < INT8_MIN ? INT8_MIN : rssi > INT8_MAX ? INT8_MAX : rssi;
+  }
+
+  static bool same(const decoded_event_t &a, const decoded_event_t &b) {
+    if (a.protocol != b.protocol || a.nbits != b.nbits || a.n_fields != b.n_fields ||
+        memcmp(a.payload, b.payload, (a.nbits + 7) / 8) != 0) {
+      return false;
+    }
+    for (uint8_t i = 0; i < a.n_fields; i++) {
+      if (a.fields[i].id != b.fields[i].id || a.fields[i].value != b.fields[i].value) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void emit(slot_t &slot) {
+    slot.used = false;
+    stats_.records++;
+    ESP_LOGD(TAG_REPEAT_FOLDER, "protocol %d: %d repeats over %lu ms", slot.folded.event.protocol,
+             slot.folded.repeats, (unsigned long)(slot.folded.last_time - slot.folded.first_time));
+    if (sink_) {
+      sink_(slot.folded);
+    }
+  }
+};
+
+RepeatFolder repeat_folder;
@@ -0,0 +1,22 @@
+#pragma once
+#include <Arduino.h>
+
+/*
+ * Capture types shared by the radio pipeline. Kept apart from main.h so the
+ * pipeline headers do not pull in WiFi, SPIFFS and the rest of the app.
+ */
+
+typedef struct rmt_message_t
+{
+  uint16_t length;
+  unsigned long time;
+  int64_t delta;
+  int rssi;
+  rmt_data_t buf[RMT_MEM_NUM_BLOCKS_4 * RMT_SYMBOLS_PER_CHANNEL_BLOCK];
+} rmt_message_t;
+
+typedef struct pwm_message_t
+{
+  uint8_t buf[RMT_MEM_NUM_BLOCKS_4 * RMT_SYMBOLS_PER_CHANNEL_BLOCK / 8];
+  uint8_t length;
+} pwm_message_t;
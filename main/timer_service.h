@@ -0,0 +1,223 @@
+#pragma once
+#include <Arduino.h>
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+
+#define TAG_TIMERS "TIMERS"
+
+/* Resolution of the service; deadlines are rounded up to a tick. */
+#ifndef TIMER_SERVICE_TICK_US
+#define TIMER_SERVICE_TICK_US 10000
+#endif
+/* Wheel size, a power of two. Timeouts longer than one turn wait out whole turns in their slot. */
+#define TIMER_SERVICE_SLOTS 256
+
+typedef void (*soft_timer_cb_t)(void *arg);
+
+/**
+ * @brief A one-shot timer of the TimerService. Owned by the user, linked into the wheel while armed.
+ */
+struct soft_timer_t {
+  soft_timer_cb_t callback;
+  void *arg;
+  soft_timer_t *prev;
+  soft_timer_t *next;
+  int64_t deadline_us;  // esp_timer time the timer fires at
+  uint32_t rounds;      // wheel turns left before it fires
+  uint16_t slot;        // list the timer is in
+  bool armed;
+
+  soft_timer_t(soft_timer_cb_t callback = nullptr, void *arg = nullptr)
+    : callback(callback), arg(arg), prev(nullptr), next(nullptr), deadline_us(0), rounds(0), slot(0), armed(false) {}
+};
+
+/**
+ * @brief One-shot timers for any number of actuators on a single esp_timer.
+ *
+ * A hashed timing wheel: TIMER_SERVICE_SLOTS lists of timers, one per tick,
+ * with the timers further away than one turn keeping a count of turns to
+ * wait. Arming, rearming and cancelling link or unlink one list node, O(1)
+ * whatever the number of timers, and the remaining time is the stored
+ * deadline minus now. The esp_timer ticks only while a timer is armed, and
+ * each tick looks at one slot.
+ *
+ * Callbacks run in the esp_timer task, one at a time and without the service
+ * locked, so they may rearm their own timer. Expired timers wait in a list of
+ * their own until their callback runs, so cancel() stops a timer that is due
+ * but has not fired yet too. Everything else may be called from any task.
+ */
+class TimerService
+{
+public:
+  bool init() {
+    if (timer_ != NULL) {
+      return true;
+    }
+    mutex_ = xSemaphoreCreateMutexStatic(&mutex_buffer_);
+    esp_timer_create_args_t args = {};
+    args.callback = onTick;
+    args.arg = this;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "timer_service";
+    args.skip_unhandled_events = true;
+    if (mutex_ == NULL || esp_timer_create(&args, &timer_) != ESP_OK) {
+      ESP_LOGE(TAG_TIMERS, "Failed to create the service timer");
+      timer_ = NULL;
+      return false;
+    }
+    return true;
+  }
+
+  /**
+   * @brief (Re)arm `timer` to fire in `timeout_us`, cancelling a pending expiry.
+   */
+  void arm(soft_timer_t *timer, uint64_t timeout_us) {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    if (timer->armed) {
+      unlink(timer);
+    }
+    int64_t now = esp_timer_get_time();
+    if (!running_) {
+      // Idle: restart the tick count from now.
+      epoch_us_ = now - (int64_t)tick_ * TIMER_SERVICE_TICK_US;
+      esp_timer_start_periodic(timer_, TIMER_SERVICE_TICK_US);
+      running_ = true;
+    }
+    // Ticks from the current one, rounded up so a timer never fires early.
+    uint64_t elapsed_us = now - tickTime(tick_);
+    uint64_t ticks = MAX((timeout_us + elapsed_us + TIMER_SERVICE_TICK_US - 1) / TIMER_SERVICE_TICK_US, 1);
+    uint64_t fire_tick = tick_ + ticks;
+    timer->deadline_us = now + timeout_us;
+    timer->rounds = (ticks - 1) / TIMER_SERVICE_SLOTS;
+    link(timer, fire_tick % TIMER_SERVICE_SLOTS);
+    xSemaphoreGive(mutex_);
+  }
+
+  void armMs(soft_timer_t *timer, uint32_t timeout_ms) {
+    arm(timer, (uint64_t)timeout_ms * 1000);
+  }
+
+  /**
+   * @brief Stop `timer` if armed.
+   *
+   * @return true if it was armed. After this returns its callback does not start,
+   *         though it may still be running if it had already.
+   */
+  bool cancel(soft_timer_t *timer) {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    bool armed = timer->armed;
+    if (armed) {
+      unlink(timer);
+      stopIfIdle();
+    }
+    xSemaphoreGive(mutex_);
+    return armed;
+  }
+
+  /**
+   * @brief Time until `timer` fires, in us; -1 if it is not armed.
+   */
+  int64_t remainingUs(const soft_timer_t *timer) {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    int64_t remaining = timer->armed ? MAX(timer->deadline_us - esp_timer_get_time(), 0) : -1;
+    xSemaphoreGive(mutex_);
+    return remaining;
+  }
+
+  int32_t remainingMs(const soft_timer_t *timer) {
+    int64_t remaining = remainingUs(timer);
+    return remaining < 0 ? -1 : (int32_t)((remaining + 999) / 1000);
+  }
+
+  bool isArmed(const soft_timer_t *timer) const { return timer->armed; }
+
+  uint32_t armed() const { return armed_; }
+
+private:
+  esp_timer_handle_t timer_ = NULL;
+  SemaphoreHandle_t mutex_ = NULL;
+  StaticSemaphore_t mutex_buffer_;
+  soft_timer_t *slots_[TIMER_SERVICE_SLOTS + 1] = {};  // the wheel, then the expired timers
+  uint64_t tick_ = 0;     // last tick processed
+  int64_t epoch_us_ = 0;  // esp_timer time of tick 0
+  uint32_t armed_ = 0;
+  bool running_ = false;
+
+  int64_t tickTime(uint64_t tick) const {
+    return epoch_us_ + (int64_t)tick * TIMER_SERVICE_TICK_US;
+  }
+
+  void link(soft_timer_t *timer, uint16_t slot) {
+    soft_timer_t *&head = slots_[slot];
+    timer->slot = slot;
+    timer->prev = nullptr;
+    timer->next = head;
+    if (head) {
+      head->prev = timer;
+    }
+    head = timer;
+    timer->armed = true;
+    armed_++;
+  }
+
+  void unlink(soft_timer_t *timer) {
+    if (timer->prev) {
+      timer->prev->next = timer->next;
+    } else {
+      slots_[timer->slot] = timer->next;
+    }
+    if (timer->next) {
+      timer->next->prev = timer->prev;
+    }
+    timer->prev = timer->next = nullptr;
+    timer->armed = false;
+    armed_--;
+  }
+
+  void stopIfIdle() {
+    if (armed_ == 0 && running_) {
+      esp_timer_stop(timer_);
+      running_ = false;
+    }
+  }
+
+  /**
+   * @brief Process every tick up to now, then fire what expired.
+   *
+   * Catches up after a late or skipped esp_timer event, so a timer is late by
+   * the callback latency at most, never by lost ticks.
+   */
+  static void onTick(void *arg) {
+    TimerService *this_ = static_cast<TimerService *>(arg);
+    xSemaphoreTake(this_->mutex_, portMAX_DELAY);
+    if (!this_->running_) {
+      xSemaphoreGive(this_->mutex_);  // an event from before the last stop
+      return;
+    }
+    int64_t now = esp_timer_get_time();
+    while (this_->tickTime(this_->tick_ + 1) <= now) {
+      this_->tick_++;
+      soft_timer_t *timer = this_->slots_[this_->tick_ % TIMER_SERVICE_SLOTS];
+      while (timer) {
+        soft_timer_t *next = timer->next;
+        if (timer->rounds == 0) {
+          this_->unlink(timer);
+          this_->link(timer, TIMER_SERVICE_SLOTS);
+        } else {
+          timer->rounds--;
+        }
+        timer = next;
+      }
+    }
+    while (soft_timer_t *timer = this_->slots_[TIMER_SERVICE_SLOTS]) {
+      this_->unlink(timer);
+      xSemaphoreGive(this_->mutex_);
+      timer->callback(timer->arg);
+      xSemaphoreTake(this_->mutex_, portMAX_DELAY);
+    }
+    this_->stopIfIdle();
+    xSemaphoreGive(this_->mutex_);
+  }
+};
+
+TimerService timer_service;
@@ -0,0 +1,56 @@
+#pragma once
+#include "asset_cache.h"
+
+/**
+ * @brief Slot of the route table: a request path and the asset it serves.
+ */
+struct www_route_t {
+  const char *path;
+  int8_t asset;
+};
+
+/*
+ * With WWW_BUNDLE set by main/CMakeLists.txt, data/www is linked into the app
+ * as one blob and www_bundle.h, generated by wwwbundlegen.py, indexes it: the
+ * assets, with their ETags computed at build time, and a table of
+ * WWW_BUNDLE_SLOTS routes in which every path hashes to its own slot.
+ */
+#if WWW_BUNDLE
+#include "www_bundle.h"
+#endif
+
+/**
+ * @brief FNV-1a from `seed`. Must match route_hash() in wwwbundlegen.py.
+ */
+static inline uint32_t www_bundle_hash(uint32_t seed, const char *p, size_t len)
+{
+  uint32_t hash = seed;
+  while (len--) {
+    hash = (hash ^ (uint8_t)*p++) * 16777619u;
+  }
+  return hash;
+}
+
+/**
+ * @brief Resolve a request path against the UI linked into the app.
+ *
+ * One hash and one string compare: the path can only be in the slot it
+ * hashes to. The query string, if any, is ignored. Unknown paths get
+ * index.html, as from SPIFFS. The bodies are read straight from the
+ * flash mapped app image, nothing is copied.
+ *
+ * @return The asset, NULL when built without the bundle or when it has no index.html.
+ */
+static const asset_t *web_bundle_resolve(const char *uri)
+{
+#if WWW_BUNDLE
+  size_t len = strcspn(uri, "?#");
+  const www_route_t &route = www_bundle_routes[www_bundle_hash(WWW_BUNDLE_SEED, uri, len) & (WWW_BUNDLE_SLOTS - 1)];
+  if (route.path && strncmp(route.path, uri, len) == 0 && route.path[len] == '\0') {
+    return &www_bundle_assets[route.asset];
+  }
+  return WWW_BUNDLE_FALLBACK >= 0 ? &www_bundle_assets[WWW_BUNDLE_FALLBACK] : NULL;
+#else
+  return NULL;
+#endif
+}
@@ -14,6 +14,7 @@ void WiFiEvents(WiFiEvent_t event) {
   switch (event) {
     case ARDUINO_EVENT_WIFI_STA_GOT_IP:
       ESP_LOGW(TAG_WIFI, "Connected!");
+      configTime(0, 0, "pool.ntp.org");  // UTC; keeps the clock for the pump scheduler
       break;
     case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
       ESP_LOGW(TAG_WIFI, "Disconnected!");
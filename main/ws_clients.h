@@ -0,0 +1,603 @@
+#pragma once
+#include <Arduino.h>
+#include <cJSON.h>
+#include <esp_http_server.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <errno.h>
+#include "esp_timer.h"
+#include "WiFi.h"
+#include "ws_frame.h"
+#include "ws_filter.h"
+
+#define TAG_WS "WS"
+
+#define WS_MAX_CLIENTS 8
+
+/* Frames waiting per client; when full, the oldest waiting frame is dropped. */
+#define WS_CLIENT_QUEUE_LEN 16
+
+/* Frames waiting for the broadcast task to fan them out. */
+#define WS_BROADCAST_QUEUE_LEN 16
+
+/* A frame the client's socket had no room for is tried again this much later. */
+#define WS_RETRY_MS 50
+
+/*
+ * Longest the httpd task waits for room to finish a frame it has started
+ * writing; the client is disconnected after that. Part of a frame cannot be
+ * taken back without breaking the stream.
+ */
+#define WS_SEND_STALL_MS 100
+
+static_assert(WS_MAX_CLIENTS <= 32, "subscriber masks are 32 bits");
+
+/**
+ * @brief A broadcast frame, shared by the queues of every client it goes to.
+ *
+ * Freed when the last reference is released: one per queue entry, one per
+ * send in flight.
+ */
+struct ws_msg_t {
+  uint16_t refs;
+  uint16_t len;
+  uint32_t subscribers;  // client slots it goes to
+  int64_t time;          // when it was broadcast, us since boot
+  uint8_t data[];
+};
+
+/**
+ * @brief A WebSocket client: its subscription and its send queue.
+ *
+ * Clients start subscribed to everything. `fd` is -1 for a free slot.
+ * At most one frame per client is in flight; the next is sent when the
+ * httpd task reports the previous one done, or, after the socket had no
+ * room for it, on the broadcast task's next retry tick.
+ */
+struct ws_client_t {
+  int fd;
+  ws_filter_t filter;
+  ws_msg_t *queue[WS_CLIENT_QUEUE_LEN];
+  uint8_t head;
+  uint8_t count;
+  ws_msg_t *inflight;
+  bool sending;         // sendWork() is writing `inflight`; other writes are the server's own replies
+  uint16_t written;     // bytes of `inflight` on the socket
+  bool stalled;         // the socket had no room; retry on the next tick
+  bool broken;          // gave up halfway through a frame; close it
+  // Lag counters, since the client connected:
+  uint32_t sent;
+  uint32_t dropped;     // waiting frames pushed out by newer ones
+  uint32_t deferred;    // sends put off because the socket was full
+  uint32_t errors;
+  uint8_t max_count;
+  uint32_t lag_ms;      // broadcast to sent, of the last frame
+  uint32_t max_lag_ms;
+};
+
+/**
+ * @brief A frame handed to the httpd task for one client, see WsClients::sendWork().
+ */
+struct ws_send_t {
+  int fd;
+  ws_msg_t *msg;
+};
+
+class WsClients;
+extern WsClients ws_clients;
+
+/**
+ * @brief Per-client send queues of the /ws endpoint.
+ *
+ * Producers first ask subscribers() who wants a frame, which runs every
+ * client's compiled filter once, and only serialize it if someone does.
+ * broadcast() never blocks: the frame is copied into a message and handed to
+ * the broadcast task, or dropped and counted if its queue is full. The task
+ * puts the message in the queue of each client in its subscriber mask. A slow
+ * client only fills its own queue, losing its oldest frames, while the others
+ * carry on.
+ *
+ * Frames are sent by sendWork(), queued to the httpd task; it writes the
+ * frame with the session's send function, which by default blocks for up
+ * to send_wait_timeout (5 s) and so would hold up every client and request
+ * behind a slow one. WebSocket sessions get sendFn() instead, which never
+ * waits for a frame it has not started: with no room in the socket, the frame
+ * goes back to the head of the client's queue and is retried WS_RETRY_MS
+ * later. The httpd task only waits, for at most WS_SEND_STALL_MS, to finish
+ * a frame the socket took part of, or to write a reply of its own (a
+ * subscription reply, a pong); a client still stuck then is closed.
+ */
+class WsClients
+{
+public:
+  void start(httpd_handle_t server) {
+    server_ = server;
+    queue_ = xQueueCreate(WS_BROADCAST_QUEUE_LEN, sizeof(ws_msg_t *));
+    assert(queue_ != NULL);
+    for (auto &client : clients_) {
+      reset(client, -1);
+    }
+    xTaskCreate(task, "ws_broadcast_task", 4 * 1024, this, 1, NULL);
+  }
+
+  /**
+   * @brief Mask of the client slots whose subscription matches a frame.
+   */
+  uint32_t subscribers(const ws_frame_info_t &frame) {
+    uint32_t mask = 0;
+    taskENTER_CRITICAL(&lock_);
+    for (uint8_t i = 0; i < WS_MAX_CLIENTS; i++) {
+      if (clients_[i].fd >= 0 && clients_[i].filter.matches(frame)) {
+        mask |= 1u << i;
+      }
+    }
+    taskEXIT_CRITICAL(&lock_);
+    return mask;
+  }
+
+  /**
+   * @brief Queue a binary frame for the clients in `subscribers`. Does not block.
+   */
+  void broadcast(const uint8_t *data, size_t len, uint32_t subscribers) {
+    if (queue_ == NULL || subscribers == 0) {
+      return;
+    }
+    ws_msg_t *msg = (ws_msg_t *)malloc(sizeof(ws_msg_t) + len);
+    if (msg != NULL) {
+      msg->refs = 1;
+      msg->len = (uint16_t)len;
+      msg->subscribers = subscribers;
+      msg->time = esp_timer_get_time();
+      memcpy(msg->data, data, len);
+      if (xQueueSend(queue_, &msg, 0) == pdTRUE) {
+        return;
+      }
+      free(msg);
+    }
+    taskENTER_CRITICAL(&lock_);
+    broadcast_drops_++;
+    taskEXIT_CRITICAL(&lock_);
+  }
+
+  /**
+   * @brief Start a client afresh on its handshake; a reused socket loses the old queue.
+   */
+  void open(int fd) {
+    httpd_sess_set_send_override(server_, fd, sendFn);
+    taskENTER_CRITICAL(&lock_);
+    ws_client_t *client = find(fd);
+    if (client == NULL) {
+      client = findFree();
+    }
+    ws_msg_t *released[WS_CLIENT_QUEUE_LEN];
+    size_t n = client ? reset(*client, fd, released) : 0;
+    taskEXIT_CRITICAL(&lock_);
+    release(released, n);
+    if (client == NULL) {
+      ESP_LOGW(TAG_WS, "No slot for client fd=%d", fd);
+    }
+  }
+
+  /**
+   * @brief Forget a client whose socket is closing.
+   */
+  void closed(int fd) {
+    taskENTER_CRITICAL(&lock_);
+    ws_client_t *client = find(fd);
+    ws_msg_t *released[WS_CLIENT_QUEUE_LEN];
+    size_t n = client ? reset(*client, -1, released) : 0;
+    taskEXIT_CRITICAL(&lock_);
+    release(released, n);
+  }
+
+  /**
+   * @brief Apply a subscription message, e.g. `{"raw":false,"protocols":["hcs301"]}`.
+   *
+   * See ws_filter_t::compile() for the members. The reply is the resulting
+   * subscription, `{"subscription":{...}}`, or `{"error":...}` when the
+   * message is malformed and the subscription stays as it was.
+   *
+   * @param reply Set to the reply, to be freed with cJSON_free().
+   * @return true if the payload was a JSON object.
+   */
+  bool configure(int fd, const char *payload, char **reply) {
+    cJSON *json = cJSON_Parse(payload);
+    if (json == NULL) {
+      return false;
+    }
+    if (!cJSON_IsObject(json)) {
+      cJSON_Delete(json);
+      return false;
+    }
+    taskENTER_CRITICAL(&lock_);
+    ws_client_t *client = find(fd);
+    ws_filter_t filter = client ? client->filter : ws_filter_t::all();
+    taskEXIT_CRITICAL(&lock_);
+    bool ok = client && filter.compile(json, &filter);
+    if (ok) {
+      taskENTER_CRITICAL(&lock_);
+      if (client->fd == fd) {
+        client->filter = filter;
+      }
+      taskEXIT_CRITICAL(&lock_);
+    }
+    cJSON_Delete(json);
+
+    cJSON *response = cJSON_CreateObject();
+    if (ok) {
+      filter.serialize(cJSON_AddObjectToObject(response, "subscription"));
+    } else {
+      cJSON_AddStringToObject(response, "error", client ? "Invalid subscription" : "Not a WebSocket client");
+    }
+    *reply = cJSON_PrintUnformatted(response);
+    cJSON_Delete(response);
+    ESP_LOGD(TAG_WS, "Client fd=%d: %s", fd, *reply ? *reply : "");
+    return true;
+  }
+
+  void serializeStats(cJSON *json) {
+    ws_client_t clients[WS_MAX_CLIENTS];
+    taskENTER_CRITICAL(&lock_);
+    uint32_t broadcast_drops = broadcast_drops_;
+    memcpy(clients, clients_, sizeof(clients));
+    taskEXIT_CRITICAL(&lock_);
+    cJSON_AddNumberToObject(json, "broadcast_drops", broadcast_drops);
+    cJSON *array = cJSON_AddArrayToObject(json, "clients");
+    for (const auto &client : clients) {
+      if (client.fd < 0) {
+        continue;
+      }
+      cJSON *item = cJSON_CreateObject();
+      cJSON_AddNumberToObject(item, "fd", client.fd);
+      client.filter.serialize(cJSON_AddObjectToObject(item, "subscription"));
+      cJSON_AddNumberToObject(item, "queued", client.count);
+      cJSON_AddNumberToObject(item, "max_queued", client.max_count);
+      cJSON_AddNumberToObject(item, "sent", client.sent);
+      cJSON_AddNumberToObject(item, "dropped", client.dropped);
+      cJSON_AddNumberToObject(item, "deferred", client.deferred);
+      cJSON_AddNumberToObject(item, "errors", client.errors);
+      cJSON_AddNumberToObject(item, "lag_ms", client.lag_ms);
+      cJSON_AddNumberToObject(item, "max_lag_ms", client.max_lag_ms);
+      cJSON_AddItemToArray(array, item);
+    }
+  }
+
+private:
+  httpd_handle_t server_ = NULL;
+  QueueHandle_t queue_ = NULL;
+  portMUX_TYPE lock_ = portMUX_INITIALIZER_UNLOCKED;
+  ws_client_t clients_[WS_MAX_CLIENTS] = {};
+  uint32_t broadcast_drops_ = 0;
+
+  ws_client_t *find(int fd) {
+    for (auto &client : clients_) {
+      if (client.fd == fd) {
+        return &client;
+      }
+    }
+    return NULL;
+  }
+
+  ws_client_t *findFree() {
+    for (auto &client : clients_) {
+      if (client.fd < 0) {
+        return &client;
+      }
+    }
+    return NULL;
+  }
+
+  /**
+   * @brief Give a slot to `fd` with the defaults. Under the lock.
+   *
+   * The frame in flight stays referenced by its send, which releases it.
+   *
+   * @return Number of queued frames put in `released`, to release outside the lock.
+   */
+  static size_t reset(ws_client_t &client, int fd, ws_msg_t **released = NULL) {
+    size_t n = 0;
+    for (; released && n < client.count; n++) {
+      released[n] = client.queue[(client.head + n) % WS_CLIENT_QUEUE_LEN];
+    }
+    client = {};
+    client.fd = fd;
+    client.filter = ws_filter_t::all();
+    return n;
+  }
+
+  /**
+   * @brief Drop references to messages, freeing those no one holds any more.
+   */
+  void release(ws_msg_t **msgs, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+      taskENTER_CRITICAL(&lock_);
+      bool last = --msgs[i]->refs == 0;
+      taskEXIT_CRITICAL(&lock_);
+      if (last) {
+        free(msgs[i]);
+      }
+    }
+  }
+
+  /**
+   * @brief Queue a message for a client, dropping its oldest waiting one when full. Under the lock.
+   *
+   * @return The dropped message, to release outside the lock.
+   */
+  static ws_msg_t *push(ws_client_t &client, ws_msg_t *msg) {
+    ws_msg_t *dropped = NULL;
+    if (client.count == WS_CLIENT_QUEUE_LEN) {
+      dropped = client.queue[client.head];
+      client.head = (client.head + 1) % WS_CLIENT_QUEUE_LEN;
+      client.count--;
+      client.dropped++;
+    }
+    msg->refs++;
+    client.queue[(client.head + client.count) % WS_CLIENT_QUEUE_LEN] = msg;
+    client.count++;
+    client.max_count = MAX(client.max_count, client.count);
+    return dropped;
+  }
+
+  /**
+   * @brief Start sending the next queued frame of a client, unless one is in flight or its socket is full.
+   */
+  void sendNext(ws_client_t &client) {
+    taskENTER_CRITICAL(&lock_);
+    ws_msg_t *msg = NULL;
+    int fd = client.fd;
+    if (client.inflight == NULL && !client.stalled && client.count > 0) {
+      msg = client.inflight = client.queue[client.head];
+      client.head = (client.head + 1) % WS_CLIENT_QUEUE_LEN;
+      client.count--;
+    }
+    taskEXIT_CRITICAL(&lock_);
+    if (msg == NULL) {
+      return;
+    }
+    ws_send_t *send = (ws_send_t *)malloc(sizeof(ws_send_t));
+    esp_err_t err = ESP_ERR_NO_MEM;
+    if (send != NULL) {
+      *send = { fd, msg };
+      err = httpd_queue_work(server_, sendWork, send);
+      if (err != ESP_OK) {
+        free(send);
+      }
+    }
+    if (err != ESP_OK) {
+      onSent(err, fd, msg);
+    }
+  }
+
+  /**
+   * @brief Write a client's frame in flight, on the httpd task, then complete it with onSent().
+   *
+   * `sending` is set around the write, so sendFn() tells the frame's first
+   * write from a reply the server sent in between, however many bytes those
+   * left on the socket.
+   */
+  static void sendWork(void *arg) {
+    WsClients &self = ws_clients;
+    ws_send_t send = *(ws_send_t *)arg;
+    free(arg);
+    taskENTER_CRITICAL(&self.lock_);
+    ws_client_t *client = self.find(send.fd);
+    bool current = client && client->inflight == send.msg;
+    if (current) {
+      client->sending = true;
+      client->written = 0;
+    }
+    taskEXIT_CRITICAL(&self.lock_);
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+    if (current) {
+      httpd_ws_frame_t ws_pkt;
+      memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
+      ws_pkt.payload = send.msg->data;
+      ws_pkt.len = send.msg->len;
+      ws_pkt.type = HTTPD_WS_TYPE_BINARY;
+      err = httpd_ws_send_frame_async(self.server_, send.fd, &ws_pkt);
+      taskENTER_CRITICAL(&self.lock_);
+      if (client->fd == send.fd) {
+        client->sending = false;
+      }
+      taskEXIT_CRITICAL(&self.lock_);
+    }
+    onSent(err, send.fd, send.msg);
+  }
+
+  /**
+   * @brief Completion of a send, on the httpd task: release the frame and send the next.
+   *
+   * A frame the socket had no room for goes back to the head of the queue
+   * instead, unless the queue filled up meanwhile, which makes it the oldest.
+   */
+  static void onSent(esp_err_t err, int fd, void *arg) {
+    WsClients &self = ws_clients;
+    ws_msg_t *msg = (ws_msg_t *)arg;
+    int64_t now = esp_timer_get_time();
+    bool requeued = false;
+    bool close = false;
+    taskENTER_CRITICAL(&self.lock_);
+    ws_client_t *client = self.find(fd);
+    if (client && client->inflight == msg) {
+      client->inflight = NULL;
+      if (err == ESP_OK) {
+        client->sent++;
+        client->lag_ms = (now - msg->time) / 1000;
+        client->max_lag_ms = MAX(client->max_lag_ms, client->lag_ms);
+      } else if (client->stalled) {
+        client->deferred++;
+        if (client->count < WS_CLIENT_QUEUE_LEN) {
+          client->head = (client->head + WS_CLIENT_QUEUE_LEN - 1) % WS_CLIENT_QUEUE_LEN;
+          client->queue[client->head] = msg;
+          client->count++;
+          requeued = true;
+        } else {
+          client->dropped++;
+        }
+      } else {
+        client->errors++;
+        close = client->broken;
+      }
+    } else {
+      client = NULL;
+    }
+    taskEXIT_CRITICAL(&self.lock_);
+    if (!requeued) {
+      self.release(&msg, 1);
+    }
+    if (close) {
+      ESP_LOGW(TAG_WS, "Client fd=%d stalled mid-frame, closing", fd);
+      httpd_sess_trigger_close(self.server_, fd);
+    } else if (client) {
+      self.sendNext(*client);
+    }
+  }
+
+  /**
+   * @brief Send function of WebSocket sessions, on the httpd task. Never waits to start a frame.
+   *
+   * httpd writes a frame as a header and a payload. While sendWork() writes
+   * a queued frame, `written` tells whether this call starts it or continues
+   * it. A frame not started when the socket is full is given up whole, and
+   * marked `stalled` for onSent() to requeue. One already started is
+   * finished, waiting up to WS_SEND_STALL_MS for room, or the client is
+   * marked `broken`. Writes of the server's own (replies, pongs) cannot be
+   * requeued, so they wait as a started frame does; one that still does not
+   * fit closes the session.
+   */
+  static int sendFn(httpd_handle_t hd, int fd, const char *buf, size_t len, int flags) {
+    WsClients &self = ws_clients;
+    taskENTER_CRITICAL(&self.lock_);
+    ws_client_t *client = self.find(fd);
+    bool queued = client && client->sending;
+    bool started = !queued || client->written > 0;
+    taskEXIT_CRITICAL(&self.lock_);
+    size_t done = 0;
+    int64_t deadline = 0;
+    while (done < len) {
+      int n = send(fd, buf + done, len - done, flags | MSG_DONTWAIT);
+      if (n > 0) {
+        done += n;
+        continue;
+      }
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && (started || done > 0)) {
+        int64_t now = esp_timer_get_time();
+        deadline = deadline ? deadline : now + WS_SEND_STALL_MS * 1000;
+        if (now < deadline && waitWritable(fd, (deadline - now) / 1000 + 1)) {
+          continue;
+        }
+      }
+      bool full = n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+      taskENTER_CRITICAL(&self.lock_);
+      if (queued && client->fd == fd) {
+        client->stalled = full && !started && done == 0;
+        client->broken = !client->stalled;
+      }
+      taskEXIT_CRITICAL(&self.lock_);
+      if (!queued) {
+        ESP_LOGW(TAG_WS, "Client fd=%d stalled on a reply, closing", fd);
+        httpd_sess_trigger_close(hd, fd);
+      }
+      return full ? HTTPD_SOCK_ERR_TIMEOUT : HTTPD_SOCK_ERR_FAIL;
+    }
+    taskENTER_CRITICAL(&self.lock_);
+    if (queued && client->fd == fd) {
+      client->written += done;
+    }
+    taskEXIT_CRITICAL(&self.lock_);
+    return done;
+  }
+
+  static bool waitWritable(int fd, uint32_t timeout_ms) {
+    fd_set writable;
+    FD_ZERO(&writable);
+    FD_SET(fd, &writable);
+    struct timeval tv = { (time_t)(timeout_ms / 1000), (suseconds_t)(timeout_ms % 1000 * 1000) };
+    return select(fd + 1, NULL, &writable, NULL, &tv) > 0;
+  }
+
+  /**
+   * @brief Send again to the clients whose socket was full at their last try.
+   */
+  void retryStalled() {
+    for (auto &client : clients_) {
+      taskENTER_CRITICAL(&lock_);
+      bool stalled = client.fd >= 0 && client.stalled && client.inflight == NULL;
+      if (stalled) {
+        client.stalled = false;
+      }
+      taskEXIT_CRITICAL(&lock_);
+      if (stalled) {
+        sendNext(client);
+      }
+    }
+  }
+
+  void fanOut(ws_msg_t *msg) {
+    for (uint8_t i = 0; i < WS_MAX_CLIENTS; i++) {
+      ws_client_t &client = clients_[i];
+      if (!(msg->subscribers >> i & 1) || client.fd < 0) {
+        continue;
+      }
+      if (httpd_ws_get_fd_info(server_, client.fd) != HTTPD_WS_CLIENT_WEBSOCKET) {
+        closed(client.fd);
+        continue;
+      }
+      taskENTER_CRITICAL(&lock_);
+      ws_msg_t *dropped = NULL;
+      bool open = client.fd >= 0;
+      if (open) {
+        dropped = push(client, msg);
+      }
+      taskEXIT_CRITICAL(&lock_);
+      if (dropped) {
+        release(&dropped, 1);
+      }
+      if (open) {
+        sendNext(client);
+      }
+    }
+  }
+
+  bool anyStalled() {
+    bool stalled = false;
+    taskENTER_CRITICAL(&lock_);
+    for (auto &client : clients_) {
+      stalled |= client.fd >= 0 && client.stalled;
+    }
+    taskEXIT_CRITICAL(&lock_);
+    return stalled;
+  }
+
+  static void task(void *pvParameters) {
+    WsClients *self = (WsClients *)pvParameters;
+    ws_msg_t *msg;
+    bool retry = false;
+    TickType_t retry_at = 0;
+    while (1) {
+      // The retry tick is kept by time, not by idle, so a steady stream of frames cannot hold it off.
+      TickType_t now = xTaskGetTickCount();
+      if (!retry && self->anyStalled()) {
+        retry = true;
+        retry_at = now + pdMS_TO_TICKS(WS_RETRY_MS);
+      }
+      TickType_t wait = !retry ? portMAX_DELAY : (int32_t)(retry_at - now) > 0 ? retry_at - now : 0;
+      if (xQueueReceive(self->queue_, &msg, wait) == pdTRUE) {
+        if (WiFi.status() == WL_CONNECTED) {
+          self->fanOut(msg);
+        }
+        self->release(&msg, 1);
+      }
+      if (retry && (int32_t)(xTaskGetTickCount() - retry_at) >= 0) {
+        retry = false;
+        self->retryStalled();
+      }
+    }
+  }
+};
+
+WsClients ws_clients;
@@ -0,0 +1,192 @@
+#pragma once
+#include "ws_frame.h"
+#include "decoded_event.h"
+#include <Arduino.h>
+#include <cJSON.h>
+
+/* Subscriber mask of a frame: bit i for client slot i. */
+#define WS_SUBSCRIBERS_ALL UINT32_MAX
+
+#define WS_FILTER_TYPES_DECODED (1u << WS_FRAME_EVENT | 1u << WS_FRAME_REPEAT)
+#define WS_FILTER_TYPES_STATUS (1u << WS_FRAME_FLOW | 1u << WS_FRAME_ZONES)
+
+/**
+ * @brief What a subscription is matched against: the frame before it is serialized.
+ */
+struct ws_frame_info_t {
+  uint8_t type;      // ws_frame_type_t
+  uint8_t protocol;  // protocol_id_t, of event and repeat frames
+  int rssi;          // dBm; of a repeat frame, the strongest frame of the burst
+  uint16_t symbols;  // of capture frames
+};
+
+static const char *const ws_filter_protocol_names[] = { "unknown", "hcs301", "ev1527", "pt2262", "hs2303" };
+
+/**
+ * @brief A client's subscription, compiled from its JSON into masks and bounds.
+ *
+ * Matching a frame is a type bit test plus, for radio frames, a protocol bit
+ * test and two compares; nothing is looked up or parsed per frame. The
+ * symbol range only applies to capture frames, the protocols to decoded
+ * frames, and the RSSI threshold to both. Status frames (flow, zones) only
+ * go by type.
+ */
+struct ws_filter_t {
+  uint32_t types;      // bit per ws_frame_type_t
+  uint32_t protocols;  // bit per protocol_id_t
+  int16_t rssi_min;
+  uint16_t symbols_min;
+  uint16_t symbols_max;
+
+  /**
+   * @brief Everything, as for a client that never subscribed.
+   */
+  static ws_filter_t all() {
+    return { UINT32_MAX, UINT32_MAX, INT16_MIN, 0, UINT16_MAX };
+  }
+
+  bool matches(const ws_frame_info_t &frame) const {
+    if (!(types >> frame.type & 1)) {
+      return false;
+    }
+    switch (frame.type) {
+      case WS_FRAME_CAPTURE:
+        return frame.rssi >= rssi_min && frame.symbols >= symbols_min && frame.symbols <= symbols_max;
+      case WS_FRAME_EVENT:
+      case WS_FRAME_REPEAT:
+        return frame.protocol < 32 && (protocols >> frame.protocol & 1) && frame.rssi >= rssi_min;
+      default:
+        return true;
+    }
+  }
+
+  /**
+   * @brief Compile a subscription message into a copy of this filter.
+   *
+   * `{"raw": bool, "decoded": bool, "status": bool, "protocols": ["hcs301", 2],
+   * "rssi_min": -80, "symbols": [20, 200]}`. Members left out keep their
+   * value; `protocols`, `rssi_min` or `symbols` set to anything but an array
+   * or a number (e.g. null) go back to matching any.
+   *
+   * @return false, and `out` untouched, if a member is malformed.
+   */
+  bool compile(const cJSON *json, ws_filter_t *out) const {
+    ws_filter_t filter = *this;
+    if (!setTypes(json, "raw", 1u << WS_FRAME_CAPTURE, &filter) ||
+        !setTypes(json, "decoded", WS_FILTER_TYPES_DECODED, &filter) ||
+        !setTypes(json, "status", WS_FILTER_TYPES_STATUS, &filter)) {
+      return false;
+    }
+    const cJSON *item = cJSON_GetObjectItem(json, "protocols");
+    if (item) {
+      filter.protocols = cJSON_IsArray(item) ? 0 : UINT32_MAX;
+      for (int i = 0; cJSON_IsArray(item) && i < cJSON_GetArraySize(item); i++) {
+        int id = protocolId(cJSON_GetArrayItem(item, i));
+        if (id < 0) {
+          return false;
+        }
+        filter.protocols |= 1u << id;
+      }
+    }
+    if ((item = cJSON_GetObjectItem(json, "rssi_min"))) {
+      filter.rssi_min = cJSON_IsNumber(item) ? (int16_t)cJSON_GetNumberValue(item) : INT16_MIN;
+    }
+    if ((item = cJSON_GetObjectItem(json, "symbols"))) {
+      filter.symbols_min = 0;
+      filter.symbols_max = UINT16_MAX;
+      if (cJSON_IsArray(item)) {
+        const cJSON *min = cJSON_GetArrayItem(item, 0);
+        const cJSON *max = cJSON_GetArrayItem(item, 1);
+        if (cJSON_GetArraySize(item) != 2 || !cJSON_IsNumber(min) || !cJSON_IsNumber(max) ||
+            cJSON_GetNumberValue(min) < 0 || cJSON_GetNumberValue(max) < cJSON_GetNumberValue(min)) {
+          return false;
+        }
+        filter.symbols_min = MIN(cJSON_GetNumberValue(min), UINT16_MAX);
+        filter.symbols_max = MIN(cJSON_GetNumberValue(max), UINT16_MAX);
+      }
+    }
+    *out = filter;
+    return true;
+  }
+
+  void serialize(cJSON *json) const {
+    cJSON_AddBoolToObject(json, "raw", types >> WS_FRAME_CAPTURE & 1);
+    cJSON_AddBoolToObject(json, "decoded", (types & WS_FILTER_TYPES_DECODED) != 0);
+    cJSON_AddBoolToObject(json, "status", (types & WS_FILTER_TYPES_STATUS) != 0);
+    if (protocols != UINT32_MAX) {
+      cJSON *array = cJSON_AddArrayToObject(json, "protocols");
+      for (uint8_t id = 0; id < 32; id++) {
+        if (protocols >> id & 1) {
+          cJSON_AddItemToArray(array, id < sizeof(ws_filter_protocol_names) / sizeof(ws_filter_protocol_names[0])
+                                        ? cJSON_CreateString(ws_filter_protocol_names[id])
+                                        : cJSON_CreateNumber(id));
+        }
+      }
+    }
+    if (rssi_min != INT16_MIN) {
+      cJSON_AddNumberToObject(json, "rssi_min", rssi_min);
+    }
+    if (symbols_min != 0 || symbols_max != UINT16_MAX) {
+      cJSON *array = cJSON_AddArrayToObject(json, "symbols");
+      cJSON_AddItemToArray(array, cJSON_CreateNumber(symbols_min));
+      cJSON_AddItemToArray(array, cJSON_CreateNumber(symbols_max));
+    }
+  }
+
+private:
+  static bool setTypes(const cJSON *json, const char *name, uint32_t bits, ws_filter_t *filter) {
+    const cJSON *item = cJSON_GetObjectItem(json, name);
+    if (item == NULL) {
+      return true;
+    }
+    if (!cJSON_IsBool(item)) {
+      return false;
+    }
+    filter->types = cJSON_IsTrue(item) ? filter->types | bits : filter->types & ~bits;
+    return true;
+  }
+
+  /**
+   * @brief protocol_id_t of a name ("hcs301") or a number.
+   *
+   * @return -1 if unknown.
+   */
+  static int protocolId(const cJSON *item) {
+    if (cJSON_IsNumber(item)) {
+      double id = cJSON_GetNumberValue(item);
+      return id >= 0 && id < 32 ? (int)id : -1;
+    }
+    const char *name = cJSON_GetStringValue(item);
+    for (size_t id = 0; name && id < sizeof(ws_filter_protocol_names) / sizeof(ws_filter_protocol_names[0]); id++) {
+      if (strcasecmp(name, ws_filter_protocol_names[id]) == 0) {
+        return id;
+      }
+    }
+    return -1;
+  }
+};
+
+namespace ws_frame
+{
+  /**
+   * @brief Filter info of a serialized frame, for frames not built by the capture pipeline.
+   */
+  inline ws_frame_info_t info(const uint8_t *frame, size_t len)
+  {
+    ws_frame_info_t info = { 0, PROTOCOL_UNKNOWN, 0, 0 };
+    if (len < WS_FRAME_HEADER_SIZE) {
+      return info;
+    }
+    info.type = frame[1];
+    info.rssi = (int8_t)frame[13];
+    if (info.type == WS_FRAME_CAPTURE) {
+      info.symbols = getU16(frame + 3);
+    } else if (info.type == WS_FRAME_EVENT && len > WS_FRAME_HEADER_SIZE) {
+      info.protocol = frame[WS_FRAME_HEADER_SIZE];
+    } else if (info.type == WS_FRAME_REPEAT && len > WS_FRAME_HEADER_SIZE + 8) {
+      info.rssi = (int8_t)frame[WS_FRAME_HEADER_SIZE + 7];
+      info.protocol = frame[WS_FRAME_HEADER_SIZE + 8];
+    }
+    return info;
+  }
+}
@@ -0,0 +1,302 @@
+#pragma once
+#include "rmt_message.h"
+#include "decoded_event.h"
+#include "repeat_folder.h"
+#include <Arduino.h>
+
+/*
+ * Binary WebSocket frame format, version 1.
+ *
+ * All multi-byte header fields are little-endian.
+ *
+ *   offset  size  field
+ *   0       1     version   (WS_FRAME_VERSION)
+ *   1       1     type      (ws_frame_type_t)
+ *   2       1     flags     (WS_FRAME_FLAG_*)
+ *   3       2     length    number of RMT symbols in the body
+ *   5       4     time      capture time, ms since boot
+ *   9       4     delta     us since the previous capture, saturated
+ *   13      1     rssi      dBm, signed
+ *   14      ...   body
+ *
+ * Capture body: for each of the `length` symbols two LEB128 varints, one per
+ * half-symbol, each holding `duration << 1 | level`. Typical remote timings
+ * (64..8191 us) take two bytes per half-symbol.
+ *
+ * Event body (a decoded_event_t; `length` is the payload size in bits):
+ *
+ *   1     protocol  (protocol_id_t)
+ *   n     payload   (length + 7) / 8 bytes, MSB first
+ *   1     field count
+ *   ...   per field: 1 byte field_id_t, LEB128 varint value
+ *
+ * Repeat body (a folded_event_t; header time and RSSI are those of the first
+ * frame, `length` is the payload size in bits):
+ *
+ *   2     repeats   frames in the burst, first one included
+ *   4     last      time of the last frame, ms since boot
+ *   1     rssi_min  dBm, signed
+ *   1     rssi_max  dBm, signed
+ *   ...   event body
+ *
+ * Flow body (a pump flow meter reading; `length` is 0, `delta` is the time
+ * the flow was measured over in us, `rssi` is 0):
+ *
+ *   1     state     1 while the pump runs
+ *   4     pulses    counted since the pump started
+ *   4     volume    ml since the pump started
+ *   4     flow      ml/min
+ *   4     target    ml to deliver, 0 for none
+ *
+ * Zones body (the valve controller's status; `length`, `delta` and `rssi`
+ * are 0; queued runs in the order they are expected to start):
+ *
+ *   1     zone count
+ *   ...   per fitted zone: 1 byte zone, 1 byte open, 2 bytes run id,
+ *         4 bytes ms left
+ *   1     queued run count
+ *   ...   per run: 2 bytes run id, 1 byte zone, 1 byte priority (signed),
+ *         4 bytes ms until it starts, 4 bytes ms until it ends (estimates)
+ */
+
+#define WS_FRAME_VERSION 1
+#define WS_FRAME_HEADER_SIZE 14
+
+#define WS_FRAME_FLAG_TRUNCATED BIT0
+
+/* Worst case: a 15-bit duration plus the level bit needs three varint bytes. */
+#define WS_FRAME_MAX_SIZE (WS_FRAME_HEADER_SIZE + RMT_MEM_NUM_BLOCKS_4 * RMT_SYMBOLS_PER_CHANNEL_BLOCK * 2 * 3)
+
+#define WS_FRAME_EVENT_MAX_SIZE (WS_FRAME_HEADER_SIZE + 2 + DECODED_EVENT_MAX_PAYLOAD + DECODED_EVENT_MAX_FIELDS * 6)
+#define WS_FRAME_REPEAT_MAX_SIZE (WS_FRAME_EVENT_MAX_SIZE + 8)
+#define WS_FRAME_FLOW_SIZE (WS_FRAME_HEADER_SIZE + 17)
+
+typedef enum : uint8_t {
+  WS_FRAME_CAPTURE = 1,
+  WS_FRAME_EVENT = 2,
+  WS_FRAME_REPEAT = 3,
+  WS_FRAME_FLOW = 4,
+  WS_FRAME_ZONES = 5,
+} ws_frame_type_t;
+
+namespace ws_frame
+{
+  inline uint8_t *putU16(uint8_t *p, uint16_t v)
+  {
+    p[0] = v;
+    p[1] = v >> 8;
+    return p + 2;
+  }
+
+  inline uint8_t *putU32(uint8_t *p, uint32_t v)
+  {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+    return p + 4;
+  }
+
+  inline uint8_t *putVarint(uint8_t *p, uint32_t v)
+  {
+    while (v >= 0x80) {
+      *p++ = (v & 0x7f) | 0x80;
+      v >>= 7;
+    }
+    *p++ = v;
+    return p;
+  }
+
+  /**
+   * @brief Write the common frame header.
+   *
+   * @return Pointer just past the header.
+   */
+  inline uint8_t *putHeader(uint8_t *p, ws_frame_type_t type, uint8_t flags, uint16_t length, uint32_t time, int64_t delta, int rssi)
+  {
+    *p++ = WS_FRAME_VERSION;
+    *p++ = type;
+    *p++ = flags;
+    p = putU16(p, length);
+    p = putU32(p, time);
+    p = putU32(p, delta < 0 ? 0 : delta > UINT32_MAX ? UINT32_MAX : (uint32_t)delta);
+    *p++ = (int8_t)(rssi < INT8_MIN ? INT8_MIN : rssi > INT8_MAX ? INT8_MAX : rssi);
+    return p;
+  }
+
+  /**
+   * @brief Serialize a capture into a version 1 capture frame.
+   *
+   * Only the first `msg->length` symbols are written. If `out` cannot hold all
+   * of them, the frame is cut at a symbol boundary and flagged as truncated.
+   *
+   * @param msg The capture to serialize.
+   * @param out Output buffer, WS_FRAME_MAX_SIZE bytes always suffice.
+   * @param size Size of `out`.
+   * @return Number of bytes written, 0 if `out` cannot even hold the header.
+   */
+  inline size_t encodeCapture(const rmt_message_t *msg, uint8_t *out, size_t size)
+  {
+    if (size < WS_FRAME_HEADER_SIZE) {
+      return 0;
+    }
+    uint8_t *end = out + size;
+    uint8_t *p = out + WS_FRAME_HEADER_SIZE;
+    uint16_t length = 0;
+    for (; length < msg->length; length++) {
+      if (end - p < 6) {
+        break;
+      }
+      const rmt_data_t &s = msg->buf[length];
+      p = putVarint(p, (uint32_t)s.duration0 << 1 | s.level0);
+      p = putVarint(p, (uint32_t)s.duration1 << 1 | s.level1);
+    }
+    uint8_t flags = length < msg->length ? WS_FRAME_FLAG_TRUNCATED : 0;
+    putHeader(out, WS_FRAME_CAPTURE, flags, length, msg->time, msg->delta, msg->rssi);
+    return p - out;
+  }
+
+  inline uint16_t getU16(const uint8_t *p)
+  {
+    return p[0] | p[1] << 8;
+  }
+
+  inline uint32_t getU32(const uint8_t *p)
+  {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+  }
+
+  /**
+   * @brief Read a LEB128 varint of at most 5 bytes.
+   *
+   * @return Pointer past the varint, nullptr if it runs past `end`.
+   */
+  inline const uint8_t *getVarint(const uint8_t *p, const uint8_t *end, uint32_t *v)
+  {
+    uint32_t value = 0;
+    for (int shift = 0; p < end && shift < 35; shift += 7) {
+      uint8_t b = *p++;
+      value |= (uint32_t)(b & 0x7f) << shift;
+      if (!(b & 0x80)) {
+        *v = value;
+        return p;
+      }
+    }
+    return nullptr;
+  }
+
+  inline uint8_t *putEventBody(uint8_t *p, const decoded_event_t *event)
+  {
+    *p++ = event->protocol;
+    uint8_t bytes = (event->nbits + 7) / 8;
+    memcpy(p, event->payload, bytes);
+    p += bytes;
+    *p++ = event->n_fields;
+    for (uint8_t i = 0; i < event->n_fields; i++) {
+      *p++ = event->fields[i].id;
+      p = putVarint(p, event->fields[i].value);
+    }
+    return p;
+  }
+
+  /**
+   * @brief Parse a capture frame back into a capture. Inverse of encodeCapture().
+   *
+   * @param in The frame.
+   * @param size Size of the frame.
+   * @param msg Filled with the capture; `delta` and `rssi` are the saturated header values.
+   * @return true if `in` is a complete version 1 capture frame that fits `msg`.
+   */
+  inline bool decodeCapture(const uint8_t *in, size_t size, rmt_message_t *msg)
+  {
+    if (size < WS_FRAME_HEADER_SIZE || in[0] != WS_FRAME_VERSION || in[1] != WS_FRAME_CAPTURE) {
+      return false;
+    }
+    uint16_t length = getU16(in + 3);
+    if (length > sizeof(msg->buf) / sizeof(msg->buf[0])) {
+      return false;
+    }
+    const uint8_t *end = in + size;
+    const uint8_t *p = in + WS_FRAME_HEADER_SIZE;
+    for (uint16_t i = 0; i < length; i++) {
+      uint32_t half0, half1;
+      if (!(p = getVarint(p, end, &half0)) || !(p = getVarint(p, end, &half1))) {
+        return false;
+      }
+      msg->buf[i].level0 = half0 & 1;
+      msg->buf[i].duration0 = half0 >> 1;
+      msg->buf[i].level1 = half1 & 1;
+      msg->buf[i].duration1 = half1 >> 1;
+    }
+    msg->length = length;
+    msg->time = getU32(in + 5);
+    msg->delta = getU32(in + 9);
+    msg->rssi = (int8_t)in[13];
+    return p == end;
+  }
+
+  /**
+   * @brief Serialize a decoded event into a version 1 event frame.
+   *
+   * @param event The event to serialize.
+   * @param out Output buffer, WS_FRAME_EVENT_MAX_SIZE bytes always suffice.
+   * @param size Size of `out`.
+   * @return Number of bytes written, 0 if `out` is too small.
+   */
+  inline size_t encodeEvent(const decoded_event_t *event, uint8_t *out, size_t size)
+  {
+    if (size < WS_FRAME_EVENT_MAX_SIZE) {
+      return 0;
+    }
+    uint8_t *p = putHeader(out, WS_FRAME_EVENT, 0, event->nbits, event->time, event->delta, event->rssi);
+    return putEventBody(p, event) - out;
+  }
+
+  /**
+   * @brief Serialize a burst of repeated events into a version 1 repeat frame.
+   *
+   * @param folded The burst to serialize.
+   * @param out Output buffer, WS_FRAME_REPEAT_MAX_SIZE bytes always suffice.
+   * @param size Size of `out`.
+   * @return Number of bytes written, 0 if `out` is too small.
+   */
+  inline size_t encodeRepeat(const folded_event_t *folded, uint8_t *out, size_t size)
+  {
+    if (size < WS_FRAME_REPEAT_MAX_SIZE) {
+      return 0;
+    }
+    const decoded_event_t *event = &folded->event;
+    uint8_t *p = putHeader(out, WS_FRAME_REPEAT, 0, event->nbits, folded->first_time, event->delta, event->rssi);
+    p = putU16(p, folded->repeats);
+    p = putU32(p, folded->last_time);
+    *p++ = folded->rssi_min;
+    *p++ = folded->rssi_max;
+    return putEventBody(p, event) - out;
+  }
+
+  /**
+   * @brief Serialize a flow meter reading into a version 1 flow frame.
+   *
+   * @param time Time of the reading, ms since boot.
+   * @param interval_ms Time the flow was measured over.
+   * @param on Whether the pump runs.
+   * @param pulses, volume_ml, flow_ml_min, target_ml The reading.
+   * @param out Output buffer of at least WS_FRAME_FLOW_SIZE bytes.
+   * @param size Size of `out`.
+   * @return Number of bytes written, 0 if `out` is too small.
+   */
+  inline size_t encodeFlow(uint32_t time, uint32_t interval_ms, bool on, uint32_t pulses, uint32_t volume_ml,
+                           uint32_t flow_ml_min, uint32_t target_ml, uint8_t *out, size_t size)
+  {
+    if (size < WS_FRAME_FLOW_SIZE) {
+      return 0;
+    }
+    uint8_t *p = putHeader(out, WS_FRAME_FLOW, 0, 0, time, (int64_t)interval_ms * 1000, 0);
+    *p++ = on;
+    p = putU32(p, pulses);
+    p = putU32(p, volume_ml);
+    p = putU32(p, flow_ml_min);
+    p = putU32(p, target_ml);
+    return p - out;
+  }
+}
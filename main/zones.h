@@ -0,0 +1,624 @@
+#pragma once
+#include <Arduino.h>
+#include <cJSON.h>
+#include "main.h"
+#include "http_server.h"
+#include "timer_service.h"
+#include "ws_frame.h"
+#include "freertos/semphr.h"
+
+#define TAG_ZONES "ZONES"
+
+#define ZONES_MAX 8
+#define ZONE_LINES_MAX 4
+#define ZONE_QUEUE_SIZE 32
+#define ZONE_NAME_SIZE 24
+
+/* The pump is held this long past the last open zone's time, so it outlasts the valve timers. */
+#define ZONES_PUMP_MARGIN_MS 2000
+
+#define ZONES_CONFIG_PATH "/spiffs/zones.json"
+#define ZONE_CONFIG_PATH "/spiffs/zone%u.json"
+
+#define WS_FRAME_ZONES_MAX_SIZE (WS_FRAME_HEADER_SIZE + 2 + ZONES_MAX * 8 + ZONE_QUEUE_SIZE * 12)
+
+/**
+ * @brief A watering zone: a valve on one of the supply lines.
+ */
+struct zone_settings_t {
+  char name[ZONE_NAME_SIZE];
+  int pin;                  // valve output, -1 when the zone is not fitted
+  bool inverted;
+  uint8_t line;             // supply line the zone is on
+  float liters_per_minute;  // to turn volumes into run times
+  uint32_t max_run_ms;      // runs are cut to this, 0 for no limit
+};
+
+/**
+ * @brief A run of a zone, queued or in progress.
+ *
+ * Queued runs start by `priority`, highest first, and in the order they were
+ * queued among equal priorities, so with all priorities 0 the queue is FIFO.
+ */
+struct zone_run_t {
+  uint16_t id;
+  uint8_t zone;
+  int8_t priority;
+  uint32_t duration_ms;
+  uint32_t seq;
+};
+
+/**
+ * @brief One valve, with its config file and its timer in timer_service.
+ */
+class Zone
+{
+public:
+  zone_settings_t settings = { "", -1, false, 0, 10.0f, 60 * 60000 };
+  soft_timer_t timer;
+  uint16_t run = 0;  // id of the run in progress, 0 when closed
+
+  bool fitted() const { return settings.pin >= 0; }
+  bool isOpen() const { return run != 0; }
+
+  void open(uint16_t run_id, uint32_t duration_ms) {
+    run = run_id;
+    digitalWrite(settings.pin, settings.inverted ? LOW : HIGH);
+    timer_service.armMs(&timer, duration_ms);
+  }
+
+  void close() {
+    timer_service.cancel(&timer);
+    run = 0;
+    if (fitted()) {
+      digitalWrite(settings.pin, settings.inverted ? HIGH : LOW);
+    }
+  }
+
+  void setup() {
+    if (fitted()) {
+      pinMode(settings.pin, OUTPUT);
+      close();
+    }
+  }
+
+  bool loadConfig(uint8_t index) {
+    char path[32];
+    snprintf(path, sizeof(path), ZONE_CONFIG_PATH, index);
+    cJSON *json = nullptr;
+    JsonConfig::load(path, &json);
+    if (json == nullptr) {
+      return false;
+    }
+    deserializeSettings(json);
+    cJSON_Delete(json);
+    return true;
+  }
+
+  void saveConfig(uint8_t index) {
+    char path[32];
+    snprintf(path, sizeof(path), ZONE_CONFIG_PATH, index);
+    cJSON *json = cJSON_CreateObject();
+    serializeSettings(json);
+    JsonConfig::save(path, json);
+    cJSON_Delete(json);
+  }
+
+  void serializeSettings(cJSON *json) const {
+    cJSON_AddStringToObject(json, "name", settings.name);
+    cJSON_AddNumberToObject(json, "pin", settings.pin);
+    cJSON_AddBoolToObject(json, "inverted", settings.inverted);
+    cJSON_AddNumberToObject(json, "line", settings.line);
+    cJSON_AddNumberToObject(json, "liters_per_minute", settings.liters_per_minute);
+    cJSON_AddNumberToObject(json, "max_run_ms", settings.max_run_ms);
+  }
+
+  void deserializeSettings(const cJSON *json) {
+    const char *name = cJSON_GetStringValue(cJSON_GetObjectItem(json, "name"));
+    if (name) {
+      strlcpy(settings.name, name, sizeof(settings.name));
+    }
+    settings.pin = JSON_OBJECT_NOT_NULL(json, "pin", settings.pin);
+    const cJSON *inverted = cJSON_GetObjectItem(json, "inverted");
+    if (cJSON_IsBool(inverted)) {
+      settings.inverted = cJSON_IsTrue(inverted);
+    }
+    settings.line = MIN((int)JSON_OBJECT_NOT_NULL(json, "line", settings.line), ZONE_LINES_MAX - 1);
+    settings.liters_per_minute = JSON_OBJECT_NOT_NULL(json, "liters_per_minute", settings.liters_per_minute);
+    settings.max_run_ms = JSON_OBJECT_NOT_NULL(json, "max_run_ms", settings.max_run_ms);
+  }
+};
+
+/**
+ * @brief Runs the zones from a queue, at most `max_concurrent` at a time per supply line.
+ *
+ * Runs are queued by HTTP, the pump scheduler or remotes, and started by the
+ * controller task as soon as their zone is closed and their line has room.
+ * A zone closes on its own timer; the timer wakes the task, which starts
+ * whatever can start next, so a sequence of zones needs no round-trip. After
+ * every change the status, with the estimated start and end of each queued
+ * run, goes to the on_status callback (a WebSocket frame on the device).
+ *
+ * Each zone has its own config file, ZONE_CONFIG_PATH; the lines are set in
+ * ZONES_CONFIG_PATH. Everything is guarded by one mutex, and valves are only
+ * switched with it held.
+ */
+class ZoneController
+{
+public:
+  void set_on_status(std::function<void()> on_status) {
+    on_status_ = on_status;
+  }
+
+  /**
+   * @brief Called whenever a zone opens or closes, with the number of open zones and
+   * the longest time one of them has left, e.g. to hold the supply pump that long.
+   */
+  void set_on_active(std::function<void(uint8_t, uint32_t)> on_active) {
+    on_active_ = on_active;
+  }
+
+  bool init() {
+    mutex_ = xSemaphoreCreateMutexStatic(&mutexBuffer_);
+    timer_service.init();
+    loadConfig();
+    uint8_t fitted = 0;
+    for (uint8_t i = 0; i < ZONES_MAX; i++) {
+      zones_[i].timer = soft_timer_t(onTimer, this);
+      zones_[i].loadConfig(i);
+      zones_[i].setup();
+      fitted += zones_[i].fitted();
+    }
+    ESP_LOGI(TAG_ZONES, "%d zones fitted", fitted);
+    return xTaskCreate(task, "zones", 1024 * 3, this, 3, &task_) == pdPASS;
+  }
+
+  /**
+   * @brief Queue a run of `zone`.
+   *
+   * @return The id of the run, -1 if the zone is not fitted, the duration is 0 or the queue is full.
+   */
+  int enqueue(uint8_t zone, uint32_t duration_ms, int8_t priority = 0) {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    int id = -1;
+    if (zone < ZONES_MAX && zones_[zone].fitted() && duration_ms > 0 && queued_ < ZONE_QUEUE_SIZE) {
+      uint32_t max_run_ms = zones_[zone].settings.max_run_ms;
+      zone_run_t &run = queue_[queued_++];
+      run.id = id = nextId();
+      run.zone = zone;
+      run.priority = priority;
+      run.duration_ms = max_run_ms ? MIN(duration_ms, max_run_ms) : duration_ms;
+      run.seq = seq_++;
+    }
+    xSemaphoreGive(mutex_);
+    wake();
+    return id;
+  }
+
+  /**
+   * @brief Run time to deliver `liters` through `zone`, 0 if unknown.
+   */
+  uint32_t durationForLiters(uint8_t zone, float liters) {
+    if (zone >= ZONES_MAX || zones_[zone].settings.liters_per_minute <= 0 || liters <= 0) {
+      return 0;
+    }
+    return liters / zones_[zone].settings.liters_per_minute * 60000;
+  }
+
+  /**
+   * @brief Drop a queued run, or end it if it is in progress.
+   */
+  bool cancel(uint16_t id) {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    bool found = false;
+    for (uint8_t i = 0; i < queued_ && !found; i++) {
+      if (queue_[i].id == id) {
+        queue_[i] = queue_[--queued_];
+        found = true;
+      }
+    }
+    for (auto &zone : zones_) {
+      if (!found && zone.run == id) {
+        timer_service.cancel(&zone.timer);  // the task closes it
+        found = true;
+      }
+    }
+    xSemaphoreGive(mutex_);
+    wake();
+    return found;
+  }
+
+  /**
+   * @brief Close every zone and empty the queue.
+   */
+  void stopAll() {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    queued_ = 0;
+    for (auto &zone : zones_) {
+      timer_service.cancel(&zone.timer);
+    }
+    xSemaphoreGive(mutex_);
+    wake();
+  }
+
+  /**
+   * @brief Change the settings of `zone` present in `json` and save them. Closes the zone if open.
+   */
+  bool setZoneConfig(uint8_t zone, const cJSON *json) {
+    if (zone >= ZONES_MAX) {
+      return false;
+    }
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    Zone &z = zones_[zone];
+    z.close();
+    z.deserializeSettings(json);
+    z.setup();
+    z.saveConfig(zone);
+    xSemaphoreGive(mutex_);
+    wake();
+    return true;
+  }
+
+  /**
+   * @brief Set the concurrency of the supply lines, e.g. `[1, 2]`, and save it.
+   */
+  bool setLines(const cJSON *json) {
+    int count = cJSON_GetArraySize(json);
+    if (!cJSON_IsArray(json) || count == 0 || count > ZONE_LINES_MAX) {
+      return false;
+    }
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    parseLines(json);
+    saveConfig();
+    xSemaphoreGive(mutex_);
+    wake();
+    return true;
+  }
+
+  /**
+   * @brief Write the lines, the zones and the queue with estimated times to `json`.
+   */
+  void serialize(cJSON *json) {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    uint32_t start_in[ZONE_QUEUE_SIZE];
+    uint32_t done_in[ZONE_QUEUE_SIZE];
+    uint8_t order[ZONE_QUEUE_SIZE];
+    estimate(order, start_in, done_in);
+    cJSON *lines = cJSON_AddArrayToObject(json, "lines");
+    for (uint8_t line = 0; line < lines_; line++) {
+      cJSON *item = cJSON_CreateObject();
+      cJSON_AddNumberToObject(item, "max_concurrent", maxConcurrent_[line]);
+      cJSON_AddNumberToObject(item, "active", activeOn(line));
+      cJSON_AddItemToArray(lines, item);
+    }
+    cJSON *zones = cJSON_AddArrayToObject(json, "zones");
+    for (uint8_t i = 0; i < ZONES_MAX; i++) {
+      const Zone &zone = zones_[i];
+      if (!zone.fitted()) {
+        continue;
+      }
+      cJSON *item = cJSON_CreateObject();
+      cJSON_AddNumberToObject(item, "id", i);
+      zone.serializeSettings(item);
+      cJSON_AddBoolToObject(item, "open", zone.isOpen());
+      if (zone.isOpen()) {
+        cJSON_AddNumberToObject(item, "run", zone.run);
+        cJSON_AddNumberToObject(item, "remaining_ms", remainingMs(zone));
+      }
+      cJSON_AddItemToArray(zones, item);
+    }
+    cJSON *queue = cJSON_AddArrayToObject(json, "queue");
+    for (uint8_t i = 0; i < queued_; i++) {
+      const zone_run_t &run = queue_[order[i]];
+      cJSON *item = cJSON_CreateObject();
+      cJSON_AddNumberToObject(item, "id", run.id);
+      cJSON_AddNumberToObject(item, "zone", run.zone);
+      cJSON_AddNumberToObject(item, "priority", run.priority);
+      cJSON_AddNumberToObject(item, "duration_ms", run.duration_ms);
+      cJSON_AddNumberToObject(item, "start_in_ms", start_in[i]);
+      cJSON_AddNumberToObject(item, "done_in_ms", done_in[i]);
+      cJSON_AddItemToArray(queue, item);
+    }
+    xSemaphoreGive(mutex_);
+  }
+
+  /**
+   * @brief Serialize the status into a version 1 zones frame, see ws_frame.h.
+   *
+   * @param out Output buffer, WS_FRAME_ZONES_MAX_SIZE bytes always suffice.
+   * @return Number of bytes written, 0 if `out` is too small.
+   */
+  size_t encodeStatus(uint8_t *out, size_t size) {
+    if (size < WS_FRAME_ZONES_MAX_SIZE) {
+      return 0;
+    }
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    uint32_t start_in[ZONE_QUEUE_SIZE];
+    uint32_t done_in[ZONE_QUEUE_SIZE];
+    uint8_t order[ZONE_QUEUE_SIZE];
+    estimate(order, start_in, done_in);
+    uint8_t *p = ws_frame::putHeader(out, WS_FRAME_ZONES, 0, 0, millis(), 0, 0);
+    uint8_t *count = p++;
+    *count = 0;
+    for (uint8_t i = 0; i < ZONES_MAX; i++) {
+      const Zone &zone = zones_[i];
+      if (zone.fitted()) {
+        *p++ = i;
+        *p++ = zone.isOpen();
+        p = ws_frame::putU16(p, zone.run);
+        p = ws_frame::putU32(p, zone.isOpen() ? remainingMs(zone) : 0);
+        (*count)++;
+      }
+    }
+    *p++ = queued_;
+    for (uint8_t i = 0; i < queued_; i++) {
+      const zone_run_t &run = queue_[order[i]];
+      p = ws_frame::putU16(p, run.id);
+      *p++ = run.zone;
+      *p++ = run.priority;
+      p = ws_frame::putU32(p, start_in[i]);
+      p = ws_frame::putU32(p, done_in[i]);
+    }
+    xSemaphoreGive(mutex_);
+    return p - out;
+  }
+
+private:
+  Zone zones_[ZONES_MAX];
+  zone_run_t queue_[ZONE_QUEUE_SIZE];
+  uint8_t queued_ = 0;
+  uint8_t lines_ = 1;
+  uint8_t maxConcurrent_[ZONE_LINES_MAX] = { 1, 1, 1, 1 };
+  uint8_t active_ = 0;
+  uint16_t lastId_ = 0;
+  uint32_t seq_ = 0;
+  SemaphoreHandle_t mutex_ = NULL;
+  StaticSemaphore_t mutexBuffer_;
+  TaskHandle_t task_ = NULL;
+  std::function<void()> on_status_;
+  std::function<void(uint8_t, uint32_t)> on_active_;
+
+  static void onTimer(void *arg) {
+    static_cast<ZoneController *>(arg)->wake();
+  }
+
+  void wake() {
+    if (task_) {
+      xTaskNotifyGive(task_);
+    }
+  }
+
+  /**
+   * @brief Close the zones whose time is up and start what can start, until nothing changes.
+   */
+  static void task(void *arg) {
+    ZoneController *this_ = static_cast<ZoneController *>(arg);
+    for (;;) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      xSemaphoreTake(this_->mutex_, portMAX_DELAY);
+      bool changed = this_->closeFinished();
+      changed |= this_->startNext();
+      uint8_t active = this_->activeOn(-1);
+      bool active_changed = changed || active != this_->active_;
+      this_->active_ = active;
+      uint32_t remaining_ms = 0;
+      for (auto &zone : this_->zones_) {
+        remaining_ms = zone.isOpen() ? MAX(remaining_ms, this_->remainingMs(zone)) : remaining_ms;
+      }
+      xSemaphoreGive(this_->mutex_);
+      if (active_changed && this_->on_active_) {
+        this_->on_active_(active, remaining_ms);
+      }
+      if (changed && this_->on_status_) {
+        this_->on_status_();
+      }
+    }
+    vTaskDelete(NULL);
+  }
+
+  bool closeFinished() {
+    bool changed = false;
+    for (uint8_t i = 0; i < ZONES_MAX; i++) {
+      Zone &zone = zones_[i];
+      if (zone.isOpen() && !timer_service.isArmed(&zone.timer)) {
+        ESP_LOGI(TAG_ZONES, "Zone %d closed, run %d", i, zone.run);
+        zone.close();
+        changed = true;
+      }
+    }
+    return changed;
+  }
+
+  /**
+   * @brief Start queued runs by priority and queue order while their zone is closed and their line has room.
+   *
+   * A run that has to wait does not hold up runs on other lines or zones behind it.
+   */
+  bool startNext() {
+    bool changed = false;
+    for (;;) {
+      int best = -1;
+      for (uint8_t i = 0; i < queued_; i++) {
+        const zone_run_t &run = queue_[i];
+        const Zone &zone = zones_[run.zone];
+        if (zone.isOpen() || !zone.fitted() || activeOn(zone.settings.line) >= maxConcurrent_[zone.settings.line]) {
+          continue;
+        }
+        if (best < 0 || before(run, queue_[best])) {
+          best = i;
+        }
+      }
+      if (best < 0) {
+        return changed;
+      }
+      zone_run_t run = queue_[best];
+      queue_[best] = queue_[--queued_];
+      ESP_LOGI(TAG_ZONES, "Zone %d open for %lu ms, run %d", run.zone, (unsigned long)run.duration_ms, run.id);
+      zones_[run.zone].open(run.id, run.duration_ms);
+      changed = true;
+    }
+  }
+
+  static bool before(const zone_run_t &a, const zone_run_t &b) {
+    return a.priority != b.priority ? a.priority > b.priority : (int32_t)(a.seq - b.seq) < 0;
+  }
+
+  /**
+   * @brief Open zones on `line`, or on all lines for -1.
+   */
+  uint8_t activeOn(int line) const {
+    uint8_t active = 0;
+    for (auto &zone : zones_) {
+      active += zone.isOpen() && (line < 0 || zone.settings.line == line);
+    }
+    return active;
+  }
+
+  uint32_t remainingMs(const Zone &zone) const {
+    int32_t remaining = timer_service.remainingMs(&zone.timer);
+    return remaining < 0 ? 0 : remaining;
+  }
+
+  uint16_t nextId() {
+    lastId_ = lastId_ == UINT16_MAX ? 1 : lastId_ + 1;
+    return lastId_;
+  }
+
+  /**
+   * @brief Sort the queue into start order and estimate when each run starts and ends, from now.
+   *
+   * Plays the queue out on each line's concurrency slots, which start out
+   * busy for the remaining time of the open zones. `order[i]` is the queue
+   * index of the i-th run to start.
+   */
+  void estimate(uint8_t *order, uint32_t *start_in, uint32_t *done_in) {
+    uint32_t zone_free[ZONES_MAX];
+    uint32_t slots[ZONE_LINES_MAX][ZONES_MAX] = {};
+    uint8_t used[ZONE_LINES_MAX] = {};
+    for (uint8_t i = 0; i < ZONES_MAX; i++) {
+      const Zone &zone = zones_[i];
+      zone_free[i] = zone.isOpen() ? remainingMs(zone) : 0;
+      uint8_t line = zone.settings.line;
+      if (zone.isOpen() && used[line] < ZONES_MAX) {
+        slots[line][used[line]++] = zone_free[i];
+      }
+    }
+    for (uint8_t i = 0; i < queued_; i++) {
+      uint8_t j = i;
+      for (; j > 0 && before(queue_[i], queue_[order[j - 1]]); j--) {
+        order[j] = order[j - 1];
+      }
+      order[j] = i;
+    }
+    for (uint8_t i = 0; i < queued_; i++) {
+      const zone_run_t &run = queue_[order[i]];
+      uint8_t line = zones_[run.zone].settings.line;
+      uint8_t slot_count = MAX(MIN(maxConcurrent_[line], ZONES_MAX), 1);
+      uint8_t earliest = 0;
+      for (uint8_t s = 1; s < slot_count; s++) {
+        earliest = slots[line][s] < slots[line][earliest] ? s : earliest;
+      }
+      start_in[i] = MAX(slots[line][earliest], zone_free[run.zone]);
+      done_in[i] = start_in[i] + run.duration_ms;
+      slots[line][earliest] = done_in[i];
+      zone_free[run.zone] = done_in[i];
+    }
+  }
+
+  void parseLines(const cJSON *json) {
+    lines_ = MIN(MAX(cJSON_GetArraySize(json), 1), ZONE_LINES_MAX);
+    for (uint8_t i = 0; i < lines_; i++) {
+      const cJSON *item = cJSON_GetArrayItem(json, i);
+      maxConcurrent_[i] = cJSON_IsNumber(item) ? MAX((int)cJSON_GetNumberValue(item), 1) : 1;
+    }
+  }
+
+  void loadConfig() {
+    cJSON *json = nullptr;
+    JsonConfig::load(ZONES_CONFIG_PATH, &json);
+    if (json == nullptr) {
+      ESP_LOGW(TAG_ZONES, "No %s, one line, one zone at a time", ZONES_CONFIG_PATH);
+      return;
+    }
+    parseLines(cJSON_GetObjectItem(json, "lines"));
+    cJSON_Delete(json);
+  }
+
+  void saveConfig() {
+    cJSON *json = cJSON_CreateObject();
+    cJSON *lines = cJSON_AddArrayToObject(json, "lines");
+    for (uint8_t i = 0; i < lines_; i++) {
+      cJSON_AddItemToArray(lines, cJSON_CreateNumber(maxConcurrent_[i]));
+    }
+    JsonConfig::save(ZONES_CONFIG_PATH, json);
+    cJSON_Delete(json);
+  }
+};
+
+ZoneController zones;
+
+static esp_err_t zones_send(httpd_req_t *req)
+{
+  cJSON *json = cJSON_CreateObject();
+  zones.serialize(json);
+  char *str = cJSON_PrintUnformatted(json);
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_sendstr(req, str);
+  cJSON_free(str);
+  cJSON_Delete(json);
+  return ESP_OK;
+}
+
+/**
+ * @brief Handle GET request to /zones: lines, zones and the queue with estimated times.
+ */
+static esp_err_t zones_get_handler(httpd_req_t *req)
+{
+  return zones_send(req);
+}
+
+/**
+ * @brief Handle POST request to /zones.
+ *
+ * `{"zone": 1, "time_ms": 600000}` (or `"liters": 50`, optional `"priority"`)
+ * queues a run; `{"cancel": <run id>}` drops or ends a run; `{"stop": true}`
+ * closes all zones and empties the queue; `{"zone": 1, "config": {...}}`
+ * changes a zone's settings; `{"lines": [1, 2]}` sets how many zones may run
+ * at once on each supply line. Responds with the status, as GET does.
+ */
+static esp_err_t zones_post_handler(httpd_req_t *req)
+{
+  cJSON *json = nullptr;
+  if (httpd_get_JSON(req, &json) != ESP_OK || json == nullptr) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Expected JSON");
+    return ESP_FAIL;
+  }
+  const cJSON *zone = cJSON_GetObjectItem(json, "zone");
+  const cJSON *config = cJSON_GetObjectItem(json, "config");
+  const cJSON *cancel = cJSON_GetObjectItem(json, "cancel");
+  const cJSON *lines = cJSON_GetObjectItem(json, "lines");
+  bool ok = true;
+  if (cJSON_IsTrue(cJSON_GetObjectItem(json, "stop"))) {
+    zones.stopAll();
+  } else if (cJSON_IsNumber(cancel)) {
+    ok = zones.cancel(cJSON_GetNumberValue(cancel));
+  } else if (cJSON_IsArray(lines)) {
+    ok = zones.setLines(lines);
+  } else if (cJSON_IsNumber(zone) && cJSON_IsObject(config)) {
+    ok = zones.setZoneConfig(cJSON_GetNumberValue(zone), config);
+  } else if (cJSON_IsNumber(zone)) {
+    uint8_t id = cJSON_GetNumberValue(zone);
+    uint32_t duration_ms = cJSON_GetObjectItem(json, "liters")
+                             ? zones.durationForLiters(id, cJSON_GetNumberValue(cJSON_GetObjectItem(json, "liters")))
+                             : JSON_OBJECT_NOT_NULL(json, "time_ms", 0);
+    ok = zones.enqueue(id, duration_ms, JSON_OBJECT_NOT_NULL(json, "priority", 0)) >= 0;
+  } else {
+    ok = false;
+  }
+  cJSON_Delete(json);
+  if (!ok) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown zone or run, full queue or bad request");
+    return ESP_FAIL;
+  }
+  return zones_send(req);
+}
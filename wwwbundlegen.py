@@ -0,0 +1,160 @@
+#!/usr/bin/env python
+#
+# wwwbundlegen packs the web UI (data/www) into one read-only blob that is
+# linked into the app, and writes a C++ header with a perfect-hash route table
+# from request path to the blob, see main/web_bundle.h.
+#
+#   wwwbundlegen.py [--max-size bytes] data/www www_bundle.bin www_bundle.h
+#
+# Files are stored gzipped unless that does not make them smaller (images).
+# A file that already ends in .gz is stored as it is, and is skipped when the
+# uncompressed file is there too. Each file answers to its own path and to
+# the path with ".gz"; index.html also answers to "/" and to unknown paths.
+# With --max-size, a bundle larger than that fails the build, so the UI cannot
+# silently eat into the app partition.
+
+from __future__ import print_function
+
+import argparse
+import gzip
+import os
+
+FNV_PRIME = 16777619
+
+
+def fnv1a(seed, data):
+    h = seed
+    for b in bytearray(data):
+        h = ((h ^ b) * FNV_PRIME) & 0xFFFFFFFF
+    return h
+
+
+def route_hash(seed, path):
+    # Must match www_bundle_hash() in main/web_bundle.h.
+    return fnv1a(seed, path.encode())
+
+
+def content_type(name):
+    # Same table as asset_content_type() in main/asset_cache.h.
+    if name.endswith('.gz'):
+        name = name[:-3]
+    ext = os.path.splitext(name)[1].lower()
+    return {
+        '.html': 'text/html',
+        '.json': 'application/json',
+        '.js': 'application/javascript',
+        '.css': 'text/css',
+        '.png': 'image/png',
+        '.ico': 'image/x-icon',
+        '.svg': 'text/xml',
+        '.pvc': 'application/octet-stream',
+    }.get(ext, 'text/plain')
+
+
+def collect(root):
+    names = []
+    for dirpath, _, filenames in os.walk(root):
+        for filename in filenames:
+            names.append(os.path.relpath(os.path.join(dirpath, filename), root).replace(os.sep, '/'))
+    names.sort()
+    assets = []
+    for name in names:
+        if name.endswith('.gz') and name[:-3] in names:
+            continue
+        with open(os.path.join(root, name), 'rb') as f:
+            data = f.read()
+        base = name[:-3] if name.endswith('.gz') else name
+        gzipped = name.endswith('.gz')
+        if not gzipped:
+            packed = gzip.compress(data, 9, mtime=0)
+            if len(packed) < len(data):
+                data, gzipped = packed, True
+        assets.append({'name': base, 'data': data, 'gzip': gzipped})
+    return assets
+
+
+def find_seed(paths, slots):
+    for seed in range(1, 1 << 24):
+        taken = set()
+        for path in paths:
+            slot = route_hash(seed, path) & (slots - 1)
+            if slot in taken:
+                break
+            taken.add(slot)
+        else:
+            return seed
+    raise RuntimeError('no perfect hash seed for %d routes in %d slots' % (len(paths), slots))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Pack a web UI directory into an app-linked bundle')
+    parser.add_argument('root', help='Directory to pack, e.g. data/www')
+    parser.add_argument('blob', help='Output blob, embedded with target_add_binary_data()')
+    parser.add_argument('header', help='Output C++ header with the route table')
+    parser.add_argument('--max-size', type=int, default=0, help='Fail if the bundle is larger, in bytes')
+    args = parser.parse_args()
+
+    assets = collect(args.root)
+    if len(assets) > 127:
+        raise RuntimeError('too many files: %d' % len(assets))
+
+    blob = bytearray()
+    routes = {}
+    fallback = -1
+    for i, asset in enumerate(assets):
+        asset['offset'] = len(blob)
+        blob += asset['data']
+        asset['etag'] = '"%08x"' % fnv1a(2166136261, asset['data'])
+        routes['/' + asset['name']] = i
+        if asset['gzip']:
+            routes['/' + asset['name'] + '.gz'] = i
+        if asset['name'] == 'index.html':
+            routes['/'] = i
+            fallback = i
+
+    if args.max_size and len(blob) > args.max_size:
+        raise SystemExit('www bundle is %d bytes, over its budget of %d (WWW_BUNDLE_MAX_SIZE)' % (len(blob), args.max_size))
+
+    paths = sorted(routes)
+    slots = 1
+    while slots < 2 * len(paths):
+        slots <<= 1
+    seed = find_seed(paths, slots)
+    table = [None] * slots
+    for path in paths:
+        table[route_hash(seed, path) & (slots - 1)] = path
+
+    with open(args.blob, 'wb') as f:
+        f.write(blob)
+
+    lines = [
+        '// Generated by wwwbundlegen.py from %s, do not edit.' % os.path.basename(os.path.normpath(args.root)),
+        '#pragma once',
+        '',
+        '#define WWW_BUNDLE_SIZE %d' % len(blob),
+        '#define WWW_BUNDLE_SEED 0x%08xu' % seed,
+        '#define WWW_BUNDLE_SLOTS %d' % slots,
+        '#define WWW_BUNDLE_FALLBACK %d' % fallback,
+        '',
+        'extern const uint8_t www_bundle_start[] asm("_binary_www_bundle_bin_start");',
+        '',
+        'static const asset_t www_bundle_assets[] = {',
+    ]
+    for asset in assets:
+        ctype = content_type(asset['name'])
+        lines.append('  { "%s", "%s", %s, %s, "%s", %d, www_bundle_start + %d },' % (
+            asset['name'], ctype, '"no-cache"' if ctype == 'text/html' else 'ASSET_CACHE_CONTROL',
+            'true' if asset['gzip'] else 'false', asset['etag'].replace('"', '\\"'), len(asset['data']), asset['offset']))
+    lines += ['};', '', 'static const www_route_t www_bundle_routes[WWW_BUNDLE_SLOTS] = {']
+    for path in table:
+        lines.append('  { "%s", %d },' % (path, routes[path]) if path else '  { NULL, -1 },')
+    lines += ['};', '']
+
+    with open(args.header, 'w') as f:
+        f.write('\n'.join(lines))
+    print('www bundle: %d files, %d routes, %d bytes%s' % (
+        len(assets), len(paths), len(blob), ' of %d' % args.max_size if args.max_size else ''))
+
+
+if __name__ == '__main__':
+    main()